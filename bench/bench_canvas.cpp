@@ -0,0 +1,758 @@
+// Native benchmarks for the canvas engine.
+// Runs headless against the offscreen software renderer and prints ns/op and
+// frame-time percentiles for rendering, hit-testing, snapped dragging, panning,
+// zoomed-out views, circles against rectangles, the grid, saving and loading
+// documents, and SVG import.
+// --check-backends renders the same scenes through the SDL, geometry and
+// software backends and exits non-zero if any frame differs by a single
+// pixel; with --threads the software side rasterizes tiles in parallel.
+// --check-allocations counts heap allocations while rendering, hit-testing
+// and handling input after a warm-up pass, and exits non-zero if there are
+// any.
+//
+// Usage: vectormate_bench [--sizes 1000,100000,1000000] [--frames 200]
+//                         [--backend sdl|software|geometry] [--threads 0]
+//                         [--check-backends] [--check-allocations]
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "canvas.h"
+
+// Every operator new in the process, engine and raster threads included,
+// goes through here so --check-allocations can count them
+static std::atomic<bool> counting_allocations{false};
+static std::atomic<long> allocation_count{0};
+
+void *operator new(size_t size)
+{
+    if (counting_allocations.load(std::memory_order_relaxed)) allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void *p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+const int VIEW_WIDTH = 1280;
+const int VIEW_HEIGHT = 720;
+
+RenderBackend backend = RENDER_BACKEND_SDL;
+int raster_threads = 0;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Samples {
+    std::vector<double> ns;
+
+    void add(Clock::time_point start, Clock::time_point end) {
+        ns.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    double mean() const {
+        double total = 0;
+        for (double v : ns) total += v;
+        return ns.empty() ? 0 : total / ns.size();
+    }
+
+    double percentile(double p) {
+        if (ns.empty()) return 0;
+        std::sort(ns.begin(), ns.end());
+        size_t i = (size_t)(p * (ns.size() - 1) + 0.5);
+        return ns[i];
+    }
+};
+
+void print_header()
+{
+    std::printf("%-22s %10s %12s %10s %10s %10s\n", "benchmark", "shapes", "ns/op", "p50 us", "p90 us", "p99 us");
+}
+
+void report(const char *name, int shapes, Samples &samples)
+{
+    std::printf("%-22s %10d %12.0f %10.1f %10.1f %10.1f\n",
+        name, shapes, samples.mean(),
+        samples.percentile(0.50) / 1000.0,
+        samples.percentile(0.90) / 1000.0,
+        samples.percentile(0.99) / 1000.0);
+}
+
+// Keeps density constant, so a fixed viewport sees roughly the same number of
+// shapes at every document size and the numbers show what culling buys.
+void populate(Canvas &canvas, int count, std::mt19937 &rng)
+{
+    int side = (int)(std::sqrt((double)count) * 40.0);
+    std::uniform_int_distribution<int> pos(-side / 2, side / 2);
+    std::uniform_int_distribution<int> size(4, 60);
+    std::uniform_int_distribution<int> palette(0, 7);
+
+    static const SDL_Color colors[8] = {
+        {231, 76, 60, 255}, {46, 204, 113, 255}, {52, 152, 219, 255}, {241, 196, 15, 255},
+        {155, 89, 182, 255}, {26, 188, 156, 255}, {230, 126, 34, 255}, {236, 240, 241, 128},
+    };
+
+    // One shape in four is a circle
+    canvas.scene.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        ShapeType type = i % 4 == 3 ? ShapeType::CIRCLE : ShapeType::RECTANGLE;
+        canvas.add_shape({type, {pos(rng), pos(rng), size(rng), size(rng)}, colors[palette(rng)]});
+    }
+}
+
+void bench_render(Canvas &canvas, int shapes, int frames)
+{
+    Samples full, idle;
+    for (int i = 0; i < frames; ++i) {
+        canvas.mark_all_dirty();
+        Clock::time_point start = Clock::now();
+        canvas.render();
+        full.add(start, Clock::now());
+    }
+    for (int i = 0; i < frames; ++i) {
+        Clock::time_point start = Clock::now();
+        canvas.render();
+        idle.add(start, Clock::now());
+    }
+    report("render_full", shapes, full);
+    report("render_idle", shapes, idle);
+}
+
+void bench_hit_test(Canvas &canvas, int shapes, int probes, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> px(0, VIEW_WIDTH - 1);
+    std::uniform_int_distribution<int> py(0, VIEW_HEIGHT - 1);
+
+    Samples samples;
+    for (int i = 0; i < probes; ++i) {
+        int x = px(rng), y = py(rng);
+        Clock::time_point start = Clock::now();
+        canvas.handle_mouse_down(x, y, 0);
+        samples.add(start, Clock::now());
+        canvas.handle_mouse_up(x, y, 0);
+    }
+    canvas.render(); // Flush the selection damage so it does not leak into later runs
+    report("hit_test", shapes, samples);
+}
+
+void bench_drag(Canvas &canvas, int shapes, int frames)
+{
+    // A shape on top at the center of the view guarantees the press grabs it
+    ShapeId target = canvas.add_shape({ShapeType::RECTANGLE, {-20, -20, 40, 40}, {255, 255, 255, 255}});
+    canvas.render();
+
+    int x = VIEW_WIDTH / 2, y = VIEW_HEIGHT / 2;
+    canvas.handle_mouse_down(x, y, 0);
+
+    Samples update, frame;
+    for (int i = 0; i < frames; ++i) {
+        x += (i & 16) ? -3 : 3;
+        y += (i & 32) ? -2 : 2;
+
+        Clock::time_point start = Clock::now();
+        canvas.handle_mouse_move(x, y);
+        Clock::time_point moved = Clock::now();
+        canvas.render();
+        Clock::time_point end = Clock::now();
+
+        update.add(start, moved);
+        frame.add(start, end);
+    }
+
+    canvas.handle_mouse_up(x, y, 0);
+    canvas.remove_shape(target);
+    canvas.render();
+
+    report("drag_update", shapes, update);
+    report("drag_frame", shapes, frame);
+}
+
+// Rubber-band selection of up to ~10k shapes, then bulk edits on them. The
+// edits are undone so later benchmarks see the same document.
+void bench_selection(Canvas &canvas, int shapes, int frames)
+{
+    int side = (int)(std::sqrt((double)shapes) * 40.0);
+    int band = std::min(side, (int)(side * std::sqrt(10000.0 / shapes)));
+    SDL_Rect region = {-band / 2, -band / 2, band, band};
+
+    Samples select, move, recolor;
+    for (int i = 0; i < frames; ++i) {
+        Clock::time_point start = Clock::now();
+        canvas.select_rect(region);
+        select.add(start, Clock::now());
+    }
+    int selected = canvas.selection.size();
+
+    for (int i = 0; i < frames; ++i) {
+        Clock::time_point start = Clock::now();
+        canvas.move_selection((i & 1) ? -3 : 3, 2);
+        move.add(start, Clock::now());
+    }
+
+    Clock::time_point start = Clock::now();
+    canvas.set_selection_color({255, 0, 255, 255});
+    recolor.add(start, Clock::now());
+
+    for (int i = 0; i <= frames; ++i) canvas.undo();
+    canvas.clear_selection();
+    canvas.render();
+
+    report("select_rect", selected, select);
+    report("selection_move", selected, move);
+    report("selection_recolor", selected, recolor);
+}
+
+void bench_pan(Canvas &canvas, int shapes, int frames)
+{
+    // Middle-button drag back and forth, so later sweeps revisit cached tiles
+    int x = VIEW_WIDTH / 2, y = VIEW_HEIGHT / 2;
+    canvas.handle_mouse_down(x, y, 1);
+
+    Samples samples;
+    for (int i = 0; i < frames; ++i) {
+        x += (i & 32) ? -9 : 9;
+        y += (i & 64) ? -4 : 4;
+
+        Clock::time_point start = Clock::now();
+        canvas.handle_mouse_move(x, y);
+        canvas.render();
+        samples.add(start, Clock::now());
+    }
+
+    canvas.handle_mouse_up(x, y, 1);
+    canvas.render();
+    report("pan_frame", shapes, samples);
+}
+
+// Full and incremental saves, then loads from memory and from a file
+void bench_scene_file(Canvas &canvas, int shapes)
+{
+    const char *path = "vectormate_bench.vmsc";
+    const int runs = 5;
+    Samples save_full, save_edit, load_memory, save_disk, load_disk;
+
+    for (int i = 0; i < runs; ++i) {
+        canvas.scene_file.reset();
+        Clock::time_point start = Clock::now();
+        canvas.save_scene();
+        save_full.add(start, Clock::now());
+
+        // One edited shape dirties a single chunk
+        canvas.set_shape_color(canvas.scene.ids[canvas.scene.size() / 2], {(Uint8)i, 0, 0, 255});
+        start = Clock::now();
+        canvas.save_scene();
+        save_edit.add(start, Clock::now());
+
+        std::vector<Uint8> document = canvas.scene_buffer;
+        start = Clock::now();
+        canvas.load_scene(document.data(), document.size());
+        load_memory.add(start, Clock::now());
+
+        start = Clock::now();
+        canvas.save_scene_file(path);
+        save_disk.add(start, Clock::now());
+
+        start = Clock::now();
+        canvas.load_scene_file(path);
+        load_disk.add(start, Clock::now());
+    }
+    std::remove(path);
+    canvas.render();
+
+    report("save_full", shapes, save_full);
+    report("save_incremental", shapes, save_edit);
+    report("load_memory", shapes, load_memory);
+    report("save_file", shapes, save_disk);
+    report("load_file", shapes, load_disk);
+}
+
+// Whole document to a 4096px wide PNG and to SVG, stepped as the UI would
+void bench_export(Canvas &canvas, int shapes)
+{
+    int side = (int)(std::sqrt((double)shapes) * 40.0) + 60;
+    SDL_Rect world = {-side / 2, -side / 2, side, side};
+    const ExportFormat formats[] = {EXPORT_PNG, EXPORT_SVG};
+    const char *names[] = {"export_png_4096", "export_svg"};
+
+    for (int f = 0; f < 2; ++f) {
+        Samples samples;
+        size_t bytes = 0;
+        Clock::time_point start = Clock::now();
+        canvas.export_begin(formats[f], world, formats[f] == EXPORT_PNG ? 4096.0f / side : 1.0f);
+        for (int size; (size = canvas.export_step()) >= 0;) bytes += (size_t)size;
+        samples.add(start, Clock::now());
+        report(names[f], shapes, samples);
+        std::printf("%-22s %10d %12.1f MB\n", (std::string(names[f]) + "_size").c_str(), shapes, bytes / 1e6);
+    }
+}
+
+// Full rasterizations of a document of specks at the minimum zoom, where
+// the whole document is in view and most shapes are narrower than a pixel
+void bench_zoomed_out(int count, int frames, std::mt19937 &rng)
+{
+    Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+    canvas.set_raster_threads(raster_threads);
+
+    int side = (int)(std::sqrt((double)count) * 12.0);
+    std::uniform_int_distribution<int> pos(-side / 2, side / 2);
+    std::uniform_int_distribution<int> size(1, 8);
+    std::uniform_int_distribution<int> channel(0, 255);
+    canvas.scene.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        SDL_Color color = {(Uint8)channel(rng), (Uint8)channel(rng), (Uint8)channel(rng), 255};
+        canvas.add_shape({ShapeType::RECTANGLE, {pos(rng), pos(rng), size(rng), size(rng)}, color});
+    }
+    canvas.set_zoom(0.1f);
+
+    Samples samples;
+    for (int i = 0; i < frames; ++i) {
+        canvas.tile_cache.invalidate_all();
+        canvas.mark_all_dirty();
+        Clock::time_point start = Clock::now();
+        canvas.render();
+        samples.add(start, Clock::now());
+    }
+    report("render_zoomed_out", count, samples);
+    canvas.cleanup();
+}
+
+// The same layout drawn as all rectangles and as all circles, rasterized
+// from scratch every frame
+void bench_shape_types(int count, int frames, std::mt19937 &rng)
+{
+    const ShapeType types[] = {ShapeType::RECTANGLE, ShapeType::CIRCLE};
+    const char *names[] = {"render_rects", "render_circles"};
+    Uint32 seed = rng();
+
+    for (int t = 0; t < 2; ++t) {
+        Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+        canvas.set_raster_threads(raster_threads);
+        std::mt19937 layout(seed);
+        std::uniform_int_distribution<int> pos(-VIEW_WIDTH, VIEW_WIDTH);
+        std::uniform_int_distribution<int> size(4, 120);
+        std::uniform_int_distribution<int> channel(0, 255);
+        canvas.scene.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            SDL_Color color = {(Uint8)channel(layout), (Uint8)channel(layout), (Uint8)channel(layout), 200};
+            canvas.add_shape({types[t], {pos(layout), pos(layout), size(layout), size(layout)}, color});
+        }
+        canvas.render();
+
+        Samples samples;
+        for (int i = 0; i < frames; ++i) {
+            canvas.tile_cache.invalidate_all();
+            canvas.mark_all_dirty();
+            Clock::time_point start = Clock::now();
+            canvas.render();
+            samples.add(start, Clock::now());
+        }
+        report(names[t], count, samples);
+        canvas.cleanup();
+    }
+}
+
+void bench_grid(int frames)
+{
+    Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+    canvas.set_raster_threads(raster_threads);
+    while (canvas.scene.size() > 0) canvas.remove_shape(canvas.scene.ids[0]);
+
+    const int sizes[] = {5, 20, 80};
+    for (int grid_size : sizes) {
+        canvas.set_grid_settings(true, grid_size, 173, 172, 172, 33);
+        Samples samples;
+        for (int i = 0; i < frames; ++i) {
+            canvas.mark_all_dirty();
+            Clock::time_point start = Clock::now();
+            canvas.render();
+            samples.add(start, Clock::now());
+        }
+        std::string name = "grid_" + std::to_string(grid_size) + "px";
+        report(name.c_str(), 0, samples);
+    }
+
+    canvas.cleanup();
+}
+
+// A document shaped like a drawing tool export: groups with transforms and
+// inherited fills around rects, circles and ellipses, fills given as
+// attributes, styles and names, and the odd comment
+std::string make_svg(int elements, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<int> pos(0, 20000);
+    std::uniform_int_distribution<int> size(4, 60);
+    std::uniform_int_distribution<int> channel(0, 255);
+
+    std::string svg = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"20000\" height=\"20000\">\n";
+    char line[256];
+    for (int i = 0; i < elements; ++i) {
+        if (i % 100 == 0) {
+            if (i > 0) svg += "</g>\n";
+            std::snprintf(line, sizeof(line), "<!-- group %d -->\n<g fill=\"#%02x%02x%02x\" transform=\"translate(%d, %d)\">\n",
+                          i / 100, channel(rng), channel(rng), channel(rng), pos(rng) / 10, pos(rng) / 10);
+            svg += line;
+        }
+        switch (i % 4) {
+            case 0:
+                std::snprintf(line, sizeof(line), "  <rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\"/>\n",
+                              pos(rng), pos(rng), size(rng), size(rng));
+                break;
+            case 1:
+                std::snprintf(line, sizeof(line), "  <rect x=\"%d.5\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"#%02x%02x%02x\" fill-opacity=\"0.5\"/>\n",
+                              pos(rng), pos(rng), size(rng), size(rng), channel(rng), channel(rng), channel(rng));
+                break;
+            case 2:
+                std::snprintf(line, sizeof(line), "  <circle cx=\"%d\" cy=\"%d\" r=\"%d\" style=\"fill: rgb(%d, %d, %d); stroke: none\"/>\n",
+                              pos(rng), pos(rng), size(rng) / 2, channel(rng), channel(rng), channel(rng));
+                break;
+            default:
+                std::snprintf(line, sizeof(line), "  <ellipse cx=\"%d\" cy=\"%d\" rx=\"%d\" ry=\"%d\" fill=\"teal\"/>\n",
+                              pos(rng), pos(rng), size(rng) / 2, size(rng) / 2);
+                break;
+        }
+        svg += line;
+    }
+    svg += "</g>\n</svg>\n";
+    return svg;
+}
+
+// Parse alone, then parse plus insertion into a fresh canvas
+void bench_svg_import(int elements, std::mt19937 &rng)
+{
+    std::string svg = make_svg(elements, rng);
+    const int runs = 5;
+    Samples parse, import;
+    SvgImporter importer;
+    std::vector<Shape> shapes;
+    int count = 0;
+
+    for (int i = 0; i < runs; ++i) {
+        shapes.clear();
+        Clock::time_point start = Clock::now();
+        count = importer.read(svg.data(), svg.size(), shapes);
+        parse.add(start, Clock::now());
+
+        Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+        start = Clock::now();
+        canvas.import_svg(svg.data(), svg.size());
+        import.add(start, Clock::now());
+        canvas.cleanup();
+    }
+
+    report("svg_parse", count, parse);
+    report("svg_import", count, import);
+    std::printf("%-22s %10d %12.1f MB/s\n", "svg_parse_throughput", count, svg.size() / (parse.percentile(0.5) / 1e9) / 1e6);
+}
+
+// Generated shapes added one call per shape, then as one bulk call, then
+// deleted as one id range
+void bench_bulk_ingest(int count, std::mt19937 &rng)
+{
+    std::vector<SDL_Rect> rects(count);
+    std::vector<SDL_Color> colors(count);
+    std::vector<Uint8> types(count);
+    int side = (int)(std::sqrt((double)count) * 40.0);
+    std::uniform_int_distribution<int> pos(-side / 2, side / 2);
+    std::uniform_int_distribution<int> size(4, 60);
+    for (int i = 0; i < count; ++i) {
+        rects[i] = {pos(rng), pos(rng), size(rng), size(rng)};
+        colors[i] = {(Uint8)rng(), (Uint8)rng(), (Uint8)rng(), 255};
+        types[i] = (Uint8)(rng() % 2);
+    }
+
+    const int runs = 5;
+    Samples each, bulk, remove;
+    for (int i = 0; i < runs; ++i) {
+        Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+        Clock::time_point start = Clock::now();
+        for (int j = 0; j < count; ++j) canvas.add_shape({(ShapeType)types[j], rects[j], colors[j]});
+        each.add(start, Clock::now());
+        canvas.cleanup();
+    }
+    for (int i = 0; i < runs; ++i) {
+        Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+        Clock::time_point start = Clock::now();
+        ShapeId first = canvas.add_shapes(rects.data(), colors.data(), types.data(), count);
+        bulk.add(start, Clock::now());
+
+        start = Clock::now();
+        canvas.remove_shapes(first, count);
+        remove.add(start, Clock::now());
+        canvas.cleanup();
+    }
+
+    report("add_shape_each", count, each);
+    report("add_shapes_bulk", count, bulk);
+    report("remove_shapes_range", count, remove);
+}
+
+// Counts pixels that differ between the two canvases' output surfaces
+int compare_frames(const Canvas &a, const Canvas &b)
+{
+    int mismatches = 0;
+    for (int y = 0; y < a.surface->h; ++y) {
+        const Uint32 *row_a = (const Uint32 *)((const Uint8 *)a.surface->pixels + y * a.surface->pitch);
+        const Uint32 *row_b = (const Uint32 *)((const Uint8 *)b.surface->pixels + y * b.surface->pitch);
+        for (int x = 0; x < a.surface->w; ++x) {
+            if (row_a[x] != row_b[x]) ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Drives every backend through identical full repaints, partial repaints,
+// zoom levels and grid settings, comparing every presented frame with the
+// software one.
+bool check_backends(int count, int frames)
+{
+    Canvas sdl(VIEW_WIDTH, VIEW_HEIGHT, RENDER_BACKEND_SDL);
+    Canvas geometry(VIEW_WIDTH, VIEW_HEIGHT, RENDER_BACKEND_GEOMETRY);
+    Canvas software(VIEW_WIDTH, VIEW_HEIGHT, RENDER_BACKEND_SOFTWARE);
+    software.set_raster_threads(raster_threads);
+    Canvas *canvases[3] = {&sdl, &geometry, &software};
+
+    for (Canvas *canvas : canvases) {
+        std::mt19937 rng(99);
+        populate(*canvas, count, rng);
+        canvas->set_grid_settings(true, 20, 173, 172, 172, 33);
+    }
+
+    int failures = 0;
+    auto step = [&](const char *what, int i, void (*action)(Canvas &, int)) {
+        for (Canvas *canvas : canvases) {
+            action(*canvas, i);
+            canvas->render();
+        }
+        for (Canvas *canvas : canvases) {
+            if (canvas == &software) continue;
+            int mismatches = compare_frames(*canvas, software);
+            if (mismatches > 0) {
+                ++failures;
+                std::printf("backend mismatch: %s %s step %d, %d pixels differ\n",
+                            canvas == &sdl ? "sdl" : "geometry", what, i, mismatches);
+            }
+        }
+    };
+
+    step("initial", 0, [](Canvas &, int) {});
+    for (int i = 0; i < frames; ++i) {
+        step("drag", i, [](Canvas &c, int i) {
+            if (i == 0) c.handle_mouse_down(VIEW_WIDTH / 2, VIEW_HEIGHT / 2, 0);
+            c.handle_mouse_move(VIEW_WIDTH / 2 + i * 3, VIEW_HEIGHT / 2 + i * 2);
+        });
+    }
+    step("drop", 0, [](Canvas &c, int) { c.handle_mouse_up(0, 0, 0); });
+
+    for (int i = 0; i < 6; ++i) {
+        step("zoom", i, [](Canvas &c, int i) { c.zoom_at_point(200 + i * 150, 100 + i * 90, i < 3 ? 1.7f : 0.4f); });
+    }
+    step("grid_off", 0, [](Canvas &c, int) { c.set_grid_settings(false, 20, 0, 0, 0, 0); });
+    step("translucent_background", 0, [](Canvas &c, int) { c.setBackgroundColor(30, 40, 50, 100); });
+
+    std::printf("check_backends %d shapes, %d raster threads: %s\n", count, software.raster_threads(), failures ? "FAILED" : "identical");
+    for (Canvas *canvas : canvases) canvas->cleanup();
+    return failures == 0;
+}
+
+// Runs a scenario once so caches, scratch buffers and arenas reach their
+// working size, then again while counting allocations
+long count_allocations(Canvas &canvas, void (*scenario)(Canvas &))
+{
+    scenario(canvas);
+    allocation_count = 0;
+    counting_allocations = true;
+    scenario(canvas);
+    counting_allocations = false;
+    return allocation_count;
+}
+
+// Steady-state frames, hit tests and input must not touch the heap: every
+// transient comes from the frame arenas or from scratch kept across frames.
+bool check_allocations(int count)
+{
+    Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+    canvas.set_raster_threads(raster_threads);
+    std::mt19937 rng(7);
+    populate(canvas, count, rng);
+    canvas.set_grid_settings(true, 20, 173, 172, 172, 33);
+    // A shape on top at the center of the view for the drag to grab, and a
+    // budget small enough that panning recycles tiles
+    canvas.add_shape({ShapeType::RECTANGLE, {-20, -20, 40, 40}, {255, 255, 255, 255}});
+    canvas.tile_cache.set_budget(48 * TileCache::TILE_BYTES);
+    canvas.render();
+
+    struct Phase {
+        const char *name;
+        void (*scenario)(Canvas &);
+    };
+    const Phase phases[] = {
+        {"render_full", [](Canvas &c) {
+            for (int i = 0; i < 3; ++i) {
+                c.mark_all_dirty();
+                c.render();
+            }
+        }},
+        {"render_idle", [](Canvas &c) {
+            for (int i = 0; i < 3; ++i) c.render();
+        }},
+        {"hit_test", [](Canvas &c) {
+            for (int y = 0; y < VIEW_HEIGHT; y += 45) {
+                for (int x = 0; x < VIEW_WIDTH; x += 80) {
+                    c.spatial_index.query_topmost({x - VIEW_WIDTH / 2, y - VIEW_HEIGHT / 2});
+                    c.handle_mouse_down(x, y, 0);
+                    c.handle_mouse_up(x, y, 0);
+                }
+            }
+            c.render();
+        }},
+        {"drag", [](Canvas &c) {
+            // Out and back, so the drag leaves no history entry behind
+            int x = VIEW_WIDTH / 2, y = VIEW_HEIGHT / 2;
+            c.handle_mouse_down(x, y, 0);
+            for (int i = 0; i < 40; ++i) {
+                int step = i < 20 ? 7 : -7;
+                c.handle_mouse_move(x += step, y += step / 2);
+                c.render();
+            }
+            c.handle_mouse_up(x, y, 0);
+            c.render();
+        }},
+        {"pan", [](Canvas &c) {
+            int x = VIEW_WIDTH / 2, y = VIEW_HEIGHT / 2;
+            c.handle_mouse_down(x, y, 1);
+            for (int i = 0; i < 80; ++i) {
+                c.handle_mouse_move(x += i < 40 ? 60 : -60, y += i < 40 ? 9 : -9);
+                c.render();
+            }
+            c.handle_mouse_up(x, y, 1);
+            c.render();
+        }},
+        {"queued_input", [](Canvas &c) {
+            // Rubber band from the corner through the input queue, as JS sends
+            // it. Out and back, since in a dense scene the corner lands on a
+            // shape and this becomes a drag.
+            c.input_queue.push({INPUT_MOUSE_DOWN, 2, 2, 0});
+            for (int i = -30; i <= 30; ++i) {
+                int step = 30 - std::abs(i);
+                c.input_queue.push({INPUT_MOUSE_MOVE, 4 + step * 20, 3 + step * 11, 0});
+                c.input_queue.push({INPUT_MOUSE_MOVE, 2 + step * 20, 2 + step * 11, 0});
+                c.render();
+            }
+            c.input_queue.push({INPUT_MOUSE_UP, 2, 2, 0});
+            c.input_queue.push({INPUT_KEY_DOWN, KEY_ESCAPE, 0, 0});
+            c.render();
+        }},
+    };
+
+    bool clean = true;
+    for (const Phase &phase : phases) {
+        long allocations = count_allocations(canvas, phase.scenario);
+        std::printf("check_allocations %d shapes, %s: %ld allocations\n", count, phase.name, allocations);
+        clean = clean && allocations == 0;
+    }
+    canvas.cleanup();
+    return clean;
+}
+
+std::vector<int> parse_sizes(const char *arg)
+{
+    std::vector<int> sizes;
+    std::string list(arg);
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        int value = std::atoi(list.substr(start, comma - start).c_str());
+        if (value > 0) sizes.push_back(value);
+        start = comma + 1;
+    }
+    return sizes;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes = {1000, 100000, 1000000};
+    int frames = 200;
+    bool check = false;
+    bool check_heap = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = parse_sizes(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            backend = std::strcmp(name, "software") == 0 ? RENDER_BACKEND_SOFTWARE :
+                      std::strcmp(name, "geometry") == 0 ? RENDER_BACKEND_GEOMETRY : RENDER_BACKEND_SDL;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            raster_threads = std::max(0, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--check-backends") == 0) {
+            check = true;
+        } else if (std::strcmp(argv[i], "--check-allocations") == 0) {
+            check_heap = true;
+        } else {
+            std::fprintf(stderr, "Usage: %s [--sizes 1000,100000,1000000] [--frames 200] [--backend sdl|software|geometry] [--threads 0] [--check-backends] [--check-allocations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (check) {
+        bool identical = true;
+        for (int count : sizes) identical = check_backends(count, std::min(frames, 50)) && identical;
+        return identical ? 0 : 1;
+    }
+    if (check_heap) {
+        bool clean = true;
+        for (int count : sizes) clean = check_allocations(count) && clean;
+        return clean ? 0 : 1;
+    }
+
+    std::mt19937 rng(1234);
+    print_header();
+
+    for (int count : sizes) {
+        Canvas canvas(VIEW_WIDTH, VIEW_HEIGHT, backend);
+        canvas.set_raster_threads(raster_threads);
+        populate(canvas, count, rng);
+        canvas.render();
+
+        bench_render(canvas, count, frames);
+        bench_hit_test(canvas, count, frames * 10, rng);
+        bench_drag(canvas, count, frames);
+        bench_selection(canvas, count, std::min(frames, 50));
+        bench_pan(canvas, count, frames);
+        bench_scene_file(canvas, count);
+        bench_export(canvas, count);
+
+        canvas.cleanup();
+        bench_zoomed_out(count, std::min(frames, 20), rng);
+    }
+
+    bench_shape_types(5000, std::min(frames, 50), rng);
+    bench_grid(frames);
+    bench_svg_import(100000, rng);
+    bench_bulk_ingest(100000, rng);
+    return 0;
+}
@@ -0,0 +1,296 @@
+// Headless replayer for input traces recorded with start_trace/stop_trace.
+// Puts a canvas in the state the trace started from, makes every recorded
+// call in order and times each render() call. Prints frame-time percentiles,
+// the slowest frames, and checksums of the final scene and frame. Exits
+// non-zero when the scene does not end as it did when recorded, or when
+// repeated runs end on different pixels, so a captured trace doubles as a
+// regression test.
+// --paced waits out the recorded gaps between calls instead of replaying
+// flat out. --csv writes one line per render() call. --record-synthetic
+// writes a trace of fast drags, wheel-zoom bursts and a resize storm over a
+// generated scene, for trying the replayer without a browser.
+//
+// Usage: vectormate_replay <trace> [--backend sdl|software|geometry]
+//                          [--threads 0] [--repeat 1] [--paced] [--csv path]
+//        vectormate_replay --record-synthetic <trace> [--shapes 100000]
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "canvas.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Frame {
+    Uint64 time_us;  // In the trace
+    double ns;       // render() call
+    bool painted;
+};
+
+bool read_file(const char *path, std::vector<Uint8> &out)
+{
+    FILE *file = std::fopen(path, "rb");
+    if (!file) return false;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    out.resize(size > 0 ? (size_t)size : 0);
+    bool ok = size > 0 && std::fread(out.data(), 1, out.size(), file) == out.size();
+    std::fclose(file);
+    return ok;
+}
+
+bool write_file(const char *path, const std::vector<Uint8> &data)
+{
+    FILE *file = std::fopen(path, "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// FNV-1a over the visible pixels of the output surface
+Uint64 frame_checksum(const Canvas &canvas)
+{
+    Uint64 h = 0xcbf29ce484222325ull;
+    const SDL_Surface *surface = canvas.surface;
+    if (!surface) return 0;
+    for (int y = 0; y < surface->h; ++y) {
+        const Uint8 *row = (const Uint8 *)surface->pixels + y * surface->pitch;
+        for (int x = 0; x < surface->w * 4; ++x) h = (h ^ row[x]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+// One replay of the whole trace; false if the trace is malformed
+bool replay(const std::vector<Uint8> &data, RenderBackend backend, int threads, bool paced,
+            std::vector<Frame> &frames, Uint64 &scene_checksum, Uint64 &pixels, bool &ended, Uint64 &recorded)
+{
+    InputTraceReader reader;
+    if (!reader.open(data.data(), data.size())) return false;
+    const InputTraceHeader &header = reader.header();
+
+    Canvas canvas(header.width, header.height, backend);
+    canvas.set_raster_threads(threads);
+    if (!canvas.begin_replay(reader)) return false;
+
+    frames.clear();
+    Clock::time_point start = Clock::now();
+    TraceEvent event;
+    while (reader.next(event)) {
+        if (paced) std::this_thread::sleep_until(start + std::chrono::microseconds(event.time_us));
+        if (event.op != TRACE_RENDER) {
+            canvas.replay(event);
+            continue;
+        }
+
+        Clock::time_point before = Clock::now();
+        bool painted = canvas.render();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count();
+        frames.push_back({event.time_us, ns, painted});
+    }
+
+    ended = reader.ended();
+    recorded = reader.checksum();
+    scene_checksum = SceneFile::checksum(canvas.scene);
+    pixels = frame_checksum(canvas);
+    canvas.cleanup();
+    return true;
+}
+
+void report(const std::vector<Frame> &frames)
+{
+    std::vector<double> painted;
+    double total = 0;
+    for (const Frame &frame : frames) {
+        total += frame.ns;
+        if (frame.painted) painted.push_back(frame.ns);
+    }
+
+    std::printf("frames %zu, painted %zu, render total %.1f ms\n", frames.size(), painted.size(), total / 1e6);
+    std::printf("painted frame us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+        percentile(painted, 0.50) / 1000.0, percentile(painted, 0.90) / 1000.0,
+        percentile(painted, 0.99) / 1000.0, percentile(painted, 1.0) / 1000.0);
+
+    // Slowest frames with where they fall in the trace
+    std::vector<size_t> order(frames.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    size_t shown = std::min<size_t>(5, order.size());
+    std::partial_sort(order.begin(), order.begin() + shown, order.end(),
+                      [&](size_t a, size_t b) { return frames[a].ns > frames[b].ns; });
+    for (size_t i = 0; i < shown; ++i) {
+        const Frame &frame = frames[order[i]];
+        std::printf("  slow frame %zu at %.3f s: %.1f us\n", order[i], frame.time_us / 1e6, frame.ns / 1000.0);
+    }
+}
+
+bool write_csv(const char *path, const std::vector<Frame> &frames)
+{
+    FILE *file = std::fopen(path, "w");
+    if (!file) return false;
+    std::fprintf(file, "frame,trace_us,render_us,painted\n");
+    for (size_t i = 0; i < frames.size(); ++i) {
+        std::fprintf(file, "%zu,%llu,%.1f,%d\n", i, (unsigned long long)frames[i].time_us, frames[i].ns / 1000.0,
+                     frames[i].painted ? 1 : 0);
+    }
+    return std::fclose(file) == 0;
+}
+
+// Drags, wheel zooms and resizes in the patterns that tend to show up in
+// production traces, each followed by a frame
+bool record_synthetic(const char *path, int count)
+{
+    Canvas canvas(1280, 720, RENDER_BACKEND_SOFTWARE);
+    std::mt19937 rng(77);
+    int side = (int)(std::sqrt((double)count) * 40.0);
+    std::uniform_int_distribution<int> pos(-side / 2, side / 2);
+    std::uniform_int_distribution<int> size(4, 60);
+    std::vector<SDL_Rect> rects(count);
+    std::vector<SDL_Color> colors(count);
+    std::vector<Uint8> types(count);
+    for (int i = 0; i < count; ++i) {
+        rects[i] = {pos(rng), pos(rng), size(rng), size(rng)};
+        colors[i] = {(Uint8)rng(), (Uint8)rng(), (Uint8)rng(), 255};
+        types[i] = (Uint8)(rng() % 2);
+    }
+    canvas.add_shapes(rects.data(), colors.data(), types.data(), count);
+    canvas.render();
+
+    canvas.start_trace();
+
+    // Fast drags of whatever is under the cursor, 40 px a frame
+    for (int drag = 0; drag < 10; ++drag) {
+        int x = 200 + drag * 80, y = 360;
+        canvas.handle_mouse_down(x, y, 0);
+        for (int step = 1; step <= 20; ++step) {
+            canvas.handle_mouse_move(x + step * 40 * (drag % 2 ? -1 : 1) / 2, y + step * 15);
+            canvas.render();
+        }
+        canvas.handle_mouse_up(x, y, 0);
+        canvas.render();
+    }
+
+    // Wheel-zoom bursts in and out around moving points
+    float zoom = 1.0f;
+    for (int burst = 0; burst < 6; ++burst) {
+        for (int tick = 0; tick < 15; ++tick) {
+            zoom *= burst % 2 ? 1.15f : 0.87f;
+            canvas.zoom_at_point(zoom, 300 + burst * 120, 200 + tick * 20);
+            canvas.render();
+        }
+    }
+
+    // Resize storm, as when dragging a window edge
+    for (int step = 0; step < 40; ++step) {
+        canvas.resize(1280 - step * 12, 720 - step * 6);
+        canvas.render();
+    }
+    canvas.set_grid_settings(true, 40, 200, 200, 200, 60);
+    canvas.render();
+
+    canvas.stop_trace();
+    bool ok = write_file(path, canvas.trace.data);
+    std::printf("recorded %zu bytes to %s\n", canvas.trace.data.size(), path);
+    canvas.cleanup();
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = nullptr;
+    const char *synthetic_path = nullptr;
+    const char *csv_path = nullptr;
+    RenderBackend backend = RENDER_BACKEND_SDL;
+    int threads = 0;
+    int repeat = 1;
+    int shapes = 100000;
+    bool paced = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            backend = std::strcmp(name, "software") == 0 ? RENDER_BACKEND_SOFTWARE :
+                      std::strcmp(name, "geometry") == 0 ? RENDER_BACKEND_GEOMETRY : RENDER_BACKEND_SDL;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(0, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--paced") == 0) {
+            paced = true;
+        } else if (std::strcmp(argv[i], "--record-synthetic") == 0 && i + 1 < argc) {
+            synthetic_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--shapes") == 0 && i + 1 < argc) {
+            shapes = std::max(1, std::atoi(argv[++i]));
+        } else if (argv[i][0] != '-' && !trace_path) {
+            trace_path = argv[i];
+        } else {
+            trace_path = nullptr;
+            synthetic_path = nullptr;
+            break;
+        }
+    }
+
+    if (synthetic_path) return record_synthetic(synthetic_path, shapes) ? 0 : 1;
+    if (!trace_path) {
+        std::fprintf(stderr, "Usage: %s <trace> [--backend sdl|software|geometry] [--threads 0] [--repeat 1] [--paced] [--csv path]\n"
+                             "       %s --record-synthetic <trace> [--shapes 100000]\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    std::vector<Uint8> data;
+    if (!read_file(trace_path, data)) {
+        std::fprintf(stderr, "cannot read %s\n", trace_path);
+        return 2;
+    }
+
+    bool matches = true;
+    Uint64 first_pixels = 0;
+    std::vector<Frame> frames;
+    for (int run = 0; run < repeat; ++run) {
+        Uint64 scene_checksum, pixels, recorded;
+        bool ended;
+        if (!replay(data, backend, threads, paced, frames, scene_checksum, pixels, ended, recorded)) {
+            std::fprintf(stderr, "%s is not a trace this build can replay\n", trace_path);
+            return 2;
+        }
+
+        std::printf("run %d\n", run + 1);
+        report(frames);
+        if (!ended) std::printf("trace is truncated; no recorded checksum to compare\n");
+        std::printf("scene checksum %016llx, recorded %016llx: %s\n", (unsigned long long)scene_checksum,
+                    (unsigned long long)recorded, !ended ? "unchecked" : scene_checksum == recorded ? "match" : "MISMATCH");
+        std::printf("frame checksum %016llx\n", (unsigned long long)pixels);
+
+        if (ended && scene_checksum != recorded) matches = false;
+        if (run == 0) first_pixels = pixels;
+        if (pixels != first_pixels) {
+            std::printf("frame differs from run 1\n");
+            matches = false;
+        }
+    }
+
+    if (csv_path && !write_csv(csv_path, frames)) {
+        std::fprintf(stderr, "cannot write %s\n", csv_path);
+        return 2;
+    }
+    return matches ? 0 : 1;
+}
@@ -6,12 +6,15 @@ param (
 )
 
 $Emcc = "emcc"
-$CppFiles = "cpp/main.cpp", "cpp/canvas.cpp", "cpp/states.cpp"
+# Every source in cpp/, as the Makefile and CMakeLists.txt build it
+$CppFiles = Get-ChildItem -Path "cpp" -Filter "*.cpp" | ForEach-Object { "cpp/" + $_.Name }
 $OutputJs = "public/vectormate.js"
 $Includes = "-I cpp/includes"
 
 # Emscripten flags
 $EmFlags = @(
+    "-std=c++17",
+    "-msimd128",
     "-s WASM=1",
     "-s USE_SDL=2",
     "-s MODULARIZE=1",
@@ -19,9 +22,56 @@ $EmFlags = @(
     "-s ALLOW_MEMORY_GROWTH=1"
 )
 
-# Exported functions and runtime methods
-$ExportedFunctions = "['_initialize_canvas', '_render', '_on_mouse_down', '_on_mouse_move', '_on_mouse_up', '_on_key_down', '_resize_canvas', '_set_canvas_background', '_set_grid_settings', '_set_zoom_level']"
-$ExportedRuntimeMethods = "['ccall', 'cwrap']"
+# Exported functions and runtime methods; keep in step with the Makefile and
+# CMakeLists.txt
+$ExportedNames = @(
+    "_initialize_canvas",
+    "_initialize_canvas_with_backend",
+    "_render",
+    "_on_mouse_down",
+    "_on_mouse_move",
+    "_on_mouse_up",
+    "_on_key_down",
+    "_resize_canvas",
+    "_set_canvas_background",
+    "_set_grid_settings",
+    "_set_grid_settings_with_color",
+    "_set_snapping",
+    "_set_zoom_level",
+    "_zoom_at_point",
+    "_get_input_queue",
+    "_drain_input",
+    "_set_raster_threads",
+    "_undo",
+    "_redo",
+    "_set_history_budget",
+    "_set_selected_shape_color",
+    "_reserve_scene_buffer",
+    "_load_scene",
+    "_save_scene",
+    "_get_scene_buffer",
+    "_import_svg",
+    "_add_shapes",
+    "_remove_shapes",
+    "_export_begin",
+    "_export_step",
+    "_export_chunk",
+    "_export_progress",
+    "_export_cancel",
+    "_get_frame_stats",
+    "_get_scene_view",
+    "_drain_changes",
+    "_start_trace",
+    "_stop_trace",
+    "_get_trace_buffer",
+    "_delete_selection",
+    "_restack_selection",
+    "_get_selection_count",
+    "_malloc",
+    "_free"
+)
+$ExportedFunctions = "[" + (($ExportedNames | ForEach-Object { "'$_'" }) -join ",") + "]"
+$ExportedRuntimeMethods = "['ccall','cwrap','HEAP32','HEAPU8']"
 
 # Compiler flags
 $CFlagsRelease = "-O3", "--no-entry"
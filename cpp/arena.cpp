@@ -0,0 +1,45 @@
+#include "arena.h"
+
+#include <algorithm>
+
+Arena::Arena(size_t bytes)
+    : block_bytes(std::max<size_t>(bytes, 256))
+{
+}
+
+void *Arena::allocate(size_t bytes, size_t align)
+{
+    // Try the current block, then later blocks kept from before a reset
+    for (; current < blocks.size(); ++current, offset = 0) {
+        Block &block = blocks[current];
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + bytes <= block.size) {
+            offset = start + bytes;
+            return block.data.get() + start;
+        }
+    }
+
+    // new[] memory is aligned for any fundamental type, so a fresh block
+    // needs no padding
+    Block block;
+    block.size = std::max(block_bytes, bytes);
+    block.data.reset(new Uint8[block.size]);
+    blocks.push_back(std::move(block));
+
+    current = blocks.size() - 1;
+    offset = bytes;
+    return blocks[current].data.get();
+}
+
+void Arena::reset()
+{
+    current = 0;
+    offset = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total = 0;
+    for (const Block &block : blocks) total += block.size;
+    return total;
+}
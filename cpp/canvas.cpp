@@ -1,138 +1,1676 @@
 
 #include <SDL2/SDL.h>
+#ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #include <emscripten/html5.h>
 #include <emscripten/val.h>
+#endif
 #include <cmath>
 #include <iostream>
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include "states.h"
 #include "shape.h"
 #include "canvas.h"
 
 // Helper Functions
-SDL_Point screen_to_world(SDL_Point p, int w, int h) {
+
+// Pan is applied in whole screen pixels, so panning translates the whole
+// frame (and the cached grid layer) exactly, without reshaping anything
+static SDL_Point pan_to_pixels(SDL_FPoint pan, float zoom) {
+    return {(int)lround((double)pan.x * zoom), (int)lround((double)pan.y * zoom)};
+}
+
+SDL_Point screen_to_world(SDL_Point p, SDL_FPoint pan, float zoom, int w, int h) {
+    SDL_Point pan_px = pan_to_pixels(pan, zoom);
+    return {
+        (int)floor((double)(p.x - w / 2 + pan_px.x) / zoom),
+        (int)floor((double)(p.y - h / 2 + pan_px.y) / zoom)
+    };
+}
+
+SDL_Point world_to_screen(SDL_Point p, SDL_FPoint pan, float zoom, int w, int h) {
+    SDL_Point pan_px = pan_to_pixels(pan, zoom);
     return {
-        p.x - w / 2,
-        p.y - h / 2
+        world_to_content(p.x, zoom) - pan_px.x + w / 2,
+        world_to_content(p.y, zoom) - pan_px.y + h / 2
+    };
+}
+
+// Both edges are projected so neighbouring shapes never open seams when zoomed
+SDL_Rect world_to_screen_rect(SDL_Rect r, SDL_FPoint pan, float zoom, int w, int h) {
+    SDL_Point top_left = world_to_screen({r.x, r.y}, pan, zoom, w, h);
+    SDL_Point bottom_right = world_to_screen({r.x + r.w, r.y + r.h}, pan, zoom, w, h);
+    return {
+        top_left.x,
+        top_left.y,
+        bottom_right.x - top_left.x,
+        bottom_right.y - top_left.y
+    };
+}
+
+static int floor_div(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+bool is_point_in_rect(SDL_Point p, SDL_Rect r) {
+    return p.x >= r.x && p.x <= r.x + r.w && p.y >= r.y && p.y <= r.y + r.h;
+}
+
+// Global state
+Canvas::Canvas(int width, int height, RenderBackend render_backend)
+{
+    backend = render_backend;
+    canvas_width = std::max(width, 300);
+    canvas_height = std::max(height, 300);
+    damage_rects.reserve(MAX_DAMAGE_RECTS + 1);
+
+#ifdef __EMSCRIPTEN__
+    SDL_SetHint(SDL_HINT_EMSCRIPTEN_KEYBOARD_ELEMENT, "#canvas");
+    emscripten_set_canvas_element_size("#canvas", canvas_width, canvas_height);
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        std::cerr << "SDL initialization failed: " << SDL_GetError() << std::endl;
+        return;
+    }
+
+    if (SDL_CreateWindowAndRenderer(canvas_width, canvas_height, 0, &window, &renderer) < 0) {
+        std::cerr << "SDL_CreateWindowAndRenderer failed: " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return;
+    }
+    std::cout << "SDL window and renderer created successfully" << std::endl;
+#else
+    // Native builds are headless and render into an offscreen software surface
+    if (!create_offscreen_renderer()) return;
+#endif
+
+    // Create some test shapes
+    add_shape({ShapeType::RECTANGLE, {-50, -50, 100, 100}, {255, 0, 0, 255}});
+    add_shape({ShapeType::RECTANGLE, {100, 100, 80, 120}, {0, 255, 0, 255}});
+    add_shape({ShapeType::RECTANGLE, {-200, 80, 150, 50}, {0, 0, 255, 255}});
+    history.clear();
+}
+
+#ifndef __EMSCRIPTEN__
+bool Canvas::create_offscreen_renderer()
+{
+    surface = SDL_CreateRGBSurfaceWithFormat(0, canvas_width, canvas_height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!surface) {
+        std::cerr << "SDL_CreateRGBSurfaceWithFormat failed: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    renderer = SDL_CreateSoftwareRenderer(surface);
+    if (!renderer) {
+        std::cerr << "SDL_CreateSoftwareRenderer failed: " << SDL_GetError() << std::endl;
+        SDL_FreeSurface(surface);
+        surface = nullptr;
+        return false;
+    }
+    return true;
+}
+#endif
+
+ShapeId Canvas::add_shape(const Shape &shape)
+{
+    ShapeId id = scene.add(shape);
+    if (id == INVALID_SHAPE_ID) return id;
+    int index = scene.index_of(id);
+    spatial_index.insert((int)id, scene.rect(index), scene.z[index], scene.type[index] == CIRCLE);
+    snap_index.insert(id, scene.rect(index));
+    stack_order.insert(id, scene.z[index]);
+    update_lod(index, 1);
+    changes.note(id, CHANGE_CREATED);
+    invalidate_shape(id);
+
+    ShapeRecord *record = history.record_insert(1);
+    if (record) *record = shape_record(index);
+    return id;
+}
+
+bool Canvas::remove_shape(ShapeId id)
+{
+    int index = scene.index_of(id);
+    if (index == -1) return false;
+
+    ShapeRecord *record = history.record_delete(1);
+    if (record) *record = shape_record(index);
+
+    erase_shape(id);
+    return true;
+}
+
+bool Canvas::set_shape_color(ShapeId id, SDL_Color color)
+{
+    int index = scene.index_of(id);
+    if (index == -1) return false;
+
+    ColorRecord *record = history.record_recolor(1);
+    if (record) *record = {id, scene.color[index], color};
+
+    recolor_shape(id, color);
+    return true;
+}
+
+int Canvas::select_rect(SDL_Rect world_rect)
+{
+    clear_selection();
+    if (world_rect.w <= 0 || world_rect.h <= 0) return 0;
+
+    selection_query.clear();
+    spatial_index.query_rect(world_rect, selection_query);
+    for (int id : selection_query) select_shape((ShapeId)id);
+    return selection.size();
+}
+
+void Canvas::clear_selection()
+{
+    if (selection.empty()) return;
+
+    for (ShapeId id : selection) {
+        scene.flags[scene.index_of(id)] &= ~SHAPE_SELECTED;
+        changes.note(id, CHANGE_SELECTED);
+    }
+    selection.clear();
+    selection_box_stale = true;
+}
+
+void Canvas::select_shape(ShapeId id)
+{
+    int index = scene.index_of(id);
+    if (index == -1 || !selection.insert(id)) return;
+
+    scene.flags[index] |= SHAPE_SELECTED;
+    changes.note(id, CHANGE_SELECTED);
+    selection_box_stale = true;
+}
+
+int Canvas::move_selection(int dx, int dy)
+{
+    if (selection.empty() || (dx == 0 && dy == 0)) return 0;
+
+    history.seal();
+    ShapeId *ids = history.record_move(selection.size(), dx, dy);
+    if (ids) std::copy(selection.begin(), selection.end(), ids);
+    move_shapes(selection.data(), selection.size(), dx, dy);
+    history.seal();
+    return selection.size();
+}
+
+int Canvas::set_selection_color(SDL_Color color)
+{
+    trace.record(TRACE_RECOLOR, color.r, color.g, color.b, color.a);
+    ColorRecord *records = selection.empty() ? nullptr : history.record_recolor(selection.size());
+
+    edit_rects.clear();
+    for (int i = 0; i < selection.size(); ++i) {
+        ShapeId id = selection.data()[i];
+        int index = scene.index_of(id);
+        if (records) records[i] = {id, scene.color[index], color};
+        update_lod(index, -1);
+        scene.color[index] = color;
+        update_lod(index, 1);
+        changes.note(id, CHANGE_RECOLORED);
+        edit_rects.push_back(tile_footprint(index));
+        mark_shape_dirty(id);
+    }
+    tile_cache.invalidate(edit_rects.data(), (int)edit_rects.size());
+    return selection.size();
+}
+
+int Canvas::delete_selection()
+{
+    trace.record(TRACE_DELETE_SELECTION);
+    int count = selection.size();
+    if (count == 0) return 0;
+
+    bulk_ids.assign(selection.begin(), selection.end());
+    clear_selection();
+
+    ShapeRecord *records = history.record_delete(count);
+    for (int i = 0; i < count; ++i) {
+        if (records) records[i] = shape_record(scene.index_of(bulk_ids[i]));
+        erase_shape(bulk_ids[i]);
+    }
+    is_dragging = false;
+    clear_guides();
+    return count;
+}
+
+ShapeId Canvas::add_shapes(const SDL_Rect *rects, const SDL_Color *colors, const Uint8 *types, int count)
+{
+    if (count <= 0) return INVALID_SHAPE_ID;
+    for (int i = 0; i < count; ++i) {
+        if (types[i] > CIRCLE || rects[i].w < 0 || rects[i].h < 0) return INVALID_SHAPE_ID;
+    }
+    return insert_shapes(count, [&](int i) { return Shape{(ShapeType)types[i], rects[i], colors[i]}; });
+}
+
+int Canvas::remove_shapes(ShapeId first, int count)
+{
+    if (count <= 0) return 0;
+
+    // A range inside one generation is walked id by id up to the last slot;
+    // one reaching into later generations picks its shapes out of the scene
+    Uint64 end = (Uint64)first + (Uint64)count;
+    bulk_ids.clear();
+    Uint32 slot = shape_slot(first);
+    if (slot + (Uint64)count <= SHAPE_SLOT_COUNT) {
+        Uint32 slots_left = scene.slot_count() > slot ? scene.slot_count() - slot : 0;
+        end = first + std::min<Uint64>((Uint64)count, slots_left);
+        for (ShapeId id = first; id < end; ++id) {
+            if (scene.contains(id)) bulk_ids.push_back(id);
+        }
+    } else {
+        for (ShapeId id : scene.ids) {
+            if (id >= first && id < end) bulk_ids.push_back(id);
+        }
+    }
+    int removed = (int)bulk_ids.size();
+    if (removed == 0) return 0;
+
+    ShapeRecord *records = history.record_delete(removed);
+    if (records) {
+        for (int i = 0; i < removed; ++i) records[i] = shape_record(scene.index_of(bulk_ids[i]));
+    }
+    erase_shapes(bulk_ids.data(), removed);
+    return removed;
+}
+
+int Canvas::restack_selection(StackOp op)
+{
+    trace.record(TRACE_RESTACK, op);
+    if (selection.empty()) return 0;
+
+    // Shapes going up are placed from the top of the selection down when
+    // stepping and from the bottom up when going to the front, and the other
+    // way round going down: either way none is placed relative to a shape
+    // of the selection still to be moved.
+    restack_order.clear();
+    for (ShapeId id : selection) restack_order.push_back({scene.z[scene.index_of(id)], id});
+    std::sort(restack_order.begin(), restack_order.end(),
+              [](const StackOrder::Entry &a, const StackOrder::Entry &b) { return a.z < b.z; });
+    if (op == STACK_FORWARD || op == STACK_TO_BACK) std::reverse(restack_order.begin(), restack_order.end());
+
+    restack_records.clear();
+    edit_rects.clear();
+    int restacked = 0;
+    for (const StackOrder::Entry &shape : restack_order) {
+        int index = scene.index_of(shape.id);
+        Uint64 z = scene.z[index]; // An earlier placement may have relabeled it
+
+        // Stepping goes past the nearest overlapping unselected shape
+        // above or below; there is nothing to do without one
+        StackOrder::Entry neighbour = {0, INVALID_SHAPE_ID};
+        if (op == STACK_FORWARD || op == STACK_BACKWARD) {
+            selection_query.clear();
+            spatial_index.query_rect(scene.rect(index), selection_query);
+            for (int id : selection_query) {
+                int other = scene.index_of((ShapeId)id);
+                if (scene.flags[other] & SHAPE_SELECTED) continue;
+                Uint64 other_z = scene.z[other];
+                bool closer = neighbour.id == INVALID_SHAPE_ID || (op == STACK_FORWARD ? other_z < neighbour.z : other_z > neighbour.z);
+                if ((op == STACK_FORWARD ? other_z > z : other_z < z) && closer) neighbour = {other_z, (ShapeId)id};
+            }
+            if (neighbour.id == INVALID_SHAPE_ID) continue;
+        }
+
+        stack_order.remove(shape.id, z);
+        Uint64 label;
+        StackOrder::Entry top;
+        switch (op) {
+            case STACK_TO_FRONT:
+                label = stack_order.top(top) ? stack_order.place_above(&top.z) : stack_order.place_above(nullptr);
+                break;
+            case STACK_FORWARD:
+                label = stack_order.place_above(&neighbour.z);
+                break;
+            case STACK_BACKWARD:
+                label = stack_order.place_below(neighbour.z);
+                break;
+            default:
+                label = stack_order.place_above(nullptr);
+                break;
+        }
+        apply_relabels(&restack_records);
+        stack_order.insert(shape.id, label);
+        restack_records.push_back({shape.id, 0, z, label});
+        set_shape_z(index, label);
+
+        edit_rects.push_back(tile_footprint(index));
+        mark_shape_dirty(shape.id);
+        ++restacked;
+    }
+    tile_cache.invalidate(edit_rects.data(), (int)edit_rects.size());
+
+    if (!restack_records.empty()) {
+        StackRecord *records = history.record_restack((int)restack_records.size());
+        if (records) std::copy(restack_records.begin(), restack_records.end(), records);
+        history.seal();
+    }
+    return restacked;
+}
+
+// Refreshes the selection bounds, repainting where the outline was and is
+void Canvas::update_selection_box()
+{
+    int margin = HANDLE_SIZE / 2 + 1;
+    mark_world_dirty(selection_box, margin);
+
+    selection_box = {0, 0, 0, 0};
+    if (!selection.empty()) {
+        int index = scene.index_of(selection.data()[0]);
+        int x0 = scene.x[index], y0 = scene.y[index];
+        int x1 = x0 + scene.w[index], y1 = y0 + scene.h[index];
+        for (ShapeId id : selection) {
+            index = scene.index_of(id);
+            x0 = std::min(x0, scene.x[index]);
+            y0 = std::min(y0, scene.y[index]);
+            x1 = std::max(x1, scene.x[index] + scene.w[index]);
+            y1 = std::max(y1, scene.y[index] + scene.h[index]);
+        }
+        selection_box = {x0, y0, x1 - x0, y1 - y0};
+        mark_world_dirty(selection_box, margin);
+    }
+    selection_box_stale = false;
+}
+
+SDL_Rect Canvas::marquee_rect() const
+{
+    int x0 = std::min(marquee_anchor.x, marquee_point.x);
+    int y0 = std::min(marquee_anchor.y, marquee_point.y);
+    return {x0, y0, std::abs(marquee_point.x - marquee_anchor.x), std::abs(marquee_point.y - marquee_anchor.y)};
+}
+
+void Canvas::update_marquee(SDL_Point world_point)
+{
+    mark_world_dirty(marquee_rect(), 1);
+    marquee_point = world_point;
+    mark_world_dirty(marquee_rect(), 1);
+    select_rect(marquee_rect());
+}
+
+bool Canvas::undo()
+{
+    trace.record(TRACE_UNDO);
+    const HistoryEntry *entry = history.undo();
+    if (!entry) return false;
+    apply_history(*entry, true);
+    return true;
+}
+
+bool Canvas::redo()
+{
+    trace.record(TRACE_REDO);
+    const HistoryEntry *entry = history.redo();
+    if (!entry) return false;
+    apply_history(*entry, false);
+    return true;
+}
+
+bool Canvas::load_scene(const Uint8 *data, size_t size)
+{
+    Scene loaded;
+    if (!scene_file.load(loaded, data, size)) return false;
+    replace_scene(loaded);
+    return true;
+}
+
+size_t Canvas::save_scene()
+{
+    return scene_file.save(scene, scene_buffer);
+}
+
+bool Canvas::load_scene_file(const char *path)
+{
+    Scene loaded;
+    if (!scene_file.load_file(loaded, path)) return false;
+    replace_scene(loaded);
+    return true;
+}
+
+bool Canvas::save_scene_file(const char *path)
+{
+    return scene_file.save_file(scene, path);
+}
+
+int Canvas::import_svg(const char *data, size_t size)
+{
+    SvgImporter importer;
+    std::vector<Shape> shapes;
+    int count = importer.read(data, size, shapes);
+    if (count == 0) return 0;
+
+    if (insert_shapes(count, [&](int i) { return shapes[i]; }) == INVALID_SHAPE_ID) return 0;
+    return count;
+}
+
+// Adds count shapes on top as one history entry, shape_at(i) giving each.
+// Storage is reserved up front. Past the point where erase_shapes rebuilds,
+// the shapes only go into the scene columns and every index is built again
+// in one pass at the end. Returns the id of the first, or INVALID_SHAPE_ID
+// when the scene has no room for them.
+template <typename ShapeAt>
+ShapeId Canvas::insert_shapes(int count, ShapeAt shape_at)
+{
+    ShapeId first = scene.claim_ids(count);
+    if (first == INVALID_SHAPE_ID) return first;
+    scene.reserve(scene.size() + count);
+    spatial_index.reserve(scene.slot_count());
+    ShapeRecord *records = history.record_insert(count);
+    SDL_Rect bounds = shape_at(0).rect;
+    bool rebuild = snap_index.build_cheaper(count);
+
+    for (int i = 0; i < count; ++i) {
+        Shape shape = shape_at(i);
+        ShapeId id = first + (ShapeId)i;
+        scene.add(shape, id);
+        int index = scene.index_of(id);
+        if (!rebuild) {
+            spatial_index.insert((int)id, shape.rect, scene.z[index], shape.type == CIRCLE);
+            snap_index.insert(id, shape.rect);
+            stack_order.insert(id, scene.z[index]);
+            update_lod(index, 1);
+        }
+        changes.note(id, CHANGE_CREATED);
+        if (records) records[i] = shape_record(index);
+        SDL_UnionRect(&bounds, &shape.rect, &bounds);
+    }
+    if (rebuild) rebuild_spatial_index();
+
+    int margin = LodPyramid::FOOTPRINT_MARGIN;
+    tile_cache.invalidate({bounds.x - margin, bounds.y - margin, bounds.w + 2 * margin, bounds.h + 2 * margin});
+    mark_dirty(world_to_screen_rect(bounds, pan_offset, zoom_level, canvas_width, canvas_height));
+    return first;
+}
+
+bool Canvas::export_begin(ExportFormat format, SDL_Rect world, float scale)
+{
+    if (world.w <= 0 || world.h <= 0) return false;
+    export_job.reset(new ExportJob(scene, spatial_index, format, world, scale, background_color));
+    return true;
+}
+
+int Canvas::export_step()
+{
+    if (!export_job || !export_job->step()) {
+        export_job.reset();
+        return -1;
+    }
+    return (int)export_job->chunk.size();
+}
+
+void Canvas::export_cancel()
+{
+    export_job.reset();
+}
+
+bool Canvas::export_file(ExportFormat format, SDL_Rect world, float scale, const char *path)
+{
+    if (world.w <= 0 || world.h <= 0) return false;
+    std::unique_ptr<ExportJob> job(new ExportJob(scene, spatial_index, format, world, scale, background_color));
+    return export_writer.start(std::move(job), path);
+}
+
+void Canvas::replace_scene(Scene &loaded)
+{
+    std::swap(scene, loaded);
+    rebuild_spatial_index();
+    changes.reset(scene.slot_count());
+
+    selection.clear();
+    selection_box_stale = true;
+    is_dragging = false;
+    is_selecting = false;
+    clear_guides();
+    history.clear();
+    tile_cache.invalidate_all();
+    mark_all_dirty();
+}
+
+ShapeRecord Canvas::shape_record(int index) const
+{
+    ShapeRecord record = {};
+    record.id = scene.ids[index];
+    record.type = scene.type[index];
+    record.rect = scene.rect(index);
+    record.color = scene.color[index];
+    record.z = scene.z[index];
+    return record;
+}
+
+void Canvas::place_shape(const ShapeRecord &record)
+{
+    if (scene.contains(record.id)) return;
+
+    // The old z is exact unless a relabel has since handed it to another
+    // shape; the shape then goes right above that one
+    Uint64 z = record.z;
+    if (stack_order.taken(z)) {
+        z = stack_order.place_above(&z);
+        apply_relabels(nullptr);
+    }
+
+    if (!scene.restore(record.id, {(ShapeType)record.type, record.rect, record.color}, z)) return;
+    spatial_index.insert((int)record.id, record.rect, z, record.type == CIRCLE);
+    snap_index.insert(record.id, record.rect);
+    stack_order.insert(record.id, z);
+    update_lod(scene.index_of(record.id), 1);
+    changes.note(record.id, CHANGE_CREATED);
+    invalidate_shape(record.id);
+}
+
+void Canvas::erase_shape(ShapeId id)
+{
+    if (!scene.contains(id)) return;
+
+    invalidate_shape(id);
+    update_lod(scene.index_of(id), -1);
+    spatial_index.remove((int)id);
+    snap_index.remove(id, scene.rect(scene.index_of(id)));
+    stack_order.remove(id, scene.z[scene.index_of(id)]);
+    scene.remove(id);
+    changes.note(id, CHANGE_DELETED);
+
+    if (selection.erase(id)) {
+        selection_box_stale = true;
+        if (selection.empty()) {
+            is_dragging = false;
+            clear_guides();
+        }
+    }
+}
+
+// Erases many shapes. Past a point, building the indexes again from the
+// shapes left beats taking these out one by one.
+void Canvas::erase_shapes(const ShapeId *ids, int count)
+{
+    if (!snap_index.build_cheaper(count)) {
+        for (int i = 0; i < count; ++i) erase_shape(ids[i]);
+        return;
+    }
+
+    SDL_Rect bounds = {0, 0, 0, 0};
+    bool found = false;
+    for (int i = 0; i < count; ++i) {
+        int index = scene.index_of(ids[i]);
+        if (index == -1) continue;
+
+        // Footprints as they are now, before the index nodes go
+        SDL_Rect footprint = tile_footprint(index);
+        if (found) {
+            SDL_UnionRect(&bounds, &footprint, &bounds);
+        } else {
+            bounds = footprint;
+            found = true;
+        }
+        if (selection.erase(ids[i])) selection_box_stale = true;
+        scene.remove(ids[i]);
+        changes.note(ids[i], CHANGE_DELETED);
+    }
+    if (!found) return;
+
+    rebuild_spatial_index();
+    if (selection.empty()) {
+        is_dragging = false;
+        clear_guides();
+    }
+    tile_cache.invalidate(bounds);
+    mark_world_dirty(bounds, HANDLE_SIZE / 2 + 1);
+}
+
+void Canvas::move_shapes(const ShapeId *ids, int count, int dx, int dy)
+{
+    if (dx == 0 && dy == 0) return;
+
+    move_indices.clear();
+    edit_rects.clear();
+    for (int i = 0; i < count; ++i) {
+        int index = scene.index_of(ids[i]);
+        if (index == -1) continue;
+        move_indices.push_back(index);
+        edit_rects.push_back(tile_footprint(index));
+        update_lod(index, -1);
+        snap_index.remove(ids[i], scene.rect(index));
+        mark_shape_dirty(ids[i]);
+    }
+
+    scene.translate(move_indices.data(), (int)move_indices.size(), dx, dy);
+    if (!selection.empty()) selection_box_stale = true;
+
+    for (int index : move_indices) {
+        spatial_index.update((int)scene.ids[index], scene.rect(index));
+        snap_index.insert(scene.ids[index], scene.rect(index));
+        update_lod(index, 1);
+        changes.note(scene.ids[index], CHANGE_MOVED);
+        edit_rects.push_back(tile_footprint(index));
+        mark_shape_dirty(scene.ids[index]);
+    }
+    tile_cache.invalidate(edit_rects.data(), (int)edit_rects.size());
+}
+
+// Restacks a shape in the scene and the spatial index; stack_order is up to
+// the caller
+void Canvas::set_shape_z(int index, Uint64 z)
+{
+    scene.set_z(index, z);
+    spatial_index.set_z((int)scene.ids[index], z);
+    changes.note(scene.ids[index], CHANGE_RESTACKED);
+}
+
+// Mirrors the labels stack_order spread out in its last placement, noting
+// them in records if given
+void Canvas::apply_relabels(std::vector<StackRecord> *records)
+{
+    for (const StackOrder::Entry &entry : stack_order.relabeled()) {
+        int index = scene.index_of(entry.id);
+        if (records) records->push_back({entry.id, 0, scene.z[index], entry.z});
+        set_shape_z(index, entry.z);
+    }
+}
+
+void Canvas::recolor_shape(ShapeId id, SDL_Color color)
+{
+    int index = scene.index_of(id);
+    if (index == -1) return;
+
+    update_lod(index, -1);
+    scene.color[index] = color;
+    update_lod(index, 1);
+    changes.note(id, CHANGE_RECOLORED);
+    invalidate_shape(id);
+}
+
+// Reverts an entry (undo) or applies it again (redo)
+void Canvas::apply_history(const HistoryEntry &entry, bool revert)
+{
+    switch (entry.op) {
+        case HISTORY_MOVE: {
+            int sign = revert ? -1 : 1;
+            move_shapes(entry.ids(), entry.count, sign * entry.dx, sign * entry.dy);
+            break;
+        }
+        case HISTORY_RECOLOR:
+            edit_rects.clear();
+            for (int i = 0; i < entry.count; ++i) {
+                const ColorRecord &record = entry.colors()[i];
+                int index = scene.index_of(record.id);
+                if (index == -1) continue;
+                update_lod(index, -1);
+                scene.color[index] = revert ? record.from : record.to;
+                update_lod(index, 1);
+                changes.note(record.id, CHANGE_RECOLORED);
+                edit_rects.push_back(tile_footprint(index));
+                mark_shape_dirty(record.id);
+            }
+            tile_cache.invalidate(edit_rects.data(), (int)edit_rects.size());
+            break;
+        case HISTORY_INSERT:
+        case HISTORY_DELETE: {
+            bool insert = (entry.op == HISTORY_INSERT) != revert;
+            if (insert) {
+                for (int i = 0; i < entry.count; ++i) place_shape(entry.shapes()[i]);
+                break;
+            }
+            bulk_ids.clear();
+            for (int i = 0; i < entry.count; ++i) bulk_ids.push_back(entry.shapes()[i].id);
+            erase_shapes(bulk_ids.data(), entry.count);
+            break;
+        }
+        case HISTORY_RESTACK: {
+            // Every shape comes out of stack_order before any goes back, so
+            // no label is held twice on the way. A shape listed more than
+            // once ends at its first from (undo) or its last to (redo).
+            const StackRecord *records = entry.stacks();
+            int count = entry.count;
+            for (int i = 0; i < count; ++i) {
+                int index = scene.index_of(records[i].id);
+                if (index != -1) stack_order.remove(records[i].id, scene.z[index]);
+            }
+            for (int i = 0; i < count; ++i) {
+                const StackRecord &record = records[revert ? count - 1 - i : i];
+                int index = scene.index_of(record.id);
+                if (index != -1) set_shape_z(index, revert ? record.from : record.to);
+            }
+            edit_rects.clear();
+            for (int i = 0; i < count; ++i) {
+                int index = scene.index_of(records[i].id);
+                if (index == -1) continue;
+                stack_order.remove(records[i].id, scene.z[index]); // Once per shape
+                stack_order.insert(records[i].id, scene.z[index]);
+                edit_rects.push_back(tile_footprint(index));
+                mark_shape_dirty(records[i].id);
+            }
+            tile_cache.invalidate(edit_rects.data(), (int)edit_rects.size());
+            break;
+        }
+    }
+}
+
+void Canvas::rebuild_spatial_index()
+{
+    spatial_index.clear();
+    lod.clear();
+    for (int i = 0; i < scene.size(); ++i) {
+        spatial_index.insert((int)scene.ids[i], scene.rect(i), scene.z[i], scene.type[i] == CIRCLE);
+        update_lod(i, 1);
+    }
+    snap_index.build(scene);
+    stack_order.build(scene);
+}
+
+// Adds (sign 1) or takes out (sign -1) a shape's share of the LOD pyramid.
+// Shapes are taken out before their rect, color or index node change and
+// added back after.
+void Canvas::update_lod(int index, int sign)
+{
+    lod.add(scene.rect(index), scene.color[index], scene.type[index] == CIRCLE,
+            spatial_index.node_half((int)scene.ids[index]), sign);
+}
+
+void Canvas::set_clip(DrawContext &ctx, const SDL_Rect *clip)
+{
+    if (ctx.pixels) {
+        ctx.pixels->clip = clip ? *clip : SDL_Rect{0, 0, ctx.pixels->width, ctx.pixels->height};
+    } else {
+        flush_geometry(ctx);
+        SDL_RenderSetClipRect(renderer, clip);
+    }
+}
+
+void Canvas::fill_rect(DrawContext &ctx, SDL_Rect rect, SDL_Color color)
+{
+    ++ctx.stats[STAT_DRAW_CALLS];
+    if (ctx.pixels) {
+        raster_fill_rect(*ctx.pixels, rect, color);
+        return;
+    }
+    flush_geometry(ctx);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRect(renderer, &rect);
+}
+
+void Canvas::blend_rects(DrawContext &ctx, const SDL_Rect *rects, int count, SDL_Color color)
+{
+    if (queues_geometry(ctx)) {
+        for (int i = 0; i < count; ++i) queue_rect(ctx, rects[i], color);
+        return;
+    }
+    ++ctx.stats[STAT_DRAW_CALLS];
+    if (ctx.pixels) {
+        raster_blend_rects(*ctx.pixels, rects, count, color);
+        return;
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRects(renderer, rects, count);
+}
+
+void Canvas::blend_line(DrawContext &ctx, int x1, int y1, int x2, int y2, SDL_Color color)
+{
+    // Lines are axis-aligned, so as geometry they are 1 pixel wide quads
+    if (queues_geometry(ctx) && (x1 == x2 || y1 == y2)) {
+        queue_rect(ctx, {std::min(x1, x2), std::min(y1, y2), std::abs(x2 - x1) + 1, std::abs(y2 - y1) + 1}, color);
+        return;
+    }
+    ++ctx.stats[STAT_DRAW_CALLS];
+    if (ctx.pixels) {
+        raster_blend_line(*ctx.pixels, x1, y1, x2, y2, color);
+        return;
+    }
+    flush_geometry(ctx);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+}
+
+// Two triangles with the fill's color at every corner. Integer corners put
+// pixel centers inside exactly the pixels SDL_RenderFillRect would cover.
+void Canvas::queue_rect(DrawContext &ctx, SDL_Rect rect, SDL_Color color)
+{
+    if (rect.w <= 0 || rect.h <= 0 || color.a == 0) return;
+
+    int first = (int)ctx.vertices.size();
+    float x0 = (float)rect.x, y0 = (float)rect.y;
+    float x1 = (float)(rect.x + rect.w), y1 = (float)(rect.y + rect.h);
+    ctx.vertices.push_back({{x0, y0}, color, {0, 0}});
+    ctx.vertices.push_back({{x1, y0}, color, {0, 0}});
+    ctx.vertices.push_back({{x1, y1}, color, {0, 0}});
+    ctx.vertices.push_back({{x0, y1}, color, {0, 0}});
+    const int corners[6] = {0, 1, 2, 0, 2, 3};
+    for (int corner : corners) ctx.indices.push_back(first + corner);
+}
+
+// Submits the queued quads in one call, in the order they were queued. Must
+// run before anything else draws, clips or switches targets.
+void Canvas::flush_geometry(DrawContext &ctx)
+{
+    if (ctx.indices.empty()) return;
+
+    ++ctx.stats[STAT_DRAW_CALLS];
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_RenderGeometry(renderer, nullptr, ctx.vertices.data(), (int)ctx.vertices.size(),
+                       ctx.indices.data(), (int)ctx.indices.size());
+    ctx.vertices.clear();
+    ctx.indices.clear();
+}
+
+SDL_Point Canvas::pan_pixels() const
+{
+    return pan_to_pixels(pan_offset, zoom_level);
+}
+
+bool Canvas::grid_visible() const
+{
+    return show_grid && grid_size * zoom_level >= 5; // Don't draw if grid is too dense
+}
+
+// Draws grid lines over a screen-space area, translated so the screen point
+// origin lands at (0, 0) of the current target
+void Canvas::draw_grid(DrawContext &ctx, SDL_Rect area, SDL_Point origin)
+{
+    // Lines sit on world multiples of grid_size so they follow pan and zoom
+    SDL_Point top_left = screen_to_world({area.x, area.y}, pan_offset, zoom_level, canvas_width, canvas_height);
+    int start_x = floor_div(top_left.x, grid_size) * grid_size;
+    int start_y = floor_div(top_left.y, grid_size) * grid_size;
+
+    for (int x = start_x; ; x += grid_size) {
+        int line_x = world_to_screen({x, 0}, pan_offset, zoom_level, canvas_width, canvas_height).x;
+        if (line_x >= area.x + area.w) break;
+        if (line_x >= area.x) blend_line(ctx, line_x - origin.x, area.y - origin.y, line_x - origin.x, area.y + area.h - origin.y, grid_color);
+    }
+
+    for (int y = start_y; ; y += grid_size) {
+        int line_y = world_to_screen({0, y}, pan_offset, zoom_level, canvas_width, canvas_height).y;
+        if (line_y >= area.y + area.h) break;
+        if (line_y >= area.y) blend_line(ctx, area.x - origin.x, line_y - origin.y, area.x + area.w - origin.x, line_y - origin.y, grid_color);
+    }
+}
+
+// Rebuilds the grid layer if its inputs changed or the view panned past its
+// margin. Runs before any damage is repainted, while the default target is set.
+void Canvas::update_grid_layer()
+{
+    if (!grid_visible()) return;
+
+    GridLayer &layer = grid_layer;
+    SDL_Point pan_px = pan_pixels();
+    int width = canvas_width + 2 * GRID_LAYER_MARGIN;
+    int height = canvas_height + 2 * GRID_LAYER_MARGIN;
+
+    bool current = layer.valid &&
+        layer.width == width && layer.height == height &&
+        layer.grid_size == grid_size && layer.zoom == zoom_level &&
+        raster_pack(layer.grid_color) == raster_pack(grid_color) &&
+        raster_pack(layer.background_color) == raster_pack(background_color) &&
+        std::abs(pan_px.x - layer.origin.x) <= GRID_LAYER_MARGIN &&
+        std::abs(pan_px.y - layer.origin.y) <= GRID_LAYER_MARGIN;
+    if (current) return;
+
+    layer.valid = false;
+    SDL_Rect bounds = {0, 0, width, height};
+    SDL_Rect area = {-GRID_LAYER_MARGIN, -GRID_LAYER_MARGIN, width, height};
+
+    if (backend == RENDER_BACKEND_SOFTWARE) {
+        if (layer.pixels.width != width || layer.pixels.height != height) layer.pixels.resize(width, height);
+        DrawContext ctx;
+        ctx.pixels = &layer.pixels;
+        fill_rect(ctx, bounds, background_color);
+        draw_grid(ctx, area, {area.x, area.y});
+    } else {
+        if (layer.texture && (layer.width != width || layer.height != height)) {
+            SDL_DestroyTexture(layer.texture);
+            layer.texture = nullptr;
+        }
+        if (!layer.texture) {
+            layer.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+            if (!layer.texture) return;
+            SDL_SetTextureBlendMode(layer.texture, SDL_BLENDMODE_NONE);
+        }
+        if (SDL_SetRenderTarget(renderer, layer.texture) < 0) return;
+        // The main context's geometry buffers have room from earlier frames
+        DrawContext &ctx = main_context;
+        fill_rect(ctx, bounds, background_color);
+        draw_grid(ctx, area, {area.x, area.y});
+        flush_geometry(ctx);
+        SDL_SetRenderTarget(renderer, nullptr);
+    }
+
+    layer.valid = true;
+    layer.origin = pan_px;
+    layer.width = width;
+    layer.height = height;
+    layer.grid_size = grid_size;
+    layer.zoom = zoom_level;
+    layer.grid_color = grid_color;
+    layer.background_color = background_color;
+}
+
+// Background and grid for a screen region: one copy out of the grid layer
+// when it covers the region
+void Canvas::draw_background(DrawContext &ctx, SDL_Rect region, SDL_Point origin)
+{
+    Uint64 start = stat_clock();
+    SDL_Rect target = {region.x - origin.x, region.y - origin.y, region.w, region.h};
+    if (!grid_visible()) {
+        fill_rect(ctx, target, background_color);
+        ctx.stats[STAT_BACKGROUND_US] += stat_clock() - start;
+        return;
+    }
+
+    SDL_Point pan_px = pan_pixels();
+    SDL_Rect source = {
+        region.x + GRID_LAYER_MARGIN + pan_px.x - grid_layer.origin.x,
+        region.y + GRID_LAYER_MARGIN + pan_px.y - grid_layer.origin.y,
+        region.w,
+        region.h
     };
+    bool covered = grid_layer.valid &&
+        source.x >= 0 && source.y >= 0 &&
+        source.x + source.w <= grid_layer.width && source.y + source.h <= grid_layer.height;
+
+    if (!covered) {
+        fill_rect(ctx, target, background_color);
+        Uint64 grid_start = stat_clock();
+        ctx.stats[STAT_BACKGROUND_US] += grid_start - start;
+        draw_grid(ctx, region, origin);
+        ctx.stats[STAT_GRID_US] += stat_clock() - grid_start;
+        return;
+    }
+
+    ++ctx.stats[STAT_DRAW_CALLS];
+    if (ctx.pixels) {
+        raster_copy(*ctx.pixels, grid_layer.pixels, source, {target.x, target.y});
+    } else {
+        flush_geometry(ctx);
+        SDL_RenderCopy(renderer, grid_layer.texture, &source, &target);
+    }
+    ctx.stats[STAT_BACKGROUND_US] += stat_clock() - start;
 }
 
-SDL_Rect world_to_screen_rect(SDL_Rect r, int w, int h) {
-    return {
-        r.x + w / 2,
-        r.y + h / 2,
-        r.w,
-        r.h
+// Selection handles and rubber band where they fall inside a screen region.
+// A single shape gets handles at its corners; a larger selection also gets
+// an outline around all of it.
+void Canvas::draw_selection(DrawContext &ctx, SDL_Rect region)
+{
+    if (is_selecting) draw_marquee(ctx, region);
+    draw_guides(ctx, region);
+    if (selection.empty()) {
+        flush_geometry(ctx);
+        return;
+    }
+
+    SDL_Rect r = world_to_screen_rect(selection_box, pan_offset, zoom_level, canvas_width, canvas_height);
+    int margin = HANDLE_SIZE / 2 + 1;
+    SDL_Rect reach = {r.x - margin, r.y - margin, r.w + 2 * margin, r.h + 2 * margin};
+    if (!SDL_HasIntersection(&reach, &region)) {
+        flush_geometry(ctx);
+        return;
+    }
+
+    if (selection.size() > 1 && r.w > 0 && r.h > 0) {
+        SDL_Color outline = {0, 100, 255, 255};
+        int right = r.x + r.w - 1, bottom = r.y + r.h - 1;
+        blend_line(ctx, r.x, r.y, right, r.y, outline);
+        blend_line(ctx, r.x, bottom, right, bottom, outline);
+        blend_line(ctx, r.x, r.y, r.x, bottom, outline);
+        blend_line(ctx, right, r.y, right, bottom, outline);
+    }
+    draw_selection_handles(ctx, r);
+    flush_geometry(ctx);
+}
+
+void Canvas::draw_guides(DrawContext &ctx, SDL_Rect region)
+{
+    SDL_Color color = {255, 0, 128, 255};
+    for (int axis = SnapIndex::AXIS_X; axis <= SnapIndex::AXIS_Y; ++axis) {
+        if (!guides[axis].active) continue;
+        // One pixel wide at any zoom
+        SDL_Rect r = world_to_screen_rect(guide_rect(axis), pan_offset, zoom_level, canvas_width, canvas_height);
+        if (axis == SnapIndex::AXIS_X) r.w = 1; else r.h = 1;
+        if (!SDL_HasIntersection(&r, &region)) continue;
+        if (axis == SnapIndex::AXIS_X) {
+            blend_line(ctx, r.x, r.y, r.x, r.y + r.h - 1, color);
+        } else {
+            blend_line(ctx, r.x, r.y, r.x + r.w - 1, r.y, color);
+        }
+    }
+}
+
+void Canvas::draw_marquee(DrawContext &ctx, SDL_Rect region)
+{
+    SDL_Rect r = world_to_screen_rect(marquee_rect(), pan_offset, zoom_level, canvas_width, canvas_height);
+    if (r.w <= 0 || r.h <= 0 || !SDL_HasIntersection(&r, &region)) return;
+
+    SDL_Color outline = {0, 100, 255, 200};
+    int right = r.x + r.w - 1, bottom = r.y + r.h - 1;
+    blend_rects(ctx, &r, 1, {0, 100, 255, 40});
+    blend_line(ctx, r.x, r.y, right, r.y, outline);
+    blend_line(ctx, r.x, bottom, right, bottom, outline);
+    blend_line(ctx, r.x, r.y, r.x, bottom, outline);
+    blend_line(ctx, right, r.y, right, bottom, outline);
+}
+
+void Canvas::draw_selection_handles(DrawContext &ctx, SDL_Rect rect) {
+    int handle_size = HANDLE_SIZE;
+    int half_handle = handle_size / 2;
+
+    // Corners
+    SDL_Rect handles[4] = {
+        {rect.x - half_handle, rect.y - half_handle, handle_size, handle_size},
+        {rect.x + rect.w - half_handle, rect.y - half_handle, handle_size, handle_size},
+        {rect.x - half_handle, rect.y + rect.h - half_handle, handle_size, handle_size},
+        {rect.x + rect.w - half_handle, rect.y + rect.h - half_handle, handle_size, handle_size}
     };
+    blend_rects(ctx, handles, 4, {0, 100, 255, 255});
 }
 
-bool is_point_in_rect(SDL_Point p, SDL_Rect r) {
-    return p.x >= r.x && p.x <= r.x + r.w && p.y >= r.y && p.y <= r.y + r.h;
+// Adds a screen rect to a batch of its color and returns the batch. Walking
+// back from the newest batch, a same-colored batch may be reused only if no
+// later batch overlaps the rect, so submitting batches in creation order
+// keeps z-order intact.
+int Canvas::add_to_batch(DrawContext &ctx, SDL_Rect rect, SDL_Color color)
+{
+    const int max_lookback = 32;
+
+    for (int b = ctx.batch_count - 1; b >= 0 && b >= ctx.batch_count - max_lookback; --b) {
+        ColorBatch &batch = ctx.batches[b];
+        if (batch.color.r == color.r && batch.color.g == color.g && batch.color.b == color.b && batch.color.a == color.a) {
+            SDL_UnionRect(&batch.bounds, &rect, &batch.bounds);
+            ++batch.count;
+            return b;
+        }
+        if (SDL_HasIntersection(&batch.bounds, &rect)) break;
+    }
+
+    ColorBatch &batch = ctx.batches[ctx.batch_count];
+    batch.color = color;
+    batch.bounds = rect;
+    batch.first = 0;
+    batch.count = 1;
+    return ctx.batch_count++;
 }
 
-// Global state
-Canvas::Canvas(int width, int height)
+// Queues a screen rect for repaint. Overlapping rects are merged and a long
+// list collapses into its bounding box, so a frame repaints a few regions.
+void Canvas::mark_dirty(SDL_Rect screen_rect)
 {
-    SDL_SetHint(SDL_HINT_EMSCRIPTEN_KEYBOARD_ELEMENT, "#canvas");
+    if (full_damage) return;
 
-    canvas_width = std::max(width, 300);
-    canvas_height = std::max(height, 300);
+    SDL_Rect screen_bounds = {0, 0, canvas_width, canvas_height};
+    if (!SDL_IntersectRect(&screen_rect, &screen_bounds, &screen_rect)) return;
 
-    emscripten_set_canvas_element_size("#canvas", canvas_width, canvas_height);
+    for (SDL_Rect &existing : damage_rects) {
+        if (SDL_HasIntersection(&existing, &screen_rect)) {
+            SDL_UnionRect(&existing, &screen_rect, &existing);
+            return;
+        }
+    }
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        std::cerr << "SDL initialization failed: " << SDL_GetError() << std::endl;
-        return;
+    damage_rects.push_back(screen_rect);
+    if ((int)damage_rects.size() > MAX_DAMAGE_RECTS) {
+        SDL_Rect bounds = damage_rects[0];
+        for (const SDL_Rect &r : damage_rects) SDL_UnionRect(&bounds, &r, &bounds);
+        damage_rects.clear();
+        damage_rects.push_back(bounds);
     }
+}
 
-    if (SDL_CreateWindowAndRenderer(canvas_width, canvas_height, 0, &window, &renderer) < 0) {
-        std::cerr << "SDL_CreateWindowAndRenderer failed: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return;
+void Canvas::mark_all_dirty()
+{
+    full_damage = true;
+    damage_rects.clear();
+}
+
+// Screen area of a shape including its selection handles
+void Canvas::mark_shape_dirty(ShapeId id)
+{
+    int index = scene.index_of(id);
+    if (index == -1) return;
+
+    mark_world_dirty(scene.rect(index), HANDLE_SIZE / 2 + 1);
+}
+
+// Screen area of a world rect grown by a margin in screen pixels
+void Canvas::mark_world_dirty(SDL_Rect world_rect, int margin)
+{
+    SDL_Rect r = world_to_screen_rect(world_rect, pan_offset, zoom_level, canvas_width, canvas_height);
+    mark_dirty({r.x - margin, r.y - margin, r.w + 2 * margin, r.h + 2 * margin});
+}
+
+// A shape's pixels changed: drop its cached tiles as well as its screen area
+void Canvas::invalidate_shape(ShapeId id)
+{
+    int index = scene.index_of(id);
+    if (index == -1) return;
+
+    tile_cache.invalidate(tile_footprint(index));
+    mark_shape_dirty(id);
+}
+
+// World area whose tiles change with a shape. Shapes in the LOD pyramid also
+// reach the pixels under their cells.
+SDL_Rect Canvas::tile_footprint(int index) const
+{
+    SDL_Rect r = scene.rect(index);
+    if (!LodPyramid::holds(spatial_index.node_half((int)scene.ids[index]))) return r;
+
+    int margin = LodPyramid::FOOTPRINT_MARGIN;
+    return {r.x - margin, r.y - margin, r.w + 2 * margin, r.h + 2 * margin};
+}
+
+// Redraws background, grid and fills inside a screen region into the current
+// target, translated so the screen point origin lands at (0, 0)
+void Canvas::draw_region(DrawContext &ctx, SDL_Rect region, SDL_Point origin)
+{
+    draw_background(ctx, region, origin);
+    Uint64 start = stat_clock();
+
+    // Cull against the region with a pixel of slack for rounding, then
+    // restore stacking order from the z column
+    int margin = (int)ceilf(1 / zoom_level);
+    SDL_Point top_left = screen_to_world({region.x, region.y}, pan_offset, zoom_level, canvas_width, canvas_height);
+    SDL_Point bottom_right = screen_to_world({region.x + region.w, region.y + region.h}, pan_offset, zoom_level, canvas_width, canvas_height);
+    SDL_Rect world_region = {
+        top_left.x - margin,
+        top_left.y - margin,
+        bottom_right.x - top_left.x + 2 * margin,
+        bottom_right.y - top_left.y + 2 * margin
+    };
+
+    // Zoomed out, shapes narrower than a pixel come from the LOD pyramid as
+    // one layer under the rest, and the index skips the nodes holding them
+    int lod_level = LodPyramid::level_for_zoom(zoom_level);
+    ctx.arena.reset();
+    if (lod_level) draw_lod(ctx, region, origin, lod_level);
+
+    ctx.visible_shapes.clear();
+    spatial_index.query_rect(world_region, ctx.visible_shapes, lod_level ? LodPyramid::cell_size(lod_level) : 0);
+    int visible = (int)ctx.visible_shapes.size();
+    ctx.stats[STAT_SHAPES_VISITED] += visible;
+
+    DrawItem *items = ctx.arena.allocate_array<DrawItem>(visible);
+    for (int i = 0; i < visible; ++i) {
+        int index = scene.index_of((ShapeId)ctx.visible_shapes[i]);
+        items[i].z = scene.z[index];
+        items[i].index = index;
     }
-    std::cout << "SDL window and renderer created successfully" << std::endl;
+    std::sort(items, items + visible, [](const DrawItem &a, const DrawItem &b) { return a.z < b.z; });
 
-    // Create some test shapes
-    shapes.push_back({ShapeType::RECTANGLE, {-50, -50, 100, 100}, {255, 0, 0, 255}});
-    shapes.push_back({ShapeType::RECTANGLE, {100, 100, 80, 120}, {0, 255, 0, 255}});
-    shapes.push_back({ShapeType::RECTANGLE, {-200, 80, 150, 50}, {0, 0, 255, 255}});
+    // Break the shapes that show into fills: a rectangle is one, an ellipse
+    // one per run of its anti-aliased coverage. The rasterizer has no per-call
+    // cost to batch away, so it takes them in stacking order right here.
+    ctx.fills.clear();
+    for (int i = 0; i < visible; ++i) {
+        int index = items[i].index;
+        SDL_Rect screen_rect = world_to_screen_rect(scene.rect(index), pan_offset, zoom_level, canvas_width, canvas_height);
+        if (screen_rect.w <= 0 || screen_rect.h <= 0 || !SDL_HasIntersection(&screen_rect, &region)) {
+            ++ctx.stats[STAT_SHAPES_CULLED];
+            continue;
+        }
+
+        SDL_Color color = scene.color[index];
+        bool ellipse = scene.type[index] == CIRCLE;
+        screen_rect.x -= origin.x;
+        screen_rect.y -= origin.y;
+        if (ctx.pixels) {
+            ++ctx.stats[STAT_DRAW_CALLS];
+            if (ellipse) {
+                raster_blend_ellipse(*ctx.pixels, screen_rect, color, ctx.ellipses);
+            } else {
+                raster_blend_rect(*ctx.pixels, screen_rect, color);
+            }
+        } else if (!ellipse) {
+            if (queues_geometry(ctx)) queue_rect(ctx, screen_rect, color);
+            else ctx.fills.push_back({screen_rect, color, 0});
+        } else {
+            SDL_Rect clip = {region.x - origin.x, region.y - origin.y, region.w, region.h};
+            ctx.ellipses.for_each_run(screen_rect, clip, [&](SDL_Rect run, int level) {
+                SDL_Color run_color = {color.r, color.g, color.b, EllipseCache::run_alpha(color, level)};
+                if (queues_geometry(ctx)) queue_rect(ctx, run, run_color);
+                else if (run_color.a) ctx.fills.push_back({run, run_color, 0});
+            });
+        }
+    }
+
+    int fill_count = (int)ctx.fills.size();
+    ctx.batches = ctx.arena.allocate_array<ColorBatch>(fill_count);
+    ctx.batch_count = 0;
+    for (Fill &fill : ctx.fills) fill.batch = add_to_batch(ctx, fill.rect, fill.color);
+
+    // Lay the batches out back to back, each in stacking order
+    SDL_Rect *rects = ctx.arena.allocate_array<SDL_Rect>(fill_count);
+    int offset = 0;
+    for (int b = 0; b < ctx.batch_count; ++b) {
+        ctx.batches[b].first = offset;
+        offset += ctx.batches[b].count;
+        ctx.batches[b].count = 0;
+    }
+    for (const Fill &fill : ctx.fills) {
+        ColorBatch &batch = ctx.batches[fill.batch];
+        rects[batch.first + batch.count++] = fill.rect;
+    }
+
+    for (int b = 0; b < ctx.batch_count; ++b) {
+        const ColorBatch &batch = ctx.batches[b];
+        blend_rects(ctx, rects + batch.first, batch.count, batch.color);
+    }
+    flush_geometry(ctx);
+    ctx.stats[STAT_SHAPES_US] += stat_clock() - start;
+}
+
+// Draws the LOD cells under a region, resolved to pixel colors by the
+// pyramid. Rows go in bands to bound the scratch. Runs of a color are
+// submitted in one batch per color; they never overlap, so their order does
+// not matter.
+void Canvas::draw_lod(DrawContext &ctx, SDL_Rect region, SDL_Point origin, int level)
+{
+    const int BAND_ROWS = 64;
+    struct Run {
+        Uint32 color; // Quantized ARGB
+        SDL_Rect rect;
+    };
+
+    SDL_Point pan_px = pan_pixels();
+    int left = region.x + pan_px.x - canvas_width / 2;
+    int top = region.y + pan_px.y - canvas_height / 2;
+
+    size_t band_pixels = (size_t)region.w * BAND_ROWS;
+    LodPyramid::Sums *sums = ctx.arena.allocate_array<LodPyramid::Sums>(band_pixels);
+    Uint32 *colors = ctx.arena.allocate_array<Uint32>(band_pixels);
+    Run *runs = ctx.arena.allocate_array<Run>(band_pixels);
+    SDL_Rect *rects = ctx.arena.allocate_array<SDL_Rect>(band_pixels);
+
+    for (int band = 0; band < region.h; band += BAND_ROWS) {
+        int rows = std::min(BAND_ROWS, region.h - band);
+        lod.resolve(level, zoom_level, left, top + band, region.w, rows, sums, colors);
+
+        int run_count = 0;
+        for (int r = 0; r < rows; ++r) {
+            Uint32 run_color = 0;
+            int run_start = 0;
+            for (int k = 0; k <= region.w; ++k) {
+                Uint32 color = k < region.w ? colors[(size_t)r * region.w + k] : 0;
+                if (k < region.w && color == run_color) continue;
+                if (run_color) {
+                    SDL_Rect rect = {region.x - origin.x + run_start, region.y - origin.y + band + r, k - run_start, 1};
+                    runs[run_count++] = {run_color, rect};
+                }
+                run_color = color;
+                run_start = k;
+            }
+        }
+
+        // Only separate SDL fills have a per-call cost to save by grouping
+        if (ctx.pixels || queues_geometry(ctx)) {
+            if (ctx.pixels) ++ctx.stats[STAT_DRAW_CALLS];
+            for (int i = 0; i < run_count; ++i) {
+                Uint32 c = runs[i].color;
+                SDL_Color color = {(Uint8)(c >> 16), (Uint8)(c >> 8), (Uint8)c, (Uint8)(c >> 24)};
+                if (ctx.pixels) raster_blend_rect(*ctx.pixels, runs[i].rect, color);
+                else queue_rect(ctx, runs[i].rect, color);
+            }
+            continue;
+        }
+
+        std::sort(runs, runs + run_count, [](const Run &a, const Run &b) { return a.color < b.color; });
+        for (int i = 0; i < run_count; ++i) rects[i] = runs[i].rect;
+        for (int first = 0, last; first < run_count; first = last) {
+            for (last = first + 1; last < run_count && runs[last].color == runs[first].color; ++last) {}
+            Uint32 c = runs[first].color;
+            SDL_Color color = {(Uint8)(c >> 16), (Uint8)(c >> 8), (Uint8)c, (Uint8)(c >> 24)};
+            blend_rects(ctx, rects + first, last - first, color);
+        }
+    }
+}
+
+const SceneView &Canvas::view_scene()
+{
+    scene_view.refresh(scene);
+    return scene_view;
 }
 
-void Canvas::draw_grid(SDL_Renderer *renderer)
+const SceneView &Canvas::drain_changes()
 {
-    if (!show_grid) return;
+    scene_view.change_count = (Uint32)changes.drain();
+    scene_view.changes = changes.records();
+    scene_view.reset = changes.drained_reset();
+    return view_scene();
+}
 
-    SDL_SetRenderDrawColor(renderer, grid_color.r, grid_color.g, grid_color.b, grid_color.a);
+// Main render function. Repaints only damaged regions of the persistent frame
+// and returns false without touching the GPU when nothing changed.
+bool Canvas::render()
+{
+    Uint64 *stats = main_context.stats;
+    Uint64 start = stat_clock();
+    frame_arena.reset();
+    drain_input();
+    trace.record(TRACE_RENDER); // After the input it drained, as a replay sees it
+    if (selection_box_stale) update_selection_box();
+    Uint64 drained = stat_clock();
+    stats[STAT_INPUT_US] += drained - start;
 
-    for (int x = 0; x < canvas_width; x += grid_size) {
-        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-        SDL_RenderDrawLine(renderer, x, 0, x, canvas_height);
+    if (!renderer || (!full_damage && damage_rects.empty())) {
+        stats[STAT_TOTAL_US] += drained - start;
+        return false;
     }
 
-    for (int y = 0; y < canvas_height; y += grid_size) {
-        SDL_RenderDrawLine(renderer, 0, y, canvas_width, y);
+    // Layers are brought up to date first, while the default target is bound
+    prepare_frame();
+    Uint64 grid_start = stat_clock();
+    update_grid_layer();
+    stats[STAT_GRID_US] += stat_clock() - grid_start;
+    bool from_tiles = prepare_tiles();
+
+    if (backend == RENDER_BACKEND_SOFTWARE) {
+        render_software(from_tiles);
+    } else {
+        render_sdl(from_tiles);
     }
+
+    stats[STAT_DAMAGE_RECTS] += full_damage ? 1 : damage_rects.size();
+    full_damage = false;
+    damage_rects.clear();
+
+    stats[STAT_TOTAL_US] += stat_clock() - start;
+    record_frame_stats();
+    return true;
 }
 
-void Canvas::draw_selection_handles(SDL_Renderer *renderer, SDL_Rect rect) {
-    SDL_SetRenderDrawColor(renderer, 0, 100, 255, 255);
-    int handle_size = 8;
-    int half_handle = handle_size / 2;
+// Adds up every context's stats into the next ring slot and starts over
+void Canvas::record_frame_stats()
+{
+    for (DrawContext &worker : worker_contexts) {
+        for (int stat = 0; stat < FRAME_STAT_COUNT; ++stat) main_context.stats[stat] += worker.stats[stat];
+        std::fill(worker.stats, worker.stats + FRAME_STAT_COUNT, 0);
+    }
+    frame_stats.record(main_context.stats);
+    std::fill(main_context.stats, main_context.stats + FRAME_STAT_COUNT, 0);
+}
 
-    // Corners
-    SDL_RenderFillRect(renderer, new SDL_Rect{rect.x - half_handle, rect.y - half_handle, handle_size, handle_size});
-    SDL_RenderFillRect(renderer, new SDL_Rect{rect.x + rect.w - half_handle, rect.y - half_handle, handle_size, handle_size});
-    SDL_RenderFillRect(renderer, new SDL_Rect{rect.x - half_handle, rect.y + rect.h - half_handle, handle_size, handle_size});
-    SDL_RenderFillRect(renderer, new SDL_Rect{rect.x + rect.w - half_handle, rect.y + rect.h - half_handle, handle_size, handle_size});
+// Makes every tile under the damaged regions resident and clean. Returns false
+// when tiles are unavailable (no render target support) so the frame is drawn
+// directly instead.
+bool Canvas::prepare_tiles()
+{
+    const int T = TileCache::TILE_SIZE;
+    SDL_Point pan_px = pan_pixels();
+    SDL_Renderer *tile_renderer = backend == RENDER_BACKEND_SOFTWARE ? nullptr : renderer;
+
+    tile_cache.begin_frame();
+    frame_tile_count = 0;
+    dirty_tile_count = 0;
+
+    SDL_Rect full = {0, 0, canvas_width, canvas_height};
+    const SDL_Rect *regions = full_damage ? &full : damage_rects.data();
+    int region_count = full_damage ? 1 : (int)damage_rects.size();
+
+    // Screen to content is a shift by the pan
+    SDL_Rect *spans = frame_arena.allocate_array<SDL_Rect>(region_count); // Tile ranges, inclusive
+    int most = 0;
+    for (int i = 0; i < region_count; ++i) {
+        int cx0 = regions[i].x + pan_px.x - canvas_width / 2;
+        int cy0 = regions[i].y + pan_px.y - canvas_height / 2;
+        spans[i].x = floor_div(cx0, T);
+        spans[i].y = floor_div(cy0, T);
+        spans[i].w = floor_div(cx0 + regions[i].w - 1, T) - spans[i].x + 1;
+        spans[i].h = floor_div(cy0 + regions[i].h - 1, T) - spans[i].y + 1;
+        most += spans[i].w * spans[i].h;
+    }
+    frame_tiles = frame_arena.allocate_array<Tile *>(most);
+    dirty_tiles = frame_arena.allocate_array<Tile *>(most);
+
+    for (int i = 0; i < region_count; ++i) {
+        for (int ty = spans[i].y; ty < spans[i].y + spans[i].h; ++ty) {
+            for (int tx = spans[i].x; tx < spans[i].x + spans[i].w; ++tx) {
+                Tile *tile = tile_cache.acquire(tile_renderer, zoom_level, tx, ty);
+                if (!tile) return false;
+                if (std::find(frame_tiles, frame_tiles + frame_tile_count, tile) != frame_tiles + frame_tile_count) continue;
+
+                frame_tiles[frame_tile_count++] = tile;
+                if (!SDL_RectEmpty(&tile->dirty)) dirty_tiles[dirty_tile_count++] = tile;
+            }
+        }
+    }
+
+    main_context.stats[STAT_TILES_RASTERIZED] += dirty_tile_count;
+
+    // Software tiles are independent framebuffers, so they rasterize in
+    // parallel; each slot draws with its own context. The SDL renderer is
+    // single-threaded.
+    if (backend == RENDER_BACKEND_SOFTWARE && raster_pool.worker_count() > 0 && dirty_tile_count > 1) {
+        raster_pool.run(dirty_tile_count, [&](int i, int slot) {
+            render_tile(worker_contexts[slot], *dirty_tiles[i], pan_px);
+        });
+        return true;
+    }
+
+    for (int i = 0; i < dirty_tile_count; ++i) {
+        if (!render_tile(main_context, *dirty_tiles[i], pan_px)) return false;
+    }
+    return true;
 }
 
+// Redraws the dirty part of a tile into its texture or framebuffer
+bool Canvas::render_tile(DrawContext &ctx, Tile &tile, SDL_Point pan_px)
+{
+    const int T = TileCache::TILE_SIZE;
+    SDL_Point origin = {
+        tile.tx * T - pan_px.x + canvas_width / 2,
+        tile.ty * T - pan_px.y + canvas_height / 2
+    };
+    SDL_Rect region = {origin.x + tile.dirty.x, origin.y + tile.dirty.y, tile.dirty.w, tile.dirty.h};
+
+    if (backend == RENDER_BACKEND_SOFTWARE) {
+        Framebuffer *frame = ctx.pixels;
+        ctx.pixels = &tile.pixels;
+        set_clip(ctx, &tile.dirty);
+        draw_region(ctx, region, origin);
+        set_clip(ctx, nullptr);
+        ctx.pixels = frame;
+    } else {
+        if (SDL_SetRenderTarget(renderer, tile.texture) < 0) return false;
+        SDL_RenderSetClipRect(renderer, &tile.dirty);
+        draw_region(ctx, region, origin);
+        SDL_RenderSetClipRect(renderer, nullptr);
+        SDL_SetRenderTarget(renderer, nullptr);
+    }
+
+    tile.dirty = {0, 0, 0, 0};
+    return true;
+}
 
-// Main render function
-void Canvas::render()
+// Composites the frame on the calling thread in a fixed order, so the result
+// does not depend on how tiles were scheduled
+void Canvas::repaint_damage(bool from_tiles)
 {
-    if (!renderer) return;
+    const int T = TileCache::TILE_SIZE;
+    SDL_Point pan_px = pan_pixels();
+    DrawContext &ctx = main_context;
+
+    SDL_Rect full = {0, 0, canvas_width, canvas_height};
+    const SDL_Rect *regions = full_damage ? &full : damage_rects.data();
+    int region_count = full_damage ? 1 : (int)damage_rects.size();
 
-    SDL_SetRenderDrawColor(renderer, background_color.r, background_color.g, background_color.b, background_color.a);
-    SDL_RenderClear(renderer);
+    for (int i = 0; i < region_count; ++i) {
+        const SDL_Rect &region = regions[i];
+        if (!full_damage) set_clip(ctx, &region);
+
+        if (from_tiles) {
+            Uint64 start = stat_clock();
+            for (int t = 0; t < frame_tile_count; ++t) {
+                const Tile *tile = frame_tiles[t];
+                SDL_Rect screen = {
+                    tile->tx * T - pan_px.x + canvas_width / 2,
+                    tile->ty * T - pan_px.y + canvas_height / 2,
+                    T,
+                    T
+                };
+                SDL_Rect part;
+                if (!SDL_IntersectRect(&screen, &region, &part)) continue;
+
+                SDL_Rect source = {part.x - screen.x, part.y - screen.y, part.w, part.h};
+                ++ctx.stats[STAT_DRAW_CALLS];
+                if (ctx.pixels) {
+                    raster_copy(*ctx.pixels, tile->pixels, source, {part.x, part.y});
+                } else {
+                    SDL_RenderCopy(renderer, tile->texture, &source, &part);
+                }
+            }
+            ctx.stats[STAT_COMPOSITE_US] += stat_clock() - start;
+        } else {
+            draw_region(ctx, region, {0, 0});
+        }
+
+        // Handles go on top of every fill
+        Uint64 start = stat_clock();
+        draw_selection(ctx, region);
+        ctx.stats[STAT_SELECTION_US] += stat_clock() - start;
+    }
+    set_clip(ctx, nullptr);
+}
+
+int Canvas::set_raster_threads(int threads)
+{
+    raster_pool.resize(threads);
+    worker_contexts.resize(raster_pool.worker_count() + 1);
+    return raster_pool.worker_count();
+}
 
-    draw_grid(renderer);
+// Creates the persistent frame on first use; a new frame is fully damaged
+void Canvas::prepare_frame()
+{
+    main_context.pixels = backend == RENDER_BACKEND_SOFTWARE ? &framebuffer : nullptr;
 
-    for (const auto& shape : shapes) {
-        SDL_Rect screen_rect = world_to_screen_rect(shape.rect, canvas_width, canvas_height);
-        SDL_SetRenderDrawColor(renderer, shape.color.r, shape.color.g, shape.color.b, shape.color.a);
-        SDL_RenderFillRect(renderer, &screen_rect);
-        if(shape.is_selected) {
-            draw_selection_handles(renderer, screen_rect);
+    if (backend == RENDER_BACKEND_SOFTWARE) {
+        if (framebuffer.width != canvas_width || framebuffer.height != canvas_height) {
+            framebuffer.resize(canvas_width, canvas_height);
+            full_damage = true;
         }
+        if (!framebuffer_texture) {
+            framebuffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, canvas_width, canvas_height);
+            if (!framebuffer_texture) {
+                std::cerr << "SDL_CreateTexture failed: " << SDL_GetError() << std::endl;
+                return;
+            }
+            SDL_SetTextureBlendMode(framebuffer_texture, SDL_BLENDMODE_NONE);
+            full_damage = true;
+        }
+        return;
+    }
+
+    if (!scene_texture) {
+        scene_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, canvas_width, canvas_height);
+        if (scene_texture) SDL_SetTextureBlendMode(scene_texture, SDL_BLENDMODE_NONE);
+        full_damage = true;
+    }
+}
+
+void Canvas::render_sdl(bool from_tiles)
+{
+    // Without render targets the backbuffer cannot be trusted, repaint it whole
+    if (!scene_texture || SDL_SetRenderTarget(renderer, scene_texture) < 0) {
+        full_damage = true;
+        repaint_damage(false);
+        present();
+        return;
+    }
+
+    repaint_damage(from_tiles);
+
+    Uint64 start = stat_clock();
+    SDL_SetRenderTarget(renderer, nullptr);
+    SDL_RenderCopy(renderer, scene_texture, nullptr, nullptr);
+    ++main_context.stats[STAT_DRAW_CALLS];
+    main_context.stats[STAT_COMPOSITE_US] += stat_clock() - start;
+    present();
+}
+
+// Rasterizes damaged regions into the CPU framebuffer and uploads their
+// bounding box into one streaming texture.
+void Canvas::render_software(bool from_tiles)
+{
+    if (!framebuffer_texture) return;
+
+    SDL_Rect upload = {0, 0, canvas_width, canvas_height};
+    if (!full_damage) {
+        upload = damage_rects[0];
+        for (const SDL_Rect &r : damage_rects) SDL_UnionRect(&upload, &r, &upload);
     }
 
+    repaint_damage(from_tiles);
+
+    Uint64 start = stat_clock();
+    const Uint32 *first = framebuffer.pixels.data() + (size_t)upload.y * framebuffer.width + upload.x;
+    SDL_UpdateTexture(framebuffer_texture, &upload, first, framebuffer.pitch());
+    SDL_RenderCopy(renderer, framebuffer_texture, nullptr, nullptr);
+    ++main_context.stats[STAT_DRAW_CALLS];
+    main_context.stats[STAT_COMPOSITE_US] += stat_clock() - start;
+    present();
+}
+
+void Canvas::present()
+{
+    Uint64 start = stat_clock();
     SDL_RenderPresent(renderer);
+    main_context.stats[STAT_PRESENT_US] += stat_clock() - start;
 }
 
 void Canvas::resize(int new_width, int new_height)
 {
+    trace.record(TRACE_RESIZE, new_width, new_height);
     if (new_width <= 0 || new_height <= 0) return;
 
     canvas_width = new_width;
     canvas_height = new_height;
 
+    // Frame textures are recreated at the new size on the next frame
+    if (scene_texture) {
+        SDL_DestroyTexture(scene_texture);
+        scene_texture = nullptr;
+    }
+    if (framebuffer_texture) {
+        SDL_DestroyTexture(framebuffer_texture);
+        framebuffer_texture = nullptr;
+    }
+    if (grid_layer.texture) {
+        SDL_DestroyTexture(grid_layer.texture);
+        grid_layer.texture = nullptr;
+    }
+    grid_layer.valid = false;
+    mark_all_dirty();
+
+#ifdef __EMSCRIPTEN__
     emscripten_set_canvas_element_size("#canvas", canvas_width, canvas_height);
     SDL_SetWindowSize(window, canvas_width, canvas_height);
     SDL_RenderSetLogicalSize(renderer, canvas_width, canvas_height);
+#else
+    // Tiles are in content space and survive a resize, but not their renderer
+    tile_cache.clear();
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (surface) SDL_FreeSurface(surface);
+    renderer = nullptr;
+    surface = nullptr;
+    create_offscreen_renderer();
+#endif
 
     std::cout << "SDL2: Canvas resized to " << canvas_width << "x" << canvas_height << std::endl;
 }
 
 void Canvas::setBackgroundColor(int r, int g, int b, int a)
 {
+    trace.record(TRACE_BACKGROUND, r, g, b, a);
     background_color.r = (Uint8)r;
     background_color.g = (Uint8)g;
     background_color.b = (Uint8)b;
     background_color.a = (Uint8)a;
+    tile_cache.invalidate_all();
+    mark_all_dirty();
 
-    
     CanvasStates::bg[0] = (Uint8)r;
     CanvasStates::bg[1] = (Uint8)g;
     CanvasStates::bg[2] = (Uint8)b;
@@ -141,19 +1679,24 @@ void Canvas::setBackgroundColor(int r, int g, int b, int a)
 
 void Canvas::set_grid_settings(bool show, int size)
 {
+    trace.record(TRACE_GRID, show, size);
     show_grid = show;
     grid_size = std::max(5, size);
+    tile_cache.invalidate_all();
+    mark_all_dirty();
 }
 
 void Canvas::set_grid_settings(bool show, int size, int r, int g, int b, int a)
 {
+    trace.record(TRACE_GRID_COLOR, show, size, r, g, b, a);
     show_grid = show;
     grid_size = std::max(5, size);
     grid_color.r = (Uint8)r;
     grid_color.g = (Uint8)g;
     grid_color.b = (Uint8)b;
     grid_color.a = (Uint8)a;
-
+    tile_cache.invalidate_all();
+    mark_all_dirty();
 
     CanvasStates::grid_color[0] = (Uint8)r;
     CanvasStates::grid_color[1] = (Uint8)g;
@@ -161,79 +1704,466 @@ void Canvas::set_grid_settings(bool show, int size, int r, int g, int b, int a)
     CanvasStates::grid_color[3] = (Uint8)a;
 }
 
+void Canvas::set_snapping(bool to_grid, bool to_shapes)
+{
+    trace.record(TRACE_SNAPPING, to_grid, to_shapes);
+    snap_to_grid = to_grid;
+    snap_to_shapes = to_shapes;
+}
+
 void Canvas::set_zoom(float zoom) {
-    // Stub function for JavaScript compatibility - does nothing
+    zoom_at_point(zoom, canvas_width / 2, canvas_height / 2);
 }
 
 void Canvas::zoom_at_point(float zoom_factor, int x, int y) {
-    // Stub function for JavaScript compatibility - does nothing
+    if (trace.recording()) {
+        int bits;
+        std::memcpy(&bits, &zoom_factor, sizeof(bits));
+        trace.record(TRACE_ZOOM, bits, x, y);
+    }
+    if (zoom_factor <= 0) return;
+
+    // World point under the cursor before the zoom change
+    float world_x = ((float)x - (float)(canvas_width / 2)) / zoom_level + pan_offset.x;
+    float world_y = ((float)y - (float)(canvas_height / 2)) / zoom_level + pan_offset.y;
+
+    zoom_level = std::max(0.1f, std::min(zoom_factor, 10.0f));
+
+    // Move the pan offset so that the same world point stays under the cursor
+    pan_offset.x = world_x - ((float)x - (float)(canvas_width / 2)) / zoom_level;
+    pan_offset.y = world_y - ((float)y - (float)(canvas_height / 2)) / zoom_level;
+    mark_all_dirty();
+}
+
+void Canvas::pan(int dx, int dy) {
+    pan_offset.x -= (float)dx / zoom_level;
+    pan_offset.y -= (float)dy / zoom_level;
+    if (dx != 0 || dy != 0) mark_all_dirty();
 }
 
 void Canvas::cleanup()
 {
+    export_writer.wait();
+    if (scene_texture) SDL_DestroyTexture(scene_texture);
+    if (framebuffer_texture) SDL_DestroyTexture(framebuffer_texture);
+    if (grid_layer.texture) SDL_DestroyTexture(grid_layer.texture);
+    tile_cache.clear();
     if (renderer) SDL_DestroyRenderer(renderer);
     if (window) SDL_DestroyWindow(window);
+    if (surface) SDL_FreeSurface(surface);
     SDL_Quit();
 }
 
 void Canvas::handle_mouse_down(int x, int y, int button)
 {
+    trace.record(TRACE_MOUSE_DOWN, x, y, button);
     last_mouse_pos = {x, y};
 
-    if (button == 0) { // Left mouse button only - no middle button panning
+    if (button == 1) { // Middle mouse button
+        is_panning = true;
+    } else if (button == 0) { // Left mouse button
         on_drag_start(x, y);
     }
 }
 
 void Canvas::handle_mouse_move(int x, int y) {
+    trace.record(TRACE_MOUSE_MOVE, x, y);
     int dx = x - last_mouse_pos.x;
     int dy = y - last_mouse_pos.y;
 
+    if (is_panning) {
+        pan(dx, dy);
+    }
+
+    if (is_selecting) {
+        update_marquee(screen_to_world({x, y}, pan_offset, zoom_level, canvas_width, canvas_height));
+    }
+
     if (is_dragging) {
-        on_drag_update(dx, dy);
+        // Drag in world units; deltas of projected points never drift when zoomed
+        SDL_Point world_last = screen_to_world(last_mouse_pos, pan_offset, zoom_level, canvas_width, canvas_height);
+        SDL_Point world_now = screen_to_world({x, y}, pan_offset, zoom_level, canvas_width, canvas_height);
+        on_drag_update(world_now.x - world_last.x, world_now.y - world_last.y);
     }
 
     last_mouse_pos = {x, y};
 }
 
 void Canvas::handle_mouse_up(int x, int y, int button) {
+    trace.record(TRACE_MOUSE_UP, x, y, button);
+    if (button == 1 && is_panning) {
+        is_panning = false;
+    }
+
     if (button == 0 && is_dragging) {
         is_dragging = false;
         on_drag_end();
     }
+
+    if (button == 0 && is_selecting) {
+        mark_world_dirty(marquee_rect(), 1);
+        is_selecting = false;
+    }
 }
 
 void Canvas::on_drag_start(int x, int y) {
-    SDL_Point world_pos = screen_to_world({x, y}, canvas_width, canvas_height);
-    
-    selected_shape_index = -1;
-    for (int i = shapes.size() - 1; i >= 0; --i) {
-        shapes[i].is_selected = false;
-        if (selected_shape_index == -1 && is_point_in_rect(world_pos, shapes[i].rect)) {
-            selected_shape_index = i;
-        }
+    history.seal();
+    SDL_Point world_pos = screen_to_world({x, y}, pan_offset, zoom_level, canvas_width, canvas_height);
+
+    // Pressing on a selected shape drags the whole selection; pressing on
+    // another shape selects just that one; empty space starts a rubber band
+    int hit = spatial_index.query_topmost(world_pos);
+    ++main_context.stats[STAT_HIT_TESTS];
+    if (hit != -1 && selection.contains((ShapeId)hit)) {
+        begin_drag();
+        return;
     }
-    
-    if (selected_shape_index != -1) {
-        is_dragging = true;
-        shapes[selected_shape_index].is_selected = true;
+
+    clear_selection();
+    if (hit != -1) {
+        select_shape((ShapeId)hit);
+        begin_drag();
+    } else {
+        is_selecting = true;
+        marquee_anchor = marquee_point = world_pos;
     }
 }
 
+void Canvas::begin_drag()
+{
+    if (selection_box_stale) update_selection_box();
+    is_dragging = true;
+    drag_box = selection_box;
+    drag_travel = drag_applied = {0, 0};
+}
+
 void Canvas::on_drag_update(int dx, int dy) {
-    if (is_dragging && selected_shape_index != -1) {
-        shapes[selected_shape_index].rect.x += dx;
-        shapes[selected_shape_index].rect.y += dy;
+    if (!is_dragging || selection.empty() || (dx == 0 && dy == 0)) return;
+
+    drag_travel.x += dx;
+    drag_travel.y += dy;
+    SDL_Rect moving = {drag_box.x + drag_travel.x, drag_box.y + drag_travel.y, drag_box.w, drag_box.h};
+    SDL_Point snap = snap_offset(moving);
+
+    dx = drag_travel.x + snap.x - drag_applied.x;
+    dy = drag_travel.y + snap.y - drag_applied.y;
+    if (dx == 0 && dy == 0) return;
+    drag_applied.x += dx;
+    drag_applied.y += dy;
+
+    move_shapes(selection.data(), selection.size(), dx, dy);
+
+    // A drag is one history entry however many updates it takes
+    if (!history.extend_move(selection.data(), selection.size(), dx, dy)) {
+        ShapeId *ids = history.record_move(selection.size(), dx, dy);
+        if (ids) std::copy(selection.begin(), selection.end(), ids);
     }
 }
 
 void Canvas::on_drag_end() {
     is_dragging = false;
+    clear_guides();
+    history.seal();
+}
+
+// Correction that snaps moving, the selection bounds where the pointer alone
+// would put them, on each axis: the smallest distance from one of its edges
+// or its center to a grid line or to an edge or center of an unselected
+// shape in view. Shapes come from snap_index, nearest first, so each drag
+// sample costs six logarithmic lookups rather than a pass over the scene.
+// Ties go to shapes, which also set the guide for the axis.
+SDL_Point Canvas::snap_offset(SDL_Rect moving)
+{
+    int reach = (int)std::ceil(SNAP_DISTANCE / zoom_level);
+    SDL_Point corner = screen_to_world({0, 0}, pan_offset, zoom_level, canvas_width, canvas_height);
+    SDL_Point far_corner = screen_to_world({canvas_width, canvas_height}, pan_offset, zoom_level, canvas_width, canvas_height);
+    SDL_Rect view = {corner.x, corner.y, far_corner.x - corner.x + 1, far_corner.y - corner.y + 1};
+
+    auto in_view = [&](const SnapIndex::Entry &entry) {
+        if (selection.contains(entry.id)) return false;
+        SDL_Rect rect = scene.rect(scene.index_of(entry.id));
+        return SDL_HasIntersection(&rect, &view) == SDL_TRUE;
+    };
+
+    int offset[2] = {0, 0};
+    ShapeId targets[2];
+    int positions[2] = {0, 0};
+    for (int axis = SnapIndex::AXIS_X; axis <= SnapIndex::AXIS_Y; ++axis) {
+        int features[3];
+        SnapIndex::features(moving, (SnapIndex::Axis)axis, features);
+
+        int best = reach + 1;
+        ShapeId &target = targets[axis];
+        target = INVALID_SHAPE_ID;
+        if (snap_to_shapes) {
+            for (int feature : features) {
+                SnapIndex::Entry entry;
+                if (!snap_index.nearest((SnapIndex::Axis)axis, feature, reach, SNAP_PROBES, in_view, entry)) continue;
+                if (std::abs(entry.value - feature) < std::abs(best)) {
+                    best = entry.value - feature;
+                    target = entry.id;
+                    positions[axis] = entry.value;
+                }
+            }
+        }
+        if (snap_to_grid) {
+            for (int feature : features) {
+                int line = floor_div(feature + grid_size / 2, grid_size) * grid_size;
+                if (std::abs(line - feature) < std::abs(best)) {
+                    best = line - feature;
+                    target = INVALID_SHAPE_ID;
+                }
+            }
+        }
+        if (std::abs(best) > reach) best = 0;
+        offset[axis] = best;
+    }
+
+    // Guides run along the snapped line across both the selection and the
+    // shape it lines up with
+    SDL_Rect snapped = {moving.x + offset[0], moving.y + offset[1], moving.w, moving.h};
+    for (int axis = SnapIndex::AXIS_X; axis <= SnapIndex::AXIS_Y; ++axis) {
+        SnapGuide guide = {};
+        if (targets[axis] != INVALID_SHAPE_ID) {
+            SDL_Rect other = scene.rect(scene.index_of(targets[axis]));
+            bool vertical = axis == SnapIndex::AXIS_X;
+            int a0 = vertical ? snapped.y : snapped.x, a1 = a0 + (vertical ? snapped.h : snapped.w);
+            int b0 = vertical ? other.y : other.x, b1 = b0 + (vertical ? other.h : other.w);
+            guide = {true, positions[axis], std::min(a0, b0), std::max(a1, b1)};
+        }
+        set_guide(axis, guide);
+    }
+    return {offset[0], offset[1]};
+}
+
+SDL_Rect Canvas::guide_rect(int axis) const
+{
+    const SnapGuide &guide = guides[axis];
+    if (axis == SnapIndex::AXIS_X) return {guide.position, guide.from, 1, guide.to - guide.from};
+    return {guide.from, guide.position, guide.to - guide.from, 1};
+}
+
+// Repaints where a guide was and is when it changes
+void Canvas::set_guide(int axis, SnapGuide guide)
+{
+    SnapGuide &current = guides[axis];
+    if (guide.active == current.active && (!guide.active ||
+        (guide.position == current.position && guide.from == current.from && guide.to == current.to))) return;
+
+    if (current.active) mark_world_dirty(guide_rect(axis), 1);
+    current = guide;
+    if (current.active) mark_world_dirty(guide_rect(axis), 1);
+}
+
+void Canvas::clear_guides()
+{
+    set_guide(SnapIndex::AXIS_X, {});
+    set_guide(SnapIndex::AXIS_Y, {});
 }
 
 void Canvas::handle_key_down(const char *key)
 {
-    // Key handling logic can be expanded here.
-    // This is now intended for non-UI keys that should be handled by the canvas engine.
-    // Example: std::string key_str(key); if (key_str == "Delete") { ... }
+    handle_key(key_code_from_name(key), 0);
+}
+
+void Canvas::handle_key(int key_code, int modifiers)
+{
+    trace.record(TRACE_KEY, key_code, modifiers);
+    trace.set_muted(true); // Replaying the key makes its edits again
+
+    // Non-UI keys handled by the canvas engine; Cmd works like Ctrl on macOS
+    bool command = (modifiers & (KEY_MOD_CTRL | KEY_MOD_META)) != 0;
+
+    if (command && (key_code == 'z' || key_code == 'Z')) {
+        if (modifiers & KEY_MOD_SHIFT) {
+            redo();
+        } else {
+            undo();
+        }
+    } else if (command && (key_code == 'y' || key_code == 'Y')) {
+        redo();
+    } else if (command && (key_code == ']' || key_code == '}')) {
+        // Shift gives '}' on most layouts
+        bool all_the_way = (modifiers & KEY_MOD_SHIFT) || key_code == '}';
+        restack_selection(all_the_way ? STACK_TO_FRONT : STACK_FORWARD);
+    } else if (command && (key_code == '[' || key_code == '{')) {
+        bool all_the_way = (modifiers & KEY_MOD_SHIFT) || key_code == '{';
+        restack_selection(all_the_way ? STACK_TO_BACK : STACK_BACKWARD);
+    } else if (key_code == KEY_DELETE || key_code == KEY_BACKSPACE) {
+        delete_selection();
+    } else if (key_code == KEY_ESCAPE) {
+        clear_selection();
+    } else if (key_code >= KEY_ARROW_LEFT && key_code <= KEY_ARROW_DOWN) {
+        // Nudge the selection by a world unit, or ten with Shift
+        int step = (modifiers & KEY_MOD_SHIFT) ? 10 : 1;
+        int dx = key_code == KEY_ARROW_LEFT ? -step : key_code == KEY_ARROW_RIGHT ? step : 0;
+        int dy = key_code == KEY_ARROW_UP ? -step : key_code == KEY_ARROW_DOWN ? step : 0;
+        move_selection(dx, dy);
+    }
+    trace.set_muted(false);
+}
+
+void Canvas::start_trace()
+{
+    drain_input(); // Queued input belongs before the snapshot
+
+    InputTraceHeader header = {};
+    header.width = canvas_width;
+    header.height = canvas_height;
+    header.backend = (Uint32)backend;
+    header.zoom = zoom_level;
+    header.pan_x = pan_offset.x;
+    header.pan_y = pan_offset.y;
+    header.grid_size = grid_size;
+    header.grid_color = grid_color;
+    header.background_color = background_color;
+    header.show_grid = show_grid;
+    header.snap_to_grid = snap_to_grid;
+    header.snap_to_shapes = snap_to_shapes;
+
+    // A file of its own, so scene_file keeps the layout for incremental saves
+    SceneFile snapshot;
+    std::vector<Uint8> document;
+    snapshot.save(scene, document);
+    trace.start(header, document, selection.data(), selection.size());
+}
+
+size_t Canvas::stop_trace()
+{
+    drain_input();
+    return trace.stop(SceneFile::checksum(scene));
+}
+
+bool Canvas::begin_replay(const InputTraceReader &reader)
+{
+    const InputTraceHeader &header = reader.header();
+    Scene loaded;
+    SceneFile file;
+    if (!file.load(loaded, reader.scene(), header.scene_bytes)) return false;
+    replace_scene(loaded);
+
+    resize(header.width, header.height);
+    set_grid_settings(header.show_grid != 0, header.grid_size, header.grid_color.r, header.grid_color.g,
+                      header.grid_color.b, header.grid_color.a);
+    setBackgroundColor(header.background_color.r, header.background_color.g, header.background_color.b,
+                       header.background_color.a);
+    set_snapping(header.snap_to_grid != 0, header.snap_to_shapes != 0);
+    zoom_level = header.zoom;
+    pan_offset = {header.pan_x, header.pan_y};
+    for (Uint32 i = 0; i < header.selection_count; ++i) select_shape(reader.selected((int)i));
+
+    is_panning = false;
+    tile_cache.invalidate_all();
+    mark_all_dirty();
+    return true;
+}
+
+void Canvas::replay(const TraceEvent &event)
+{
+    const int *a = event.args;
+    switch (event.op) {
+        case TRACE_RENDER:
+            render();
+            break;
+        case TRACE_MOUSE_DOWN:
+            handle_mouse_down(a[0], a[1], a[2]);
+            break;
+        case TRACE_MOUSE_MOVE:
+            handle_mouse_move(a[0], a[1]);
+            break;
+        case TRACE_MOUSE_UP:
+            handle_mouse_up(a[0], a[1], a[2]);
+            break;
+        case TRACE_KEY:
+            handle_key(a[0], a[1]);
+            break;
+        case TRACE_ZOOM: {
+            float zoom_factor;
+            std::memcpy(&zoom_factor, &a[0], sizeof(zoom_factor));
+            zoom_at_point(zoom_factor, a[1], a[2]);
+            break;
+        }
+        case TRACE_RESIZE:
+            resize(a[0], a[1]);
+            break;
+        case TRACE_GRID:
+            set_grid_settings(a[0] != 0, a[1]);
+            break;
+        case TRACE_GRID_COLOR:
+            set_grid_settings(a[0] != 0, a[1], a[2], a[3], a[4], a[5]);
+            break;
+        case TRACE_BACKGROUND:
+            setBackgroundColor(a[0], a[1], a[2], a[3]);
+            break;
+        case TRACE_SNAPPING:
+            set_snapping(a[0] != 0, a[1] != 0);
+            break;
+        case TRACE_UNDO:
+            undo();
+            break;
+        case TRACE_REDO:
+            redo();
+            break;
+        case TRACE_RECOLOR:
+            set_selection_color({(Uint8)a[0], (Uint8)a[1], (Uint8)a[2], (Uint8)a[3]});
+            break;
+        case TRACE_DELETE_SELECTION:
+            delete_selection();
+            break;
+        case TRACE_RESTACK:
+            restack_selection((StackOp)a[0]);
+            break;
+        default:
+            break;
+    }
+}
+
+// Applies everything JS queued since the last frame. A run of moves collapses
+// into its last sample, since drag and pan only depend on where the run ends,
+// and repeated zooms around the same point collapse the same way.
+void Canvas::drain_input()
+{
+    const Uint32 mask = InputQueue::CAPACITY - 1;
+    Uint32 end = input_queue.write_index;
+    Uint32 i = input_queue.read_index;
+    main_context.stats[STAT_INPUT_EVENTS] += end - i;
+
+    while (i != end) {
+        InputEvent event = input_queue.events[i & mask];
+        ++i;
+
+        switch (event.type) {
+        case INPUT_MOUSE_DOWN:
+            handle_mouse_down(event.x, event.y, event.value);
+            break;
+        case INPUT_MOUSE_MOVE:
+            while (i != end && input_queue.events[i & mask].type == INPUT_MOUSE_MOVE) {
+                event = input_queue.events[i & mask];
+                ++i;
+            }
+            handle_mouse_move(event.x, event.y);
+            break;
+        case INPUT_MOUSE_UP:
+            handle_mouse_up(event.x, event.y, event.value);
+            break;
+        case INPUT_KEY_DOWN:
+            handle_key(event.x, event.y);
+            break;
+        case INPUT_ZOOM:
+            while (i != end) {
+                const InputEvent &next = input_queue.events[i & mask];
+                if (next.type != INPUT_ZOOM || next.x != event.x || next.y != event.y) break;
+                event = next;
+                ++i;
+            }
+            float zoom_factor;
+            std::memcpy(&zoom_factor, &event.value, sizeof(zoom_factor));
+            zoom_at_point(zoom_factor, event.x, event.y);
+            break;
+        default:
+            break;
+        }
+    }
+
+    input_queue.read_index = end;
 }
@@ -0,0 +1,105 @@
+#include "ellipse_cache.h"
+
+#include <cmath>
+
+const int EllipseCache::LEVELS;
+const int EllipseCache::CACHE_SIDE;
+const size_t EllipseCache::CACHE_RUNS;
+
+// Area of the unit disk inside [0, u] x [0, v], signed by the quadrant of
+// (u, v) so that the area inside any rect is an inclusion-exclusion of four
+// corners
+static double disk_corner_area(double u, double v)
+{
+    double sign = (u < 0) != (v < 0) ? -1.0 : 1.0;
+    u = std::min(std::fabs(u), 1.0);
+    v = std::min(std::fabs(v), 1.0);
+    if (u * u + v * v <= 1.0) return sign * u * v;
+
+    // Full height up to where the circle drops below v, then the area under
+    // the arc: the integral of sqrt(1 - t^2) is (t sqrt(1 - t^2) + asin t) / 2
+    double cross = std::sqrt(1.0 - v * v);
+    auto arc = [](double t) { return 0.5 * (t * std::sqrt(std::max(0.0, 1.0 - t * t)) + std::asin(t)); };
+    return sign * (cross * v + arc(u) - arc(cross));
+}
+
+void EllipseCache::row_runs(int w, int h, int row, int first, int last, std::vector<Run> &out)
+{
+    // Box [0, w] x [0, h] in pixels, ellipse centered with semi-axes a and b
+    double a = w * 0.5, b = h * 0.5;
+    int half_cols = (w + 1) / 2;
+
+    // Half widths at the row's top edge and at its edge nearest the middle
+    auto half_width = [&](double y) {
+        double t = (y - b) / b;
+        return a * std::sqrt(std::max(0.0, 1.0 - t * t));
+    };
+    double narrow = half_width(row);
+    double wide = half_width(std::min(row + 1.0, b));
+
+    // Columns left of edge_start are empty and from full_start on wholly
+    // inside; the ones between are integrated
+    int edge_start = std::max(0, (int)std::floor(a - wide));
+    int full_start = std::min(half_cols, std::max(edge_start, (int)std::ceil(a - narrow)));
+    int from = std::max(edge_start, first);
+    int to = std::min(full_start, last);
+
+    double v0 = (row - b) / b, v1 = (row + 1 - b) / b;
+    double scale = a * b; // Unit disk area to pixels
+    auto column_area = [&](int x) {
+        double u = (x - a) / a;
+        return disk_corner_area(u, v1) - disk_corner_area(u, v0);
+    };
+
+    auto append = [&](int x, int level) {
+        if (level == 0) return;
+        if (!out.empty() && out.back().level == level && out.back().x + out.back().w == x) {
+            ++out.back().w;
+        } else {
+            out.push_back({x, 1, level});
+        }
+    };
+
+    double left = column_area(from);
+    for (int x = from; x < to; ++x) {
+        double right = column_area(x + 1);
+        double coverage = (right - left) * scale;
+        left = right;
+        append(x, std::min(LEVELS, std::max(0, (int)std::lround(coverage * LEVELS))));
+    }
+
+    int full_from = std::max(full_start, first);
+    int full_to = std::min(half_cols, last);
+    if (full_from >= full_to) return;
+    if (!out.empty() && out.back().level == LEVELS && out.back().x + out.back().w == full_from) {
+        out.back().w += full_to - full_from;
+    } else {
+        out.push_back({full_from, full_to - full_from, LEVELS});
+    }
+}
+
+const EllipseCache::Shape &EllipseCache::cached(int w, int h)
+{
+    Uint64 key = ((Uint64)(Uint32)w << 32) | (Uint32)h;
+    auto found = shapes.find(key);
+    if (found != shapes.end()) return found->second;
+
+    if (cached_runs > CACHE_RUNS) clear();
+
+    Shape &shape = shapes[key];
+    int half_rows = (h + 1) / 2;
+    shape.rows.reserve(half_rows + 1);
+    for (int row = 0; row < half_rows; ++row) {
+        shape.rows.push_back((int)shape.runs.size());
+        row_runs(w, h, row, 0, (w + 1) / 2, shape.runs);
+    }
+    shape.rows.push_back((int)shape.runs.size());
+    cached_runs += shape.runs.size();
+    return shape;
+}
+
+void EllipseCache::clear()
+{
+    shapes.clear();
+    cached_runs = 0;
+}
@@ -0,0 +1,521 @@
+#include "export.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "tile_cache.h"
+
+const int ExportJob::BAND_BYTES;
+const int ExportJob::SVG_BATCH;
+const int ExportJob::MAX_SIDE;
+
+namespace {
+
+struct CrcTable {
+    Uint32 value[256];
+
+    CrcTable() {
+        for (Uint32 n = 0; n < 256; ++n) {
+            Uint32 c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            value[n] = c;
+        }
+    }
+};
+
+Uint32 crc32(Uint32 crc, const Uint8 *data, size_t size)
+{
+    static const CrcTable table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table.value[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Fixed Huffman codes of RFC 1951 3.2.6, bit-reversed for an LSB-first writer
+struct FixedCodes {
+    Uint16 code[288];
+    Uint8 bits[288];
+    Uint16 length_symbol[259];
+    Uint8 length_extra_bits[259];
+    Uint16 length_extra[259];
+
+    FixedCodes() {
+        for (int symbol = 0; symbol < 288; ++symbol) {
+            int value, count;
+            if (symbol < 144) { value = 0x30 + symbol; count = 8; }
+            else if (symbol < 256) { value = 0x190 + symbol - 144; count = 9; }
+            else if (symbol < 280) { value = symbol - 256; count = 7; }
+            else { value = 0xC0 + symbol - 280; count = 8; }
+
+            int reversed = 0;
+            for (int i = 0; i < count; ++i) reversed |= ((value >> i) & 1) << (count - 1 - i);
+            code[symbol] = (Uint16)reversed;
+            bits[symbol] = (Uint8)count;
+        }
+
+        static const int base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        for (int length = 3; length <= 258; ++length) {
+            // 258 has its own symbol; 284 stops at 257
+            int k = length == 258 ? 28 : 27;
+            while (base[k] > length) --k;
+            length_symbol[length] = (Uint16)(257 + k);
+            length_extra_bits[length] = (Uint8)extra[k];
+            length_extra[length] = (Uint16)(length - base[k]);
+        }
+    }
+};
+
+const FixedCodes &fixed_codes()
+{
+    static const FixedCodes codes;
+    return codes;
+}
+
+void append(std::vector<Uint8> &out, const void *data, size_t size)
+{
+    const Uint8 *bytes = (const Uint8 *)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+void append(std::vector<Uint8> &out, const char *text)
+{
+    append(out, text, std::strlen(text));
+}
+
+void append_u32(std::vector<Uint8> &out, Uint32 v)
+{
+    Uint8 bytes[4] = {(Uint8)(v >> 24), (Uint8)(v >> 16), (Uint8)(v >> 8), (Uint8)v};
+    append(out, bytes, 4);
+}
+
+void append_int(std::vector<Uint8> &out, long long v)
+{
+    char digits[24];
+    int n = 0;
+    unsigned long long magnitude = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (v < 0) out.push_back('-');
+    while (n > 0) out.push_back((Uint8)digits[--n]);
+}
+
+// half_units / 2, with ".5" when odd
+void append_half(std::vector<Uint8> &out, long long half_units)
+{
+    if (half_units < 0 && half_units % 2 != 0) {
+        out.push_back('-');
+        half_units = -half_units;
+    }
+    append_int(out, half_units / 2);
+    if (half_units % 2 != 0) append(out, ".5");
+}
+
+void append_fill(std::vector<Uint8> &out, SDL_Color color)
+{
+    static const char hex[] = "0123456789abcdef";
+    char text[] = " fill=\"#000000\"";
+    Uint8 channels[3] = {color.r, color.g, color.b};
+    for (int i = 0; i < 3; ++i) {
+        text[8 + i * 2] = hex[channels[i] >> 4];
+        text[9 + i * 2] = hex[channels[i] & 15];
+    }
+    append(out, text);
+
+    if (color.a != 255) {
+        // Three decimals are enough to get the same alpha back
+        int thousandths = (color.a * 1000 + 127) / 255;
+        char opacity[32] = " fill-opacity=\"0.000\"";
+        opacity[17] = (char)('0' + thousandths / 100);
+        opacity[18] = (char)('0' + thousandths / 10 % 10);
+        opacity[19] = (char)('0' + thousandths % 10);
+        append(out, opacity);
+    }
+}
+
+void write_chunk(std::vector<Uint8> &out, const char *type, const Uint8 *data, size_t size)
+{
+    append_u32(out, (Uint32)size);
+    size_t start = out.size();
+    append(out, type, 4);
+    append(out, data, size);
+    append_u32(out, crc32(0, out.data() + start, out.size() - start));
+}
+
+} // namespace
+
+void PngEncoder::begin(int image_width, int image_height, std::vector<Uint8> &out)
+{
+    width = image_width;
+    row.assign((size_t)width * 4, 0);
+    previous.assign((size_t)width * 4, 0);
+    filtered.assign((size_t)width * 4 + 1, 0);
+    compressed.clear();
+    bit_buffer = 0;
+    bit_count = 0;
+    adler_a = 1;
+    adler_b = 0;
+    last_byte = -1;
+
+    static const Uint8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    append(out, signature, 8);
+
+    Uint8 header[13] = {
+        (Uint8)(image_width >> 24), (Uint8)(image_width >> 16), (Uint8)(image_width >> 8), (Uint8)image_width,
+        (Uint8)(image_height >> 24), (Uint8)(image_height >> 16), (Uint8)(image_height >> 8), (Uint8)image_height,
+        8, 6, 0, 0, 0 // 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+    };
+    write_chunk(out, "IHDR", header, sizeof(header));
+
+    // zlib header, then one final fixed-Huffman block for the whole image
+    put_byte(0x78);
+    put_byte(0x01);
+    put_bits(1, 1);
+    put_bits(1, 2);
+}
+
+void PngEncoder::put_byte(Uint8 value)
+{
+    compressed.push_back(value);
+}
+
+void PngEncoder::put_bits(Uint32 value, int count)
+{
+    bit_buffer |= value << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+        compressed.push_back((Uint8)bit_buffer);
+        bit_buffer >>= 8;
+        bit_count -= 8;
+    }
+}
+
+void PngEncoder::put_literal(int symbol)
+{
+    const FixedCodes &codes = fixed_codes();
+    put_bits(codes.code[symbol], codes.bits[symbol]);
+}
+
+void PngEncoder::put_match(int length)
+{
+    const FixedCodes &codes = fixed_codes();
+    put_literal(codes.length_symbol[length]);
+    if (codes.length_extra_bits[length]) put_bits(codes.length_extra[length], codes.length_extra_bits[length]);
+    put_bits(0, 5); // Distance code 0: one byte back
+}
+
+void PngEncoder::deflate_bytes(const Uint8 *data, size_t size)
+{
+    // Adler-32 with the modulo deferred as long as the sums cannot overflow
+    for (size_t i = 0; i < size;) {
+        size_t block = std::min<size_t>(size - i, 5552);
+        for (size_t end = i + block; i < end; ++i) {
+            adler_a += data[i];
+            adler_b += adler_a;
+        }
+        adler_a %= 65521;
+        adler_b %= 65521;
+    }
+
+    for (size_t i = 0; i < size;) {
+        Uint8 value = data[i];
+        if (value == last_byte) {
+            size_t run = 1;
+            while (run < 258 && i + run < size && data[i + run] == value) ++run;
+            if (run >= 3) {
+                put_match((int)run);
+                i += run;
+                continue;
+            }
+        }
+        put_literal(value);
+        last_byte = value;
+        ++i;
+    }
+}
+
+void PngEncoder::flush_chunk(std::vector<Uint8> &out)
+{
+    if (compressed.empty()) return;
+    write_chunk(out, "IDAT", compressed.data(), compressed.size());
+    compressed.clear();
+}
+
+void PngEncoder::write_rows(const Uint32 *pixels, int stride, int rows, std::vector<Uint8> &out)
+{
+    size_t bytes = (size_t)width * 4;
+
+    for (int y = 0; y < rows; ++y) {
+        const Uint32 *source = pixels + (size_t)y * stride;
+        for (int x = 0; x < width; ++x) {
+            Uint32 p = source[x];
+            row[x * 4 + 0] = (Uint8)(p >> 16);
+            row[x * 4 + 1] = (Uint8)(p >> 8);
+            row[x * 4 + 2] = (Uint8)p;
+            row[x * 4 + 3] = (Uint8)(p >> 24);
+        }
+
+        // Pick the filter with the smaller sum of absolute residuals
+        Uint32 sub_cost = 0, up_cost = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            Uint8 sub = (Uint8)(row[i] - (i >= 4 ? row[i - 4] : 0));
+            Uint8 up = (Uint8)(row[i] - previous[i]);
+            sub_cost += std::abs((int)(Sint8)sub);
+            up_cost += std::abs((int)(Sint8)up);
+        }
+        bool use_up = up_cost < sub_cost;
+        filtered[0] = use_up ? 2 : 1;
+        for (size_t i = 0; i < bytes; ++i) {
+            filtered[i + 1] = use_up ? (Uint8)(row[i] - previous[i]) : (Uint8)(row[i] - (i >= 4 ? row[i - 4] : 0));
+        }
+
+        deflate_bytes(filtered.data(), filtered.size());
+        row.swap(previous);
+    }
+
+    flush_chunk(out);
+}
+
+void PngEncoder::finish(std::vector<Uint8> &out)
+{
+    put_literal(256); // End of block
+    if (bit_count > 0) put_bits(0, 8 - bit_count);
+
+    Uint32 adler = (adler_b << 16) | adler_a;
+    for (int shift = 24; shift >= 0; shift -= 8) put_byte((Uint8)(adler >> shift));
+    flush_chunk(out);
+
+    write_chunk(out, "IEND", nullptr, 0);
+}
+
+void SvgWriter::begin(SDL_Rect world, SDL_Color background, std::vector<Uint8> &out, int width, int height)
+{
+    append(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+    append_int(out, width);
+    append(out, "\" height=\"");
+    append_int(out, height);
+    append(out, "\" viewBox=\"");
+    append_int(out, world.x);
+    out.push_back(' ');
+    append_int(out, world.y);
+    out.push_back(' ');
+    append_int(out, world.w);
+    out.push_back(' ');
+    append_int(out, world.h);
+    append(out, "\">\n");
+
+    if (background.a > 0) write_shape(RECTANGLE, world, background, out);
+}
+
+void SvgWriter::write_shape(Uint8 type, SDL_Rect rect, SDL_Color color, std::vector<Uint8> &out)
+{
+    if (type == CIRCLE) {
+        append(out, "<ellipse cx=\"");
+        append_half(out, 2ll * rect.x + rect.w);
+        append(out, "\" cy=\"");
+        append_half(out, 2ll * rect.y + rect.h);
+        append(out, "\" rx=\"");
+        append_half(out, rect.w);
+        append(out, "\" ry=\"");
+        append_half(out, rect.h);
+    } else {
+        append(out, "<rect x=\"");
+        append_int(out, rect.x);
+        append(out, "\" y=\"");
+        append_int(out, rect.y);
+        append(out, "\" width=\"");
+        append_int(out, rect.w);
+        append(out, "\" height=\"");
+        append_int(out, rect.h);
+    }
+    out.push_back('"');
+    append_fill(out, color);
+    append(out, "/>\n");
+}
+
+void SvgWriter::finish(std::vector<Uint8> &out)
+{
+    append(out, "</svg>\n");
+}
+
+ExportJob::ExportJob(const Scene &scene, const SpatialIndex &index, ExportFormat export_format, SDL_Rect region,
+                     float output_scale, SDL_Color background_color)
+    : format(export_format), world(region), scale(output_scale), background(background_color)
+{
+    world.w = std::max(world.w, 1);
+    world.h = std::max(world.h, 1);
+    if (!(scale > 0.0f) || !std::isfinite(scale)) scale = 1.0f;
+    // Shrink rather than crop when the output would be too large
+    scale = std::min(scale, (float)MAX_SIDE / std::max(world.w, world.h));
+
+    width = std::min(std::max((int)std::ceil(world.w * (double)scale), 1), MAX_SIDE);
+    height = std::min(std::max((int)std::ceil(world.h * (double)scale), 1), MAX_SIDE);
+
+    // Visible shapes overlapping the region, in stacking order. Where the
+    // view would draw a shape from its LOD pyramid, it goes into the job's
+    // instead, including shapes just outside whose cells reach in.
+    if (format == EXPORT_PNG) lod_level = LodPyramid::level_for_zoom(scale);
+    int margin = LodPyramid::FOOTPRINT_MARGIN;
+    SDL_Rect lod_region = {world.x - margin, world.y - margin, world.w + 2 * margin, world.h + 2 * margin};
+    std::vector<std::pair<Uint64, int>> order;
+    for (int i = 0; i < scene.size(); ++i) {
+        if (scene.color[i].a == 0) continue;
+        SDL_Rect r = scene.rect(i);
+        int half = index.node_half((int)scene.ids[i]);
+        if (lod_level && half < LodPyramid::cell_size(lod_level)) {
+            if (SDL_HasIntersection(&r, &lod_region)) lod.add(r, scene.color[i], scene.type[i] == CIRCLE, half, 1);
+        } else if (SDL_HasIntersection(&r, &world)) {
+            order.push_back({scene.z[i], i});
+        }
+    }
+    std::sort(order.begin(), order.end());
+
+    // PNG keeps rects in output pixels, projected once like world_to_screen_rect
+    int origin_x = world_to_content(world.x, scale);
+    int origin_y = world_to_content(world.y, scale);
+    origin = {origin_x, origin_y};
+    rects.reserve(order.size());
+    colors.reserve(order.size());
+    types.reserve(order.size());
+    for (const auto &entry : order) {
+        SDL_Rect r = scene.rect(entry.second);
+        if (format == EXPORT_PNG) {
+            int x0 = world_to_content(r.x, scale) - origin_x;
+            int y0 = world_to_content(r.y, scale) - origin_y;
+            r = {x0, y0, world_to_content(r.x + r.w, scale) - origin_x - x0, world_to_content(r.y + r.h, scale) - origin_y - y0};
+        }
+        rects.push_back(r);
+        colors.push_back(scene.color[entry.second]);
+        types.push_back(scene.type[entry.second]);
+    }
+
+    band_rows = std::max(1, std::min(height, BAND_BYTES / (width * 4)));
+}
+
+float ExportJob::progress() const
+{
+    if (finished) return 1.0f;
+    int total = format == EXPORT_PNG ? height : (int)rects.size();
+    return total > 0 ? (float)next / total : 0.0f;
+}
+
+void ExportJob::render_band(int top, int rows)
+{
+    band.resize(width, rows);
+    raster_fill_rect(band, {0, 0, width, rows}, background);
+
+    // LOD cells as one layer under the shapes, as Canvas::draw_lod draws
+    // them, a few rows at a time to bound the scratch
+    if (lod_level) {
+        int strip = std::max(1, std::min(rows, BAND_BYTES / (width * (int)sizeof(LodPyramid::Sums))));
+        lod_sums.resize((size_t)width * strip);
+        lod_colors.resize((size_t)width * strip);
+        for (int y = 0; y < rows; y += strip) {
+            int n = std::min(strip, rows - y);
+            lod.resolve(lod_level, scale, origin.x, origin.y + top + y, width, n, lod_sums.data(), lod_colors.data());
+            for (int r = 0; r < n; ++r) {
+                const Uint32 *row = lod_colors.data() + (size_t)r * width;
+                for (int x = 0, end; x < width; x = end) {
+                    for (end = x + 1; end < width && row[end] == row[x]; ++end) {}
+                    Uint32 c = row[x];
+                    if (!c) continue;
+                    SDL_Color color = {(Uint8)(c >> 16), (Uint8)(c >> 8), (Uint8)c, (Uint8)(c >> 24)};
+                    raster_blend_rect(band, {x, y + r, end - x, 1}, color);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const SDL_Rect &r = rects[i];
+        if (r.y + r.h <= top || r.y >= top + rows) continue;
+        if (types[i] == CIRCLE) {
+            raster_blend_ellipse(band, {r.x, r.y - top, r.w, r.h}, colors[i], ellipses);
+        } else {
+            raster_blend_rect(band, {r.x, r.y - top, r.w, r.h}, colors[i]);
+        }
+    }
+}
+
+bool ExportJob::step()
+{
+    chunk.clear();
+    if (finished) return false;
+
+    if (format == EXPORT_PNG) {
+        if (!started) png.begin(width, height, chunk);
+        if (next < height) {
+            int rows = std::min(band_rows, height - next);
+            render_band(next, rows);
+            png.write_rows(band.pixels.data(), band.width, rows, chunk);
+            next += rows;
+        }
+        if (next >= height) {
+            png.finish(chunk);
+            band = Framebuffer();
+            lod_sums = std::vector<LodPyramid::Sums>();
+            lod_colors = std::vector<Uint32>();
+            finished = true;
+        }
+    } else {
+        if (!started) svg.begin(world, background, chunk, width, height);
+        int end = std::min((int)rects.size(), next + SVG_BATCH);
+        for (; next < end; ++next) svg.write_shape(types[next], rects[next], colors[next], chunk);
+        if (next >= (int)rects.size()) {
+            svg.finish(chunk);
+            finished = true;
+        }
+    }
+
+    started = true;
+    return true;
+}
+
+ExportWriter::~ExportWriter()
+{
+    wait();
+}
+
+bool ExportWriter::start(std::unique_ptr<ExportJob> next_job, const char *path)
+{
+    wait();
+    FILE *file = std::fopen(path, "wb");
+    if (!file) return false;
+
+    job = std::move(next_job);
+    running = true;
+    ok = false;
+    fraction = 0.0f;
+#if VECTORMATE_HAS_THREADS
+    thread = std::thread(&ExportWriter::run, this, file);
+#else
+    run(file);
+#endif
+    return true;
+}
+
+void ExportWriter::wait()
+{
+#if VECTORMATE_HAS_THREADS
+    if (thread.joinable()) thread.join();
+#endif
+    job.reset();
+}
+
+void ExportWriter::run(FILE *file)
+{
+    bool written = true;
+    while (written && job->step()) {
+        written = std::fwrite(job->chunk.data(), 1, job->chunk.size(), file) == job->chunk.size();
+        fraction = job->progress();
+    }
+    written = std::fclose(file) == 0 && written;
+
+    ok = written;
+    running = false;
+}
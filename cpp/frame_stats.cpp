@@ -0,0 +1,12 @@
+#include "frame_stats.h"
+
+void FrameStats::record(const Uint64 *pending)
+{
+    Uint32 *frame = frames[write_index & (CAPACITY - 1)];
+    for (int stat = 0; stat < FRAME_STAT_COUNT; ++stat) {
+        Uint64 value = frame_stat_is_time(stat) ? pending[stat] / 1000 : pending[stat];
+        frame[stat] = value > 0xFFFFFFFFu ? 0xFFFFFFFFu : (Uint32)value;
+    }
+    frame[STAT_FRAME] = write_index;
+    ++write_index;
+}
@@ -0,0 +1,148 @@
+#include "history.h"
+
+#include <cstring>
+
+History::History(size_t budget_bytes)
+    : budget(budget_bytes)
+{
+}
+
+void History::clear()
+{
+    buffer.clear();
+    head = cursor = end = 0;
+    open = false;
+}
+
+void History::set_budget(size_t budget_bytes)
+{
+    budget = budget_bytes;
+    seal();
+
+    // Drop the oldest entries until the rest fits
+    while (end - head > budget) {
+        head += entry_at(head)->size;
+        if (cursor < head) cursor = head;
+    }
+}
+
+void *History::begin_entry(HistoryOp op, int count, size_t payload_bytes)
+{
+    seal();
+    end = cursor;
+
+    size_t size = (sizeof(HistoryEntry) + payload_bytes + 7) / 8 * 8 + FOOTER;
+    if (size > budget) {
+        clear();
+        return nullptr;
+    }
+
+    while (end - head + size > budget) {
+        head += entry_at(head)->size;
+    }
+
+    // Slide live entries back to the front once the dropped prefix dominates
+    if (head > 0 && head >= buffer.size() / 2) {
+        std::memmove(buffer.data(), buffer.data() + head, end - head);
+        end -= head;
+        head = 0;
+    }
+    if (buffer.size() < end + size) buffer.resize(end + size);
+
+    HistoryEntry *entry = entry_at(end);
+    std::memset(entry, 0, sizeof(HistoryEntry));
+    entry->size = (Uint32)size;
+    entry->op = op;
+    entry->count = count;
+    std::memcpy(buffer.data() + end + size - FOOTER, &entry->size, sizeof(Uint32));
+
+    end += size;
+    cursor = end;
+    open = true;
+    return entry + 1;
+}
+
+HistoryEntry *History::last_entry()
+{
+    if (end == head) return nullptr;
+    Uint32 size;
+    std::memcpy(&size, buffer.data() + end - FOOTER, sizeof(size));
+    return entry_at(end - size);
+}
+
+ShapeId *History::record_move(int count, int dx, int dy)
+{
+    ShapeId *ids = (ShapeId *)begin_entry(HISTORY_MOVE, count, count * sizeof(ShapeId));
+    if (ids) {
+        HistoryEntry *entry = (HistoryEntry *)ids - 1;
+        entry->dx = dx;
+        entry->dy = dy;
+    }
+    return ids;
+}
+
+ColorRecord *History::record_recolor(int count)
+{
+    return (ColorRecord *)begin_entry(HISTORY_RECOLOR, count, count * sizeof(ColorRecord));
+}
+
+ShapeRecord *History::record_insert(int count)
+{
+    return (ShapeRecord *)begin_entry(HISTORY_INSERT, count, count * sizeof(ShapeRecord));
+}
+
+ShapeRecord *History::record_delete(int count)
+{
+    return (ShapeRecord *)begin_entry(HISTORY_DELETE, count, count * sizeof(ShapeRecord));
+}
+
+StackRecord *History::record_restack(int count)
+{
+    return (StackRecord *)begin_entry(HISTORY_RESTACK, count, count * sizeof(StackRecord));
+}
+
+bool History::extend_move(const ShapeId *ids, int count, int dx, int dy)
+{
+    if (!open || cursor != end) return false;
+
+    HistoryEntry *entry = last_entry();
+    if (!entry || entry->op != HISTORY_MOVE || entry->count != count) return false;
+    if (std::memcmp(entry->ids(), ids, count * sizeof(ShapeId)) != 0) return false;
+
+    entry->dx += dx;
+    entry->dy += dy;
+    return true;
+}
+
+void History::seal()
+{
+    if (!open) return;
+    open = false;
+
+    HistoryEntry *entry = last_entry();
+    if (entry && entry->op == HISTORY_MOVE && entry->dx == 0 && entry->dy == 0) {
+        end -= entry->size;
+        cursor = end;
+    }
+}
+
+const HistoryEntry *History::undo()
+{
+    seal();
+    if (cursor == head) return nullptr;
+
+    Uint32 size;
+    std::memcpy(&size, buffer.data() + cursor - FOOTER, sizeof(size));
+    cursor -= size;
+    return entry_at(cursor);
+}
+
+const HistoryEntry *History::redo()
+{
+    seal();
+    if (cursor == end) return nullptr;
+
+    const HistoryEntry *entry = entry_at(cursor);
+    cursor += entry->size;
+    return entry;
+}
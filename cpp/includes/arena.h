@@ -0,0 +1,37 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for short-lived data.
+// Allocations are never freed one by one: reset() drops everything at once
+// and keeps the blocks, so a reader that resets per item stops allocating
+// after warming up. Objects placed here must be trivially destructible.
+class Arena
+{
+public:
+    explicit Arena(size_t block_bytes = 64u << 10);
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    void *allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+    template <typename T>
+    T *allocate_array(size_t count) { return (T *)allocate(count * sizeof(T), alignof(T)); }
+
+    void reset();
+    size_t capacity() const; // Bytes held across all blocks
+
+private:
+    struct Block {
+        std::unique_ptr<Uint8[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0; // Block being filled
+    size_t offset = 0;  // First free byte in it
+    size_t block_bytes;
+};
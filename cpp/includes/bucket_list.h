@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+// Sorted sequence kept in buckets of at most 2 * BUCKET values, none empty.
+// A position is found by a binary search over the first value of every
+// bucket, kept in one contiguous array, then one within the bucket, in
+// O(log n). An insert or erase shifts up to 2 * BUCKET values of one bucket.
+// A bucket that splits or empties also shifts the n / BUCKET bucket heads,
+// which happens at most once per BUCKET inserts into it, so an insert or
+// erase is O(BUCKET + log n) amortized. Less is a stateless strict weak
+// order on T.
+template <typename T, typename Less, size_t BUCKET = 128>
+class BucketList
+{
+public:
+    struct Cursor {
+        size_t bucket, offset;
+    };
+
+    void clear() {
+        buckets.clear();
+        heads.clear();
+        count = 0;
+    }
+
+    // Replaces the contents with values already in order. Buckets come out
+    // half full, so the first inserts into one do not split it.
+    void assign(const T *values, size_t n);
+
+    // After any equal values
+    void insert(const T &value);
+    // Erases one value equal to value; false if there is none
+    bool erase(const T &value);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // First value not less than value, or end
+    Cursor lower_bound(const T &value) const;
+    // First value greater than value, or end
+    Cursor upper_bound(const T &value) const;
+    Cursor begin() const { return {0, 0}; }
+    Cursor end() const { return {buckets.size(), 0}; }
+    bool at_end(Cursor cursor) const { return cursor.bucket >= buckets.size(); }
+
+    const T &operator[](Cursor cursor) const { return buckets[cursor.bucket][cursor.offset]; }
+    // Overwrites the value at cursor with one that sorts in the same place
+    void replace(Cursor cursor, const T &value) {
+        buckets[cursor.bucket][cursor.offset] = value;
+        if (cursor.offset == 0) heads[cursor.bucket] = value;
+    }
+
+    // Step to the next value, reaching end after the last
+    void next(Cursor &cursor) const {
+        if (++cursor.offset >= buckets[cursor.bucket].size()) cursor = {cursor.bucket + 1, 0};
+    }
+    // Step to the previous value; false, leaving cursor alone, at the first
+    bool prev(Cursor &cursor) const {
+        if (cursor.offset > 0) {
+            --cursor.offset;
+        } else if (cursor.bucket > 0) {
+            --cursor.bucket;
+            cursor.offset = buckets[cursor.bucket].size() - 1;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // Bucket for a position found by search in heads; the one before the
+    // first head that fails the search, or the first bucket
+    size_t bucket_before(typename std::vector<T>::const_iterator found) const {
+        return found == heads.begin() ? 0 : (size_t)(found - heads.begin()) - 1;
+    }
+    // Moves a cursor past the end of its bucket to the start of the next
+    Cursor normalized(Cursor cursor) const {
+        if (cursor.bucket < buckets.size() && cursor.offset >= buckets[cursor.bucket].size()) return {cursor.bucket + 1, 0};
+        return cursor;
+    }
+
+    std::vector<std::vector<T>> buckets;
+    std::vector<T> heads; // First value of each bucket
+    size_t count = 0;
+};
+
+template <typename T, typename Less, size_t BUCKET>
+void BucketList<T, Less, BUCKET>::assign(const T *values, size_t n)
+{
+    clear();
+    for (size_t first = 0; first < n; first += BUCKET) {
+        size_t last = std::min(n, first + BUCKET);
+        buckets.emplace_back(values + first, values + last);
+        heads.push_back(values[first]);
+    }
+    count = n;
+}
+
+template <typename T, typename Less, size_t BUCKET>
+void BucketList<T, Less, BUCKET>::insert(const T &value)
+{
+    ++count;
+    if (buckets.empty()) {
+        buckets.emplace_back(1, value);
+        heads.push_back(value);
+        return;
+    }
+
+    size_t index = bucket_before(std::upper_bound(heads.begin(), heads.end(), value, Less()));
+    std::vector<T> &values = buckets[index];
+    values.insert(std::upper_bound(values.begin(), values.end(), value, Less()), value);
+    heads[index] = values.front();
+
+    if (values.size() <= 2 * BUCKET) return;
+
+    // Split in half; the new bucket takes the upper half
+    std::vector<T> upper(values.begin() + BUCKET, values.end());
+    values.resize(BUCKET);
+    heads.insert(heads.begin() + index + 1, upper.front());
+    buckets.insert(buckets.begin() + index + 1, std::move(upper));
+}
+
+template <typename T, typename Less, size_t BUCKET>
+bool BucketList<T, Less, BUCKET>::erase(const T &value)
+{
+    Cursor cursor = lower_bound(value);
+    if (at_end(cursor) || Less()(value, (*this)[cursor])) return false;
+
+    std::vector<T> &values = buckets[cursor.bucket];
+    values.erase(values.begin() + cursor.offset);
+    --count;
+    if (values.empty()) {
+        buckets.erase(buckets.begin() + cursor.bucket);
+        heads.erase(heads.begin() + cursor.bucket);
+    } else {
+        heads[cursor.bucket] = values.front();
+    }
+    return true;
+}
+
+template <typename T, typename Less, size_t BUCKET>
+typename BucketList<T, Less, BUCKET>::Cursor BucketList<T, Less, BUCKET>::lower_bound(const T &value) const
+{
+    if (buckets.empty()) return end();
+    size_t index = bucket_before(std::lower_bound(heads.begin(), heads.end(), value, Less()));
+    const std::vector<T> &values = buckets[index];
+    return normalized({index, (size_t)(std::lower_bound(values.begin(), values.end(), value, Less()) - values.begin())});
+}
+
+template <typename T, typename Less, size_t BUCKET>
+typename BucketList<T, Less, BUCKET>::Cursor BucketList<T, Less, BUCKET>::upper_bound(const T &value) const
+{
+    if (buckets.empty()) return end();
+    size_t index = bucket_before(std::upper_bound(heads.begin(), heads.end(), value, Less()));
+    const std::vector<T> &values = buckets[index];
+    return normalized({index, (size_t)(std::upper_bound(values.begin(), values.end(), value, Less()) - values.begin())});
+}
@@ -1,14 +1,53 @@
 #pragma once
 #include <SDL2/SDL.h>
 #include <vector>
+#include <utility>
 #include "states.h"
 #include "shape.h"
+#include "scene.h"
+#include "spatial_index.h"
+#include "input_queue.h"
+#include "raster.h"
+#include "tile_cache.h"
+#include "thread_pool.h"
+#include "history.h"
+#include "scene_file.h"
+#include "svg_import.h"
+#include "export.h"
+#include "frame_stats.h"
+#include "selection.h"
+#include "arena.h"
+#include "lod_pyramid.h"
+#include "ellipse_cache.h"
+#include "snap_index.h"
+#include "stack_order.h"
+#include "scene_view.h"
+#include "input_trace.h"
+
+enum RenderBackend {
+    RENDER_BACKEND_SDL = 0,       // SDL_Renderer primitives (WebGL under Emscripten)
+    RENDER_BACKEND_SOFTWARE = 1,  // SIMD rasterizer into a CPU framebuffer, one texture upload per frame
+    RENDER_BACKEND_GEOMETRY = 2   // SDL_Renderer, each region's fills, runs and handles as one SDL_RenderGeometry call
+};
+
+enum StackOp {
+    STACK_TO_FRONT = 0,
+    STACK_FORWARD = 1,  // Above the nearest overlapping unselected shape
+    STACK_BACKWARD = 2, // Below the nearest overlapping unselected shape
+    STACK_TO_BACK = 3
+};
 
 class Canvas
 {
 public:
     SDL_Window *window = nullptr;
     SDL_Renderer *renderer = nullptr;
+    SDL_Surface *surface = nullptr; // Offscreen target of the headless native build
+    SDL_Texture *scene_texture = nullptr; // Persistent frame, only damaged regions are repainted
+
+    RenderBackend backend = RENDER_BACKEND_SDL;
+    Framebuffer framebuffer;                    // Software backend: persistent frame in CPU memory
+    SDL_Texture *framebuffer_texture = nullptr; // Software backend: streaming upload target
 
     int canvas_width;
     int canvas_height;
@@ -17,35 +56,310 @@ public:
     int grid_size = 20;
     SDL_Color grid_color = {CanvasStates::grid_color[0], CanvasStates::grid_color[1], CanvasStates::grid_color[2], CanvasStates::grid_color[3]};
 
+    // Drags snap the selection's edges and center to grid lines and to the
+    // edges and centers of other shapes in view, within SNAP_DISTANCE pixels
+    bool snap_to_grid = false;
+    bool snap_to_shapes = true;
+
     SDL_Color background_color = {CanvasStates::bg[0], CanvasStates::bg[1], CanvasStates::bg[2], CanvasStates::bg[3]};
 
+    float zoom_level = 1.0f;
+    SDL_FPoint pan_offset = {0.0f, 0.0f}; // World point at the center of the canvas
+    bool is_panning = false;
     bool is_dragging = false;
+    bool is_selecting = false; // Rubber-band selection in progress
     SDL_Point last_mouse_pos = {0, 0};
+    InputQueue input_queue; // Written by JS through HEAP32, drained at the start of render
+    FrameStats frame_stats; // Timings and counters of recent frames, read by JS
     
-    std::vector<Shape> shapes;
-    int selected_shape_index = -1;
+    Scene scene;
+    SelectionSet selection; // Drags and bulk edits apply to every selected shape
+    SpatialIndex spatial_index; // World-space hit-test index keyed by shape id
+    TileCache tile_cache;       // Rasterized background, grid and fills in content space
+    LodPyramid lod;             // Shapes too small for the index to return when zoomed out
+    SnapIndex snap_index;       // Sorted shape edges and centers that drags snap to
+    StackOrder stack_order;     // Shapes by z, to restack them between any two
+    History history;            // Undo log of shape edits
+    ChangeJournal changes;      // Shapes changed since JS last drained
+    SceneView scene_view;       // Columns and drained changes, read by JS
+    InputTraceRecorder trace;   // Calls recorded for replay, off unless started
+    SceneFile scene_file;       // Layout of the last load or save, for incremental saves
+    std::vector<Uint8> scene_buffer; // Document exchanged with JS
+    std::unique_ptr<ExportJob> export_job; // Export stepped by the caller
+    ExportWriter export_writer;            // Exports to native files
 
-    Canvas(int width = 800, int height = 600);
+    Canvas(int width = 800, int height = 600, RenderBackend backend = RENDER_BACKEND_SDL);
     void cleanup();
 
-    void render();
+    // Edits are recorded in history
+    ShapeId add_shape(const Shape &shape);
+    bool remove_shape(ShapeId id);
+    bool set_shape_color(ShapeId id, SDL_Color color);
+
+    // Selection. select_rect picks every shape overlapping a world rect
+    // through the spatial index. Bulk edits loop over the selected ids and are
+    // one history entry each. All of them cost time in proportion to the
+    // selection, not the document. Each returns the number of shapes affected.
+    int select_rect(SDL_Rect world_rect);
+    void clear_selection();
+    int move_selection(int dx, int dy);
+    int set_selection_color(SDL_Color color);
+    int delete_selection();
+    // Bulk ingest for generated content: count shapes from packed columns,
+    // a rect, a color and a ShapeType byte each, added on top as one history
+    // entry. Storage is reserved once, and past a point the spatial, snap
+    // and stacking indexes and the LOD pyramid are built again in one pass
+    // rather than insert by insert. Returns the id of the first shape, the
+    // others following in order, or INVALID_SHAPE_ID having added nothing
+    // when a type is unknown or a size negative.
+    ShapeId add_shapes(const SDL_Rect *rects, const SDL_Color *colors, const Uint8 *types, int count);
+    // Deletes every shape with an id in [first, first + count) as one
+    // history entry; returns how many there were
+    int remove_shapes(ShapeId first, int count);
+    // Front and back keep the selected shapes' order among themselves;
+    // forward and backward step each one past its neighbour. Only z changes.
+    int restack_selection(StackOp op);
+
+    // Step through history; false when there is nothing to step over
+    bool undo();
+    bool redo();
+
+    // Documents in the SceneFile format. A failed load keeps the current
+    // scene. Saving rewrites only the chunks changed since the last load or
+    // save of the same buffer or file.
+    bool load_scene(const Uint8 *data, size_t size);
+    size_t save_scene(); // Into scene_buffer, returns its size
+    bool load_scene_file(const char *path);
+    bool save_scene_file(const char *path);
+
+    // Adds the rects, circles and ellipses of an SVG document on top of the
+    // scene as one history entry. Returns the number of shapes added.
+    int import_svg(const char *data, size_t size);
+
+    // Exports the world region at scale (output pixels per world unit) as
+    // PNG or SVG. The job takes a copy of the shapes, so editing can go on
+    // while it runs. export_step produces the next piece in export_job->chunk
+    // and returns its size, or -1 once the file is complete. export_file
+    // writes the whole file on a background thread.
+    bool export_begin(ExportFormat format, SDL_Rect world, float scale);
+    int export_step();
+    void export_cancel();
+    bool export_file(ExportFormat format, SDL_Rect world, float scale, const char *path);
+
+    bool render(); // Returns false when nothing was damaged since the last frame
+
+    // Input traces (see input_trace.h). start_trace snapshots the scene,
+    // selection and view, then records input, view settings, undo, redo and
+    // the selection edits; loads, imports, bulk ingest and removal, edits by
+    // id and the history before the start are not recorded. stop_trace ends
+    // the trace in trace.data and returns its size.
+    // begin_replay puts a canvas in the state a trace started from, and
+    // replay makes one recorded call on it.
+    void start_trace();
+    size_t stop_trace();
+    bool begin_replay(const InputTraceReader &reader);
+    void replay(const TraceEvent &event);
+
+    // Fill in scene_view with the current columns; drain_changes also moves
+    // the changes noted since the last drain into it
+    const SceneView &view_scene();
+    const SceneView &drain_changes();
     void resize(int new_width, int new_height);
 
     void setBackgroundColor(int r, int g, int b, int a);
     void set_grid_settings(bool show, int size);
     void set_grid_settings(bool show, int size, int r, int g, int b, int a);
-    void set_zoom(float zoom);  // Stub function for compatibility
-    void zoom_at_point(float zoom_factor, int x, int y);  // Stub function for compatibility
+    void set_snapping(bool to_grid, bool to_shapes);
+    void set_zoom(float zoom);
+    void zoom_at_point(float zoom_factor, int x, int y);
 
     void handle_mouse_down(int x, int y, int button);
     void handle_mouse_move(int x, int y);
     void handle_mouse_up(int x, int y, int button);
     void handle_key_down(const char* key);
+    void handle_key(int key_code, int modifiers);
+    void drain_input();
+
+    void mark_dirty(SDL_Rect screen_rect);
+    void mark_all_dirty();
+
+    // Worker threads for software tile rasterization, 0 for single-threaded.
+    // Returns the count actually started, which is 0 without thread support.
+    int set_raster_threads(int threads);
+    int raster_threads() const { return raster_pool.worker_count(); }
 
 private:
-    void draw_grid(SDL_Renderer *renderer);
-    void draw_selection_handles(SDL_Renderer *renderer, SDL_Rect rect);
+    static const int HANDLE_SIZE = 8;
+    static const int MAX_DAMAGE_RECTS = 8;
+    static const int SNAP_DISTANCE = 6; // Screen pixels
+    static const int SNAP_PROBES = 64;  // Entries a snap query may skip per feature
+
+    // Screen regions to repaint on the next render
+    bool full_damage = true;
+    std::vector<SDL_Rect> damage_rects;
+
+    // Visible fills of one color, submitted with a single SDL_RenderFillRects.
+    // Its rects are count entries from first in the region's rect array.
+    struct ColorBatch {
+        SDL_Color color;
+        SDL_Rect bounds;
+        int first;
+        int count;
+    };
+
+    // A shape in a region, in stacking order once sorted
+    struct DrawItem {
+        Uint64 z;
+        int index;     // Dense scene index
+    };
+
+    // One rect of a visible fill: a whole rectangle or a run of an ellipse
+    struct Fill {
+        SDL_Rect rect; // On screen, relative to the region origin
+        SDL_Color color;
+        int batch;
+    };
+
+    // Target and scratch for drawing. pixels is the framebuffer the software
+    // rasterizer writes to, or null to draw through the SDL renderer. Scratch
+    // comes from arena, which each draw_region call resets, so drawing stops
+    // allocating once the arena has grown to the busiest region; each raster
+    // worker has its own context so tiles can be drawn concurrently.
+    struct DrawContext {
+        Framebuffer *pixels = nullptr;
+        std::vector<int> visible_shapes;    // Capacity kept across regions
+        std::vector<Fill> fills;            // Likewise
+        std::vector<SDL_Vertex> vertices;   // Geometry backend: quads queued for one draw, likewise
+        std::vector<int> indices;
+        EllipseCache ellipses;              // Per context, so threads share nothing
+        Arena arena;
+        ColorBatch *batches = nullptr;      // In arena
+        int batch_count = 0;
+        Uint64 stats[FRAME_STAT_COUNT] = {}; // FrameStat totals until recorded, times in nanoseconds
+    };
+    DrawContext main_context;
+    std::vector<DrawContext> worker_contexts; // One per thread pool slot
+    ThreadPool raster_pool;
+
+    // Storage that lives for one render() call, reset as it starts
+    Arena frame_arena;
+    Tile **frame_tiles = nullptr; // Tiles under this frame's damage
+    int frame_tile_count = 0;
+    Tile **dirty_tiles = nullptr; // Of those, the ones to rasterize
+    int dirty_tile_count = 0;
+
+    // Background with the grid composited on top, rendered once for the
+    // current zoom, grid settings and canvas size plus a margin. Panning only
+    // shifts the copy source; the layer is rebuilt when one of its inputs
+    // changes or the view moves past the margin.
+    static const int GRID_LAYER_MARGIN = 256;
+    struct GridLayer {
+        SDL_Texture *texture = nullptr; // SDL backend
+        Framebuffer pixels;             // Software backend
+        bool valid = false;
+        SDL_Point origin = {0, 0};      // Pan in screen pixels when the layer was built
+        int width = 0;
+        int height = 0;
+        int grid_size = 0;
+        float zoom = 0.0f;
+        SDL_Color grid_color = {0, 0, 0, 0};
+        SDL_Color background_color = {0, 0, 0, 0};
+    };
+    GridLayer grid_layer;
+
+#ifndef __EMSCRIPTEN__
+    bool create_offscreen_renderer();
+#endif
+    void prepare_frame();
+    void render_sdl(bool from_tiles);
+    void render_software(bool from_tiles);
+    void present();
+    bool prepare_tiles();
+    bool render_tile(DrawContext &ctx, Tile &tile, SDL_Point pan_px);
+    void repaint_damage(bool from_tiles);
+    void record_frame_stats();
+
+    // Drawing primitives, dispatched to SDL_Renderer or the rasterizer
+    void set_clip(DrawContext &ctx, const SDL_Rect *clip);
+    void fill_rect(DrawContext &ctx, SDL_Rect rect, SDL_Color color);
+    void blend_rects(DrawContext &ctx, const SDL_Rect *rects, int count, SDL_Color color);
+    void blend_line(DrawContext &ctx, int x1, int y1, int x2, int y2, SDL_Color color);
+    bool queues_geometry(const DrawContext &ctx) const { return !ctx.pixels && backend == RENDER_BACKEND_GEOMETRY; }
+    void queue_rect(DrawContext &ctx, SDL_Rect rect, SDL_Color color);
+    void flush_geometry(DrawContext &ctx);
+
+    SDL_Point pan_pixels() const;
+    bool grid_visible() const;
+    void update_grid_layer();
+    void draw_background(DrawContext &ctx, SDL_Rect region, SDL_Point origin);
+    void draw_grid(DrawContext &ctx, SDL_Rect area, SDL_Point origin);
+    void draw_selection(DrawContext &ctx, SDL_Rect region);
+    void draw_selection_handles(DrawContext &ctx, SDL_Rect rect);
+    void draw_marquee(DrawContext &ctx, SDL_Rect region);
     void on_drag_start(int x, int y);
     void on_drag_update(int dx, int dy);
     void on_drag_end();
+    void begin_drag();
+    SDL_Point snap_offset(SDL_Rect moving);
+    void pan(int dx, int dy);
+    void mark_shape_dirty(ShapeId id);
+    void mark_world_dirty(SDL_Rect world_rect, int margin);
+    void invalidate_shape(ShapeId id);
+    SDL_Rect tile_footprint(int index) const;
+    void update_lod(int index, int sign);
+    void draw_lod(DrawContext &ctx, SDL_Rect region, SDL_Point origin, int level);
+
+    // Scene edits shared by the public API and history replay; none record
+    ShapeRecord shape_record(int index) const;
+    void place_shape(const ShapeRecord &record);
+    void erase_shape(ShapeId id);
+    void erase_shapes(const ShapeId *ids, int count);
+    template <typename ShapeAt>
+    ShapeId insert_shapes(int count, ShapeAt shape_at);
+    void move_shapes(const ShapeId *ids, int count, int dx, int dy);
+    void recolor_shape(ShapeId id, SDL_Color color);
+    void set_shape_z(int index, Uint64 z);
+    void apply_relabels(std::vector<StackRecord> *records);
+    void apply_history(const HistoryEntry &entry, bool revert);
+    void replace_scene(Scene &loaded);
+    std::vector<int> move_indices;     // Scratch for move_shapes
+    std::vector<SDL_Rect> edit_rects;  // World rects of a bulk edit, invalidated in one pass
+
+    // World bounds of the selection, refreshed before the next frame once
+    // selected shapes move or the selection changes
+    SDL_Rect selection_box = {0, 0, 0, 0};
+    bool selection_box_stale = false;
+    // A drag moves the selection by the pointer's travel since it started
+    // plus the snap correction, so snapping never accumulates into drift
+    SDL_Rect drag_box = {0, 0, 0, 0};   // Selection bounds as the drag started
+    SDL_Point drag_travel = {0, 0};     // Pointer travel in world units
+    SDL_Point drag_applied = {0, 0};    // Offset the selection has been moved by
+
+    // Alignment line shown while a drag is snapped to another shape: at
+    // position on its axis (x for AXIS_X), spanning [from, to] on the other
+    // axis, all in world units
+    struct SnapGuide {
+        bool active;
+        int position;
+        int from, to;
+    };
+    SnapGuide guides[2] = {};
+    SDL_Rect guide_rect(int axis) const;
+    void set_guide(int axis, SnapGuide guide);
+    void clear_guides();
+    void draw_guides(DrawContext &ctx, SDL_Rect region);
+
+    SDL_Point marquee_anchor = {0, 0}; // World corners of the rubber band
+    SDL_Point marquee_point = {0, 0};
+    std::vector<int> selection_query;  // Scratch for select_rect
+    std::vector<ShapeId> bulk_ids;     // Scratch for bulk deletes
+    std::vector<StackOrder::Entry> restack_order;  // Scratch for restack_selection
+    std::vector<StackRecord> restack_records;      // Likewise
+    void select_shape(ShapeId id);
+    void update_selection_box();
+    void update_marquee(SDL_Point world_point);
+    SDL_Rect marquee_rect() const;
+    void draw_region(DrawContext &ctx, SDL_Rect region, SDL_Point origin);
+    int add_to_batch(DrawContext &ctx, SDL_Rect rect, SDL_Color color);
+    void rebuild_spatial_index();
 };
@@ -0,0 +1,126 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Anti-aliased ellipses as horizontal runs of pixels of equal coverage.
+// The ellipse is the one inscribed in a box of whole pixels. Each pixel's
+// coverage is the exact area of the ellipse inside it, from the closed form
+// of the area of a disk clipped to a rect, quantized to LEVELS steps so
+// neighbouring pixels merge into runs. Pixels wholly inside or outside are
+// found per row from the ellipse's width at the row's edges, so only the
+// boundary is integrated. Both backends fill the runs as plain rects at an
+// alpha scaled by their level, so they stay pixel for pixel identical.
+//
+// Coverage depends only on the box size, so the runs of every size seen are
+// kept: a size on screen is a radius at a zoom. One quadrant is stored and
+// mirrored. Boxes with a side over CACHE_SIDE are recomputed row by row for
+// the visible rows and columns only, since few of them fit on screen.
+class EllipseCache
+{
+public:
+    static const int LEVELS = 16;
+    static const int CACHE_SIDE = 1024;
+    static const size_t CACHE_RUNS = 1 << 18; // Everything is dropped past this
+
+    // Pixels [x, x + w) of a row of the box's left half, x from the box's left
+    // edge. A run that reaches the middle column stands for itself and its
+    // mirror joined into one.
+    struct Run {
+        int x, w;
+        int level; // Coverage in 1..LEVELS
+    };
+
+    // Calls emit(SDL_Rect, int level) with the runs of the ellipse inscribed
+    // in box that overlap clip, clipped to it
+    template <typename Emit>
+    void for_each_run(SDL_Rect box, SDL_Rect clip, Emit &&emit);
+
+    void clear();
+    size_t size() const { return shapes.size(); }
+
+    // Alpha of a run of the given level filled with color
+    static Uint8 run_alpha(SDL_Color color, int level) {
+        return (Uint8)((color.a * level + LEVELS / 2) / LEVELS);
+    }
+
+private:
+    // Runs of the top half rows, rows[i] to rows[i + 1] for row i
+    struct Shape {
+        std::vector<int> rows;
+        std::vector<Run> runs;
+    };
+
+    const Shape &cached(int w, int h);
+    // Appends the runs of one row of the top half, computing coverage only
+    // for columns [first, last) of the left half
+    static void row_runs(int w, int h, int row, int first, int last, std::vector<Run> &out);
+
+    std::unordered_map<Uint64, Shape> shapes; // Keyed by w << 32 | h
+    size_t cached_runs = 0;
+    std::vector<Run> scratch;                 // Rows of uncached boxes
+};
+
+template <typename Emit>
+void EllipseCache::for_each_run(SDL_Rect box, SDL_Rect clip, Emit &&emit)
+{
+    if (box.w <= 0 || box.h <= 0) return;
+
+    int y0 = std::max(box.y, clip.y), y1 = std::min(box.y + box.h, clip.y + clip.h);
+    int x0 = std::max(box.x, clip.x), x1 = std::min(box.x + box.w, clip.x + clip.w);
+    if (y0 >= y1 || x0 >= x1) return;
+
+    bool inside = x0 == box.x && x1 == box.x + box.w;
+    auto emit_row = [&](const Run *runs, int count, int y) {
+        if (inside) {
+            for (int i = 0; i < count; ++i) {
+                const Run &run = runs[i];
+                if (run.x + run.w >= (box.w + 1) / 2) {
+                    emit(SDL_Rect{box.x + run.x, y, box.w - 2 * run.x, 1}, run.level);
+                } else {
+                    emit(SDL_Rect{box.x + run.x, y, run.w, 1}, run.level);
+                    emit(SDL_Rect{box.x + box.w - run.x - run.w, y, run.w, 1}, run.level);
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            const Run &run = runs[i];
+            // Left run, then its mirror; the middle one is both at once
+            bool middle = run.x + run.w >= (box.w + 1) / 2;
+            int left = box.x + run.x;
+            int right = middle ? box.x + box.w - run.x : left + run.w;
+            int a = std::max(left, x0), b = std::min(right, x1);
+            if (a < b) emit(SDL_Rect{a, y, b - a, 1}, run.level);
+            if (middle) continue;
+
+            a = std::max(box.x + box.w - run.x - run.w, x0);
+            b = std::min(box.x + box.w - run.x, x1);
+            if (a < b) emit(SDL_Rect{a, y, b - a, 1}, run.level);
+        }
+    };
+
+    int half_rows = (box.h + 1) / 2;
+    if (box.w <= CACHE_SIDE && box.h <= CACHE_SIDE) {
+        const Shape &shape = cached(box.w, box.h);
+        for (int y = y0; y < y1; ++y) {
+            int row = y - box.y;
+            if (row >= half_rows) row = box.h - 1 - row;
+            emit_row(shape.runs.data() + shape.rows[row], shape.rows[row + 1] - shape.rows[row], y);
+        }
+        return;
+    }
+
+    // Left-half columns under the clip, directly or through the mirror
+    int half_cols = (box.w + 1) / 2;
+    int first = std::min(x0 - box.x, box.x + box.w - x1);
+    int last = std::min(half_cols, std::max(x1 - box.x, box.x + box.w - x0));
+    for (int y = y0; y < y1; ++y) {
+        int row = y - box.y;
+        if (row >= half_rows) row = box.h - 1 - row;
+        scratch.clear();
+        row_runs(box.w, box.h, row, std::max(first, 0), last, scratch);
+        emit_row(scratch.data(), (int)scratch.size(), y);
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "ellipse_cache.h"
+#include "lod_pyramid.h"
+#include "raster.h"
+#include "scene.h"
+#include "spatial_index.h"
+#include "thread_pool.h"
+
+enum ExportFormat {
+    EXPORT_PNG = 0,
+    EXPORT_SVG = 1
+};
+
+// Streaming PNG encoder (8-bit RGBA).
+// Rows are filtered (Sub or Up, whichever is smaller) and compressed with a
+// fixed-Huffman deflate stream that encodes byte runs as distance-1 matches,
+// which suits flat vector art. Each call appends complete IDAT chunks to
+// out, so only one band of pixels and one previous row are ever held.
+class PngEncoder
+{
+public:
+    void begin(int width, int height, std::vector<Uint8> &out);
+    // ARGB8888 rows, as in Framebuffer
+    void write_rows(const Uint32 *pixels, int stride, int rows, std::vector<Uint8> &out);
+    void finish(std::vector<Uint8> &out);
+
+private:
+    void put_byte(Uint8 value);
+    void put_bits(Uint32 value, int count);
+    void put_literal(int symbol);
+    void put_match(int length);
+    void deflate_bytes(const Uint8 *data, size_t size);
+    void flush_chunk(std::vector<Uint8> &out);
+
+    int width = 0;
+    std::vector<Uint8> row, previous, filtered;
+    std::vector<Uint8> compressed; // Pending IDAT payload
+    Uint32 bit_buffer = 0;
+    int bit_count = 0;
+    Uint32 adler_a = 1, adler_b = 0;
+    int last_byte = -1;            // For distance-1 matches
+};
+
+// Streaming SVG writer. Shapes are formatted straight into the output with
+// no intermediate strings; circles are written as ellipses so their
+// bounding box survives a round trip through SvgImporter.
+class SvgWriter
+{
+public:
+    // width and height size the document; world becomes its viewBox
+    void begin(SDL_Rect world, SDL_Color background, std::vector<Uint8> &out, int width, int height);
+    void write_shape(Uint8 type, SDL_Rect rect, SDL_Color color, std::vector<Uint8> &out);
+    void finish(std::vector<Uint8> &out);
+};
+
+// One export of a region of the scene at a given scale.
+// The job copies the shapes it needs in stacking order when created, so it
+// can run on another thread while the scene keeps changing. Each step()
+// produces the next piece of the file in chunk: a band of rows for PNG, a
+// batch of elements for SVG. Memory stays bounded by one band however large
+// the output: bands are rendered with the software rasterizer in the same
+// content-space projection as Canvas::render. Below a pixel per cell, the
+// shapes the view would draw from the LOD pyramid go into a pyramid of the
+// job's own and are drawn from it the same way, so an export at the view's
+// zoom matches the screen pixel for pixel (minus the grid).
+class ExportJob
+{
+public:
+    static const int BAND_BYTES = 4 << 20;
+    static const int SVG_BATCH = 8192;
+    static const int MAX_SIDE = 1 << 20; // Larger outputs are scaled down to fit
+
+    // index is the scene's, telling which shapes the view draws from the
+    // LOD pyramid at this scale
+    ExportJob(const Scene &scene, const SpatialIndex &index, ExportFormat format, SDL_Rect world, float scale,
+              SDL_Color background);
+
+    // Clears chunk and appends the next piece. Returns false once the whole
+    // file has been produced.
+    bool step();
+    bool done() const { return finished; }
+    float progress() const;
+
+    std::vector<Uint8> chunk;
+    int width = 0;  // Output size in pixels (PNG) or user units (SVG)
+    int height = 0;
+
+private:
+    void render_band(int top, int rows);
+
+    ExportFormat format;
+    SDL_Rect world;
+    float scale;
+    SDL_Color background;
+
+    // Visible shapes overlapping the region, in stacking order, less those
+    // in lod
+    std::vector<SDL_Rect> rects;
+    std::vector<SDL_Color> colors;
+    std::vector<Uint8> types;
+
+    // Small shapes under the region when the scale draws them as cells
+    LodPyramid lod;
+    int lod_level = 0;
+    SDL_Point origin = {0, 0}; // Content space position of output pixel (0, 0)
+    std::vector<LodPyramid::Sums> lod_sums;
+    std::vector<Uint32> lod_colors;
+
+    PngEncoder png;
+    SvgWriter svg;
+    Framebuffer band;
+    EllipseCache ellipses;
+    int band_rows = 0;
+    int next = 0;          // Next row (PNG) or shape (SVG)
+    bool started = false;
+    bool finished = false;
+};
+
+// Writes export jobs to files off the calling thread. Without thread support
+// the job runs to completion inside start().
+class ExportWriter
+{
+public:
+    ExportWriter() = default;
+    ~ExportWriter();
+    ExportWriter(const ExportWriter &) = delete;
+    ExportWriter &operator=(const ExportWriter &) = delete;
+
+    // Waits for the previous export, then starts this one. Returns false if
+    // the file cannot be created.
+    bool start(std::unique_ptr<ExportJob> job, const char *path);
+    void wait();
+
+    bool busy() const { return running; }
+    bool succeeded() const { return ok; } // Of the last finished export
+    float progress() const { return fraction; }
+
+private:
+    void run(FILE *file);
+
+    std::unique_ptr<ExportJob> job;
+#if VECTORMATE_HAS_THREADS
+    std::thread thread;
+#endif
+    std::atomic<bool> running{false};
+    std::atomic<bool> ok{false};
+    std::atomic<float> fraction{0.0f};
+};
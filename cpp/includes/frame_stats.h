@@ -0,0 +1,54 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <chrono>
+
+// Per-frame measurements. Times are in microseconds, counters are totals for
+// the frame. Work done between painted frames (input, hit tests, idle
+// renders) is carried into the next painted frame. With raster threads the
+// background, grid and shape times add up every thread's share.
+enum FrameStat {
+    STAT_FRAME = 0,         // Sequence number of the painted frame
+    STAT_TOTAL_US,          // Whole render() call
+    STAT_INPUT_US,          // Draining the input queue
+    STAT_BACKGROUND_US,     // Clears and grid layer copies
+    STAT_GRID_US,           // Grid lines and grid layer rebuilds
+    STAT_SHAPES_US,         // Culling, sorting, batching and filling shapes
+    STAT_SELECTION_US,      // Selection handles
+    STAT_COMPOSITE_US,      // Tile copies and framebuffer upload
+    STAT_PRESENT_US,        // SDL_RenderPresent
+    STAT_DRAW_CALLS,        // Fills, lines and copies submitted
+    STAT_SHAPES_VISITED,    // Returned by the spatial index
+    STAT_SHAPES_CULLED,     // Visited but outside the region or empty on screen
+    STAT_TILES_RASTERIZED,
+    STAT_DAMAGE_RECTS,
+    STAT_HIT_TESTS,
+    STAT_INPUT_EVENTS,      // Before coalescing
+    FRAME_STAT_COUNT
+};
+
+inline bool frame_stat_is_time(int stat) {
+    return stat >= STAT_TOTAL_US && stat <= STAT_PRESENT_US;
+}
+
+// Monotonic clock for the time stats, in nanoseconds
+inline Uint64 stat_clock() {
+    return (Uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Ring of the most recent painted frames in WASM linear memory, read by JS
+// through a Uint32Array view. Frame n is at frames[n % CAPACITY]; the newest
+// is frame write_index - 1. The header and ring are contiguous so JS needs
+// only one pointer.
+struct FrameStats {
+    static const Uint32 CAPACITY = 256; // Power of two
+
+    Uint32 capacity = CAPACITY;
+    Uint32 stat_count = FRAME_STAT_COUNT;
+    Uint32 write_index = 0;
+    Uint32 reserved = 0;
+    Uint32 frames[CAPACITY][FRAME_STAT_COUNT] = {};
+
+    // Stores one frame from accumulated stats, times given in nanoseconds
+    void record(const Uint64 *pending);
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "scene.h"
+
+enum HistoryOp : Uint8 {
+    HISTORY_MOVE = 1,    // ids moved by (dx, dy)
+    HISTORY_RECOLOR = 2, // ColorRecord per shape
+    HISTORY_INSERT = 3,  // ShapeRecord per inserted shape
+    HISTORY_DELETE = 4,  // ShapeRecord per deleted shape
+    HISTORY_RESTACK = 5  // StackRecord per relabeled shape
+};
+
+// Everything needed to bring a shape back with the same id and stacking
+struct ShapeRecord {
+    ShapeId id;
+    Uint8 type;
+    Uint8 flags;
+    Uint16 reserved;
+    SDL_Rect rect;
+    SDL_Color color;
+    Uint64 z;
+};
+
+struct ColorRecord {
+    ShapeId id;
+    SDL_Color from;
+    SDL_Color to;
+};
+
+// A shape's z before and after. The same id may appear more than once when
+// a later placement relabeled it again.
+struct StackRecord {
+    ShapeId id;
+    Uint32 reserved;
+    Uint64 from;
+    Uint64 to;
+};
+
+// One undoable action, stored inline in the history buffer with its
+// count payload items right after the header
+struct HistoryEntry {
+    Uint32 size;      // Header, payload and footer bytes
+    Uint8 op;         // HistoryOp
+    Uint8 reserved[3];
+    Sint32 count;
+    Sint32 dx;        // HISTORY_MOVE offset
+    Sint32 dy;
+    Sint32 padding;
+
+    const ShapeId *ids() const { return (const ShapeId *)(this + 1); }
+    const ColorRecord *colors() const { return (const ColorRecord *)(this + 1); }
+    const ShapeRecord *shapes() const { return (const ShapeRecord *)(this + 1); }
+    const StackRecord *stacks() const { return (const StackRecord *)(this + 1); }
+};
+
+// Command log of compact deltas in one contiguous byte buffer.
+// Entries are appended at the cursor; each ends with a footer holding its
+// size so undo can step backwards. Recording drops the redo tail, and the
+// oldest entries are dropped once the byte budget is exceeded. Undo and redo
+// hand back a single entry, so their cost is the size of that delta.
+class History
+{
+public:
+    explicit History(size_t budget_bytes = 8u << 20);
+
+    void clear();
+    void set_budget(size_t budget_bytes);
+    size_t bytes() const { return end - head; }
+
+    // Begin a new entry and return its payload for the caller to fill in.
+    // Returns null if the entry alone is larger than the budget; history is
+    // cleared then, since older entries would no longer apply.
+    ShapeId *record_move(int count, int dx, int dy);
+    ColorRecord *record_recolor(int count);
+    ShapeRecord *record_insert(int count);
+    ShapeRecord *record_delete(int count);
+    StackRecord *record_restack(int count);
+
+    // Folds an offset into the open move entry if it moves exactly these ids,
+    // so a whole drag undoes in one step
+    bool extend_move(const ShapeId *ids, int count, int dx, int dy);
+    // Closes the open entry; a move that came back to where it started is dropped
+    void seal();
+
+    bool can_undo() const { return cursor > head; }
+    bool can_redo() const { return cursor < end; }
+    // Entry to revert, or null; moves the cursor back over it
+    const HistoryEntry *undo();
+    // Entry to apply again, or null; moves the cursor forward over it
+    const HistoryEntry *redo();
+
+private:
+    static const size_t FOOTER = 8;
+
+    void *begin_entry(HistoryOp op, int count, size_t payload_bytes);
+    HistoryEntry *last_entry();
+    HistoryEntry *entry_at(size_t offset) { return (HistoryEntry *)(buffer.data() + offset); }
+
+    std::vector<Uint8> buffer;
+    size_t head = 0;    // Oldest entry
+    size_t cursor = 0;  // Entries before this are undoable, from here redoable
+    size_t end = 0;
+    size_t budget;
+    bool open = false;  // Last entry may still be extended
+};
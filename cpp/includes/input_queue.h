@@ -0,0 +1,63 @@
+#pragma once
+#include <SDL2/SDL.h>
+
+enum InputEventType {
+    INPUT_NONE = 0,
+    INPUT_MOUSE_DOWN = 1,   // x, y, value = button
+    INPUT_MOUSE_MOVE = 2,   // x, y
+    INPUT_MOUSE_UP = 3,     // x, y, value = button
+    INPUT_KEY_DOWN = 4,     // x = key code, y = KeyModifier bits
+    INPUT_ZOOM = 5          // x, y, value = zoom factor as float bits
+};
+
+enum KeyModifier {
+    KEY_MOD_CTRL = 1 << 0,
+    KEY_MOD_SHIFT = 1 << 1,
+    KEY_MOD_ALT = 1 << 2,
+    KEY_MOD_META = 1 << 3
+};
+
+// Key codes: the code point for single-character keys, ASCII control codes
+// where one exists, and values past the Unicode range for the rest.
+enum KeyCode {
+    KEY_UNKNOWN = 0,
+    KEY_BACKSPACE = 8,
+    KEY_TAB = 9,
+    KEY_ENTER = 13,
+    KEY_ESCAPE = 27,
+    KEY_DELETE = 127,
+    KEY_ARROW_LEFT = 0x110000,
+    KEY_ARROW_RIGHT,
+    KEY_ARROW_UP,
+    KEY_ARROW_DOWN,
+    KEY_HOME,
+    KEY_END
+};
+
+// Maps a DOM KeyboardEvent.key name to a KeyCode
+int key_code_from_name(const char *name);
+
+// Four int32 words per event so JS can write them through HEAP32
+struct InputEvent {
+    Sint32 type;
+    Sint32 x;
+    Sint32 y;
+    Sint32 value;
+};
+
+// Single-producer ring in WASM linear memory. JS writes events at
+// write_index % CAPACITY and then bumps write_index; the engine drains
+// everything up to write_index once per frame and advances read_index.
+// The header and ring are contiguous so JS needs only one pointer.
+struct InputQueue {
+    static const Uint32 CAPACITY = 1024; // Power of two
+
+    Uint32 capacity = CAPACITY;
+    Uint32 write_index = 0;
+    Uint32 read_index = 0;
+    Uint32 reserved = 0;
+    InputEvent events[CAPACITY];
+
+    bool empty() const { return read_index == write_index; }
+    bool push(const InputEvent &event);
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "scene.h"
+
+// Binary trace of the calls that drive a Canvas, for replaying an interaction
+// exactly and timing it.
+//
+//   header    InputTraceHeader: view and settings when recording started
+//   scene     SceneFile document of the scene when recording started
+//   selection selected ids, u32 each
+//   events    one per call: microseconds since the previous event, the
+//             TraceOp byte, then the op's arguments. Times and arguments are
+//             LEB128 varints, arguments zigzag encoded; a zoom factor goes as
+//             its 32 float bits.
+//   end       TRACE_END, then the SceneFile::checksum of the scene at the
+//             end as 8 raw bytes
+//
+// Mouse moves and zooms are recorded after the input queue coalesced them,
+// and render where it has drained the queue, so a replay makes the same calls
+// in the same order. Undo, redo and the selection edits are recorded whether
+// JS calls them directly or a key does, the key's edits replaying through the
+// key. Loads, SVG imports, bulk ingest and removal, and edits by id such as
+// add_shape or set_shape_z are not recorded, nor is the history: an undo
+// reaching back past the start has nothing to undo in a replay. A trace
+// around any of these will not replay to the same scene, which the checksum
+// shows.
+enum TraceOp : Uint8 {
+    TRACE_END = 0,
+    TRACE_RENDER = 1,
+    TRACE_MOUSE_DOWN = 2,  // x, y, button
+    TRACE_MOUSE_MOVE = 3,  // x, y
+    TRACE_MOUSE_UP = 4,    // x, y, button
+    TRACE_KEY = 5,         // key code, modifiers
+    TRACE_ZOOM = 6,        // zoom factor bits, x, y
+    TRACE_RESIZE = 7,      // width, height
+    TRACE_GRID = 8,        // show, size
+    TRACE_GRID_COLOR = 9,  // show, size, r, g, b, a
+    TRACE_BACKGROUND = 10, // r, g, b, a
+    TRACE_SNAPPING = 11,   // to grid, to shapes
+    TRACE_UNDO = 12,
+    TRACE_REDO = 13,
+    TRACE_RECOLOR = 14,    // r, g, b, a of the selection's new color
+    TRACE_DELETE_SELECTION = 15,
+    TRACE_RESTACK = 16,    // StackOp
+    TRACE_OP_COUNT
+};
+
+struct InputTraceHeader {
+    char magic[4];          // "VMTR"
+    Uint16 version;
+    Uint16 header_bytes;
+    Sint32 width, height;
+    Uint32 backend;         // RenderBackend recorded with; replays may pick another
+    float zoom;
+    float pan_x, pan_y;
+    Sint32 grid_size;
+    SDL_Color grid_color;
+    SDL_Color background_color;
+    Uint8 show_grid;
+    Uint8 snap_to_grid;
+    Uint8 snap_to_shapes;
+    Uint8 reserved;
+    Uint32 scene_bytes;
+    Uint32 selection_count;
+};
+
+struct TraceEvent {
+    Uint64 time_us;  // Since recording started
+    TraceOp op;
+    int args[6];
+};
+
+// Number of arguments an op carries
+int trace_op_args(TraceOp op);
+
+// Appends events to a trace in memory. Recording allocates as the trace
+// grows, so the input path only stays allocation free while it is off.
+class InputTraceRecorder
+{
+public:
+    static const Uint16 VERSION = 1;
+
+    bool recording() const { return active && !muted; }
+    // While muted, calls made on behalf of a recorded one are not recorded
+    // again
+    void set_muted(bool mute) { muted = mute; }
+
+    // Starts a trace; scene is a SceneFile document
+    void start(const InputTraceHeader &header, const std::vector<Uint8> &scene,
+               const ShapeId *selection, int selection_count);
+    void record(TraceOp op, int a = 0, int b = 0, int c = 0, int d = 0, int e = 0, int f = 0);
+    // Ends the trace with the final scene checksum and returns its size
+    size_t stop(Uint64 checksum);
+
+    std::vector<Uint8> data; // The trace, complete once stopped
+
+private:
+    void put_varint(Uint64 value);
+
+    bool active = false;
+    bool muted = false;
+    Uint64 started = 0; // stat_clock at start
+    Uint64 last_us = 0;
+};
+
+// Reads a trace back, checking the header and every length against the size
+class InputTraceReader
+{
+public:
+    bool open(const Uint8 *bytes, size_t bytes_size);
+
+    const InputTraceHeader &header() const { return head; }
+    const Uint8 *scene() const { return data + sizeof(InputTraceHeader); }
+    ShapeId selected(int i) const;
+
+    // Next event; false at TRACE_END or on a malformed event
+    bool next(TraceEvent &event);
+    // After next returned false: whether the trace ended properly, and the
+    // scene checksum it ended with
+    bool ended() const { return done; }
+    Uint64 checksum() const { return final_checksum; }
+
+private:
+    bool get_varint(Uint64 &value);
+
+    const Uint8 *data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    InputTraceHeader head = {};
+    Uint64 time_us = 0;
+    bool done = false;
+    Uint64 final_checksum = 0;
+};
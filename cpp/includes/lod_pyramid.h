@@ -0,0 +1,103 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Coverage and color of small shapes at several resolutions, for drawing
+// zoomed-out views in time proportional to the pixels rather than the shapes.
+// Level j is a sparse grid of square cells 2^j world units wide, stored in
+// blocks of cells. Each cell sums, over the shapes it holds, the area they
+// cover in it times their alpha, and the same product times each color
+// channel. Areas are in 1/FILL_SCALE units; an ellipse counts the part of its
+// rect's area it fills. Sums are exact integers, so taking a shape out is the exact
+// inverse of adding it and the pyramid is kept up to date shape by shape.
+// Which shapes a level holds follows the spatial index: a shape stored in a
+// node of half size h is in every level with 2^j > h, which is exactly the
+// set that SpatialIndex::query_rect skips with min_half = 2^j. Such shapes
+// are at most 2^j wide, so at most 2x2 cells of a level.
+class LodPyramid
+{
+public:
+    // Cells of up to 8 units: pixels are at most 10 units wide at the
+    // minimum zoom of 0.1
+    static const int LEVELS = 3;
+    // How far beyond a small shape its pixels can reach through its cells
+    // at any zoom: one coarsest cell plus one pixel at the minimum zoom
+    static const int FOOTPRINT_MARGIN = (1 << LEVELS) + 10;
+
+    static const int BLOCK_CELLS = 16; // Cells per block side
+
+    static const int FILL_SCALE = 256;
+    static const int ELLIPSE_FILL = 201; // pi / 4 of FILL_SCALE
+
+    // Sums of one cell, 0 weight never stored
+    struct Cell {
+        Uint8 x, y;    // Within the block
+        Uint64 weight; // Sum of covered area * alpha
+        Uint64 red, green, blue; // Sum of weight * channel
+    };
+
+    // The nonempty cells of a square of BLOCK_CELLS^2 cells, in no order.
+    // Drawing walks the blocks under the view, so empty space costs one
+    // lookup per block rather than one per cell.
+    struct Block {
+        int bx, by;
+        std::vector<Cell> cells;
+        Uint16 slot[BLOCK_CELLS * BLOCK_CELLS]; // Cell position -> index in cells, NO_CELL if empty
+    };
+    static const Uint16 NO_CELL = 0xFFFF;
+
+    void clear();
+
+    // Adds (sign 1) or takes out (sign -1) a shape held in a spatial index
+    // node of half size node_half. It must be taken out with the same
+    // arguments it was added with.
+    void add(SDL_Rect rect, SDL_Color color, bool ellipse, int node_half, int sign);
+
+    // Level to draw at a zoom: the coarsest whose cells are no wider than a
+    // pixel, or 0 when every shape is at least a pixel and is drawn on its own
+    static int level_for_zoom(float zoom);
+    static int cell_size(int level) { return 1 << level; }
+    // Whether a shape in a node of this half size is in any level
+    static bool holds(int node_half) { return node_half < (1 << LEVELS); }
+
+    // Null when no shape covers any cell of the block
+    const Block *find(int level, int bx, int by) const;
+    size_t cell_count() const;
+
+    // Per-pixel sums while resolving
+    struct Sums {
+        float weight, red, green, blue;
+    };
+    // Colors of the pixels [left, left + width) x [top, top + rows) of
+    // content space at zoom, where a cell of level spans [i * cell,
+    // (i + 1) * cell) pixels. Cells are no wider than a pixel, so each is
+    // split by overlap among at most 2x2 pixels; every pixel then gets the
+    // mean color of what covers it at the covered fraction, as quantized
+    // ARGB with 32 levels per channel so runs of pixels merge, or 0 where
+    // nothing does. sums is scratch of width * rows.
+    void resolve(int level, float zoom, int left, int top, int width, int rows, Sums *sums, Uint32 *colors) const;
+
+private:
+    // Blocks are found through open addressing with linear probing
+    struct Slot {
+        Uint64 key;    // Packed block coordinates
+        int block;     // Index in Level::blocks, -1 for an empty slot
+    };
+
+    struct Level {
+        std::vector<Slot> slots;
+        std::vector<Block> blocks;
+        std::vector<int> free_blocks; // Emptied blocks, kept for reuse
+        size_t used = 0;              // Blocks in slots
+        size_t cells = 0;
+    };
+
+    static Uint64 key_of(int bx, int by) { return ((Uint64)(Uint32)bx << 32) | (Uint32)by; }
+    static size_t home(Uint64 key, size_t mask);
+    size_t find_slot(const Level &level, Uint64 key) const;
+    void accumulate(Level &level, int cx, int cy, Sint64 weight, Sint64 red, Sint64 green, Sint64 blue);
+    void erase_slot(Level &level, size_t slot);
+    void grow(Level &level);
+
+    Level levels[LEVELS]; // levels[j - 1] is level j
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "ellipse_cache.h"
+
+// CPU framebuffer for the software backend.
+// Pixels are packed like SDL_PIXELFORMAT_ARGB8888 so a frame uploads into a
+// streaming texture without conversion. Blending follows SDL's software
+// renderer exactly (premultiplied source, integer /255), so both backends
+// produce identical pixels.
+struct Framebuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<Uint32> pixels;
+    SDL_Rect clip = {0, 0, 0, 0}; // Every raster_* call is clipped to this
+
+    void resize(int new_width, int new_height);
+    int pitch() const { return width * (int)sizeof(Uint32); }
+};
+
+inline Uint32 raster_pack(SDL_Color c) {
+    return ((Uint32)c.a << 24) | ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | (Uint32)c.b;
+}
+
+// Replaces pixels (SDL_BLENDMODE_NONE)
+void raster_fill_rect(Framebuffer &fb, SDL_Rect rect, SDL_Color color);
+// Alpha blends (SDL_BLENDMODE_BLEND)
+void raster_blend_rect(Framebuffer &fb, SDL_Rect rect, SDL_Color color);
+void raster_blend_rects(Framebuffer &fb, const SDL_Rect *rects, int count, SDL_Color color);
+// Anti-aliased ellipse inscribed in box, the same pixels as blending each of
+// its runs with raster_blend_rect at EllipseCache::run_alpha
+void raster_blend_ellipse(Framebuffer &fb, SDL_Rect box, SDL_Color color, EllipseCache &cache);
+// Copies pixels unchanged from another framebuffer to dst in this one
+void raster_copy(Framebuffer &fb, const Framebuffer &src, SDL_Rect src_rect, SDL_Point dst);
+// Axis-aligned line with inclusive endpoints, like SDL_RenderDrawLine
+void raster_blend_line(Framebuffer &fb, int x1, int y1, int x2, int y2, SDL_Color color);
@@ -0,0 +1,109 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "shape.h"
+
+typedef Uint32 ShapeId;
+const ShapeId INVALID_SHAPE_ID = 0xFFFFFFFFu;
+
+// An id is a slot in the id tables in its low bits and a generation above
+// that, bumped each time the slot is handed out again, so a stale id never
+// names the shape that took its slot. Ids stay below 2^31.
+const int SHAPE_SLOT_BITS = 24;
+const Uint32 SHAPE_SLOT_COUNT = 1u << SHAPE_SLOT_BITS;
+const Uint32 SHAPE_GENERATION_MASK = 0x7F;
+
+inline Uint32 shape_slot(ShapeId id) { return id & (SHAPE_SLOT_COUNT - 1); }
+inline Uint32 shape_generation(ShapeId id) { return id >> SHAPE_SLOT_BITS; }
+
+enum ShapeFlags : Uint8 {
+    SHAPE_SELECTED = 1 << 0
+};
+
+// Structure-of-arrays shape storage.
+// Every column has one entry per live shape at the same dense index, so scans
+// stream through packed ints. Shapes are referred to by stable ids; a sparse
+// table maps id slots to dense indices. Slots of removed shapes are handed
+// out again under a new generation, so tables indexed by slot follow how many
+// shapes the scene holds rather than how many it has ever had. Removal swaps
+// the last shape into the hole, so dense order is not stacking order: use the
+// z column.
+class Scene
+{
+public:
+    // Gap between the z of consecutively added shapes, so shapes can be
+    // restacked between them without relabeling (see StackOrder)
+    static const Uint64 Z_SPACING = 1 << 20;
+
+    // Dense columns
+    std::vector<int> x, y, w, h;
+    std::vector<SDL_Color> color;
+    std::vector<Uint8> type;     // ShapeType
+    std::vector<Uint8> flags;    // ShapeFlags
+    std::vector<Uint64> z;       // Stacking key, larger is on top
+    std::vector<ShapeId> ids;    // Dense index -> id
+
+    // Returns INVALID_SHAPE_ID once every slot is taken
+    ShapeId add(const Shape &shape);
+    // Claims count consecutive ids for shapes then added one by one with
+    // add(shape, id), in order. The slots are a run of free ones inside the
+    // table if a short search finds one, or else the free ones at its end
+    // and as many more as it takes. INVALID_SHAPE_ID if they run out.
+    ShapeId claim_ids(int count);
+    void add(const Shape &shape, ShapeId id);
+    // Brings a removed shape back under its old id and stacking key
+    bool restore(ShapeId id, const Shape &shape, Uint64 shape_z);
+    bool remove(ShapeId id);
+    void clear();
+    void reserve(int count);
+
+    // Bulk load: resize sets every column to count entries for the caller to
+    // fill in, then reindex rebuilds the id tables for slot_count slots.
+    // reindex fails, leaving the scene empty, on an id whose slot is out of
+    // range or repeated.
+    void resize(int count);
+    bool reindex(Uint32 slot_count, Uint64 z_count);
+
+    int size() const { return (int)ids.size(); }
+    bool contains(ShapeId id) const { return index_of(id) != -1; }
+    int index_of(ShapeId id) const {
+        Uint32 slot = shape_slot(id);
+        if (slot >= sparse.size()) return -1;
+        Uint32 entry = sparse[slot];
+        return entry != NO_INDEX && (entry ^ id) >> SHAPE_SLOT_BITS == 0 ? (int)shape_slot(entry) : -1;
+    }
+    // Id of the shape in a slot, or INVALID_SHAPE_ID if it is free
+    ShapeId id_in_slot(Uint32 slot) const {
+        return sparse[slot] != NO_INDEX ? (sparse[slot] & ~(SHAPE_SLOT_COUNT - 1)) | slot : INVALID_SHAPE_ID;
+    }
+
+    SDL_Rect rect(int index) const { return {x[index], y[index], w[index], h[index]}; }
+    void set_rect(int index, SDL_Rect r);
+    // Restacks a shape; shapes added later still go above it
+    void set_z(int index, Uint64 shape_z);
+    Shape get(int index) const;
+
+    // Moves the shapes at the given dense indices by the same offset
+    void translate(const int *indices, int count, int dx, int dy);
+
+    // Size of the slot tables; every live shape has a slot below it
+    Uint32 slot_count() const { return (Uint32)sparse.size(); }
+    Uint64 next_z() const { return z_counter; } // Above every shape
+
+private:
+    static const Uint32 NO_INDEX = 0xFFFFFFFFu;
+
+    // Slot -> generation of the id in it over its dense index, laid out like
+    // the id, or NO_INDEX when free. A lookup checks both with one load.
+    std::vector<Uint32> sparse;
+    std::vector<Uint8> generations;  // Slot -> generation it hands out next
+    std::vector<Uint32> free_slots;  // Freed slots below used_end, newest last; may hold stale ones
+    Uint32 used_end = 0;             // Slots from here on are free
+    Uint32 run_cursor = 0;           // Where claim_ids looks for free runs next
+    Uint64 z_counter = 0;
+
+    static Uint32 sparse_entry(ShapeId id, int index) { return (id & ~(SHAPE_SLOT_COUNT - 1)) | (Uint32)index; }
+    void append(ShapeId id, const Shape &shape, Uint64 shape_z);
+    ShapeId issue(Uint32 slot, Uint32 generation);
+    void collect_free_slots();
+};
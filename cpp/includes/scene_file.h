@@ -0,0 +1,84 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <string>
+#include <vector>
+#include "scene.h"
+
+// Versioned binary scene format laid out like the Scene columns.
+//
+//   header    SceneFileHeader
+//   chunks    up to CHUNK_SHAPES shapes each, stored column by column:
+//             z[n] (u64), x[n] y[n] w[n] h[n] (i32), color[n] (rgba8),
+//             id[n] (u32), type[n] (u8), padded to 8 bytes
+//   index     SceneChunkEntry per chunk, pointed to by the header
+//
+// Loading copies whole columns, never individual shapes. All values are
+// little-endian, which is what both WASM and the native targets use.
+// Chunk k holds dense indices [k * CHUNK_SHAPES, (k + 1) * CHUNK_SHAPES).
+// An incremental save appends only the chunks whose contents changed after
+// the end of the previous data, then a new index, and rewrites the header
+// last, so an interrupted save still leaves the old document readable.
+struct SceneFileHeader {
+    char magic[4];        // "VMSC"
+    Uint16 version;
+    Uint16 header_bytes;
+    Uint32 chunk_shapes;  // Shapes per full chunk
+    Uint32 chunk_count;
+    Uint32 shape_count;
+    Uint32 id_count;      // Scene::slot_count
+    Uint64 z_count;       // Scene::next_z
+    Uint64 index_offset;
+};
+
+struct SceneChunkEntry {
+    Uint64 offset;
+    Uint64 hash;   // Of the chunk contents, to spot unchanged chunks on save
+    Uint32 count;
+    Uint32 bytes;
+};
+
+// Loads and saves one document, remembering the layout of the last load or
+// save so the next save to the same target can be incremental.
+class SceneFile
+{
+public:
+    static const Uint16 VERSION = 1;
+    static const Uint32 CHUNK_SHAPES = 1 << 16;
+
+    // Replaces the scene with a document in memory. Documents with an
+    // unknown shape type or a negative size fail, leaving the scene empty.
+    bool load(Scene &scene, const Uint8 *data, size_t size);
+    // Writes the scene into buffer. If buffer still holds the last document
+    // loaded or saved through this object, only changed chunks are written.
+    // Returns the document size.
+    size_t save(const Scene &scene, std::vector<Uint8> &buffer);
+
+    // Native files. load_file maps the file where mmap is available and
+    // otherwise streams each column straight into the scene.
+    bool load_file(Scene &scene, const char *path);
+    bool save_file(const Scene &scene, const char *path);
+
+    // Forgets the last layout, so the next save is a full rewrite
+    void reset();
+
+    // Hash of every column in dense order, flags included, so two scenes
+    // with the same checksum are the same down to the selection
+    static Uint64 checksum(const Scene &scene);
+
+    Uint32 chunks_written = 0; // By the last save
+
+    // Random-access byte streams behind the memory and file entry points
+    struct Source;
+    struct Sink;
+
+private:
+    bool read(Scene &scene, Source &source);
+    bool write(const Scene &scene, Sink &sink, bool incremental);
+    bool can_append() const;
+
+    std::vector<SceneChunkEntry> chunks; // Layout of the last load or save
+    Uint64 file_end = 0;                 // End of the index
+    Uint64 live_bytes = 0;               // Header, current chunks and index
+    std::string target;                  // Path, or empty for a memory buffer
+    bool valid = false;
+};
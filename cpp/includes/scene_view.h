@@ -0,0 +1,90 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "scene.h"
+
+// What JS sees of the scene without a call per shape: the Scene columns in
+// place, and the ids of shapes changed since it last looked.
+
+enum ChangeKind : Uint32 {
+    CHANGE_CREATED = 1 << 0,   // Added, or brought back by undo
+    CHANGE_MOVED = 1 << 1,
+    CHANGE_RECOLORED = 1 << 2,
+    CHANGE_RESTACKED = 1 << 3, // z changed, relabels included
+    CHANGE_DELETED = 1 << 4,
+    CHANGE_SELECTED = 1 << 5   // SHAPE_SELECTED set or cleared
+};
+
+struct ChangeRecord {
+    ShapeId id;
+    Uint32 kinds; // ChangeKind bits, every change since the last drain
+};
+
+// Shapes changed since the last drain, each listed once with every kind of
+// change it went through, in the order they first changed. A shape created
+// and deleted in between has both bits; one deleted, whose slot another
+// shape then took, and brought back by undo is listed a second time. Room is
+// fixed at CAPACITY shapes, so noting a change allocates nothing once the
+// slot is known: when more shapes change than fit, the journal stops listing
+// them and the drain reports a reset instead, telling the reader to re-read
+// the whole scene. Replacing the scene does the same.
+class ChangeJournal
+{
+public:
+    static const int CAPACITY = 16384;
+
+    ChangeJournal();
+
+    void note(ShapeId id, Uint32 kinds);
+    // Everything changed; slot_count sizes the slot table for the new scene
+    void reset(Uint32 slot_count);
+
+    // Moves the changes noted so far to records(), returning their count
+    int drain();
+    const ChangeRecord *records() const { return drained.data(); }
+    bool drained_reset() const { return reset_drained; }
+
+private:
+    static const Uint32 NOT_LISTED = 0xFFFFFFFFu;
+
+    std::vector<Uint32> listed_by_slot;  // Id slot -> its latest entry in pending, or NOT_LISTED
+    std::vector<ChangeRecord> pending;   // In first-change order
+    std::vector<ChangeRecord> drained;
+    bool whole_scene = false;
+    bool reset_drained = false;
+};
+
+enum SceneColumn {
+    COLUMN_X = 0,
+    COLUMN_Y,
+    COLUMN_W,
+    COLUMN_H,
+    COLUMN_COLOR,  // SDL_Color, r g b a bytes
+    COLUMN_TYPE,   // ShapeType as Uint8
+    COLUMN_FLAGS,  // ShapeFlags
+    COLUMN_Z,      // Uint64
+    COLUMN_ID,     // ShapeId at each dense index
+    SCENE_COLUMN_COUNT
+};
+
+// Where the Scene columns and the last drained changes are, read by JS
+// through typed array views over WASM linear memory. An add or removal may
+// move a column, so the addresses are good until the scene next changes:
+// refresh fills them in again, and JS rebuilds its views when they differ.
+// JS reads the wasm32 layout, where a pointer is one word.
+struct SceneView {
+    struct Column {
+        const void *data;
+        Uint32 count;
+        Uint32 stride; // Bytes from one entry to the next
+    };
+
+    Uint32 column_count = SCENE_COLUMN_COUNT;
+    Uint32 shape_count = 0;
+    Uint32 change_count = 0; // Records at changes
+    Uint32 reset = 0;        // Nonzero when the changes could not be listed
+    const ChangeRecord *changes = nullptr;
+    Column columns[SCENE_COLUMN_COUNT] = {};
+
+    void refresh(const Scene &scene);
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "scene.h"
+
+// Set of selected shape ids.
+// A sparse set: ids are packed in insertion order in a dense array, and a
+// table indexed by id slot holds each one's position there. Membership, insert
+// and erase are O(1), clear is O(1), and bulk edits loop over the packed ids
+// with no gaps, so every operation costs what the selection holds rather than
+// what the document holds. The position table is never cleared; an entry is
+// trusted only when the dense slot it points at holds the same id.
+class SelectionSet
+{
+public:
+    bool insert(ShapeId id);
+    bool erase(ShapeId id);
+    void clear() { dense.clear(); }
+
+    bool contains(ShapeId id) const {
+        Uint32 slot = shape_slot(id);
+        return slot < position.size() && position[slot] < dense.size() && dense[position[slot]] == id;
+    }
+    int size() const { return (int)dense.size(); }
+    bool empty() const { return dense.empty(); }
+
+    const ShapeId *data() const { return dense.data(); }
+    const ShapeId *begin() const { return dense.data(); }
+    const ShapeId *end() const { return dense.data() + dense.size(); }
+
+private:
+    std::vector<ShapeId> dense;
+    std::vector<Uint32> position; // Id slot -> index in dense
+};
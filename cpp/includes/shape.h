@@ -11,5 +11,4 @@ struct Shape {
     ShapeType type;
     SDL_Rect rect; // Used for rect position/size and circle bounding box
     SDL_Color color;
-    bool is_selected = false;
 };
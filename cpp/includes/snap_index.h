@@ -0,0 +1,89 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstdlib>
+#include "scene.h"
+#include "bucket_list.h"
+
+// Edges and centers of shapes in sorted order, by x and by y, for snapping.
+// A shape adds its left, center and right x to one axis and its top, middle
+// and bottom y to the other. Each axis is a BucketList, so finding a value
+// takes two binary searches and an insert or removal shifts one bucket only:
+// shapes are kept up to date one by one as they are added, moved and
+// removed. Equal values are ordered by id, so a removal finds its own entry.
+class SnapIndex
+{
+public:
+    enum Axis { AXIS_X = 0, AXIS_Y = 1 };
+
+    struct Entry {
+        int value;
+        ShapeId id;
+    };
+
+    void clear();
+    // Replaces the contents with every shape of the scene, sorted in one pass
+    void build(const Scene &scene);
+
+    // A shape must be removed with the rect it was inserted with
+    void insert(ShapeId id, SDL_Rect rect);
+    void remove(ShapeId id, SDL_Rect rect);
+
+    // Whether adding or removing this many shapes one by one costs more than
+    // build, which sorts in linear time but over the whole scene
+    bool build_cheaper(size_t changed) const { return changed * 8 >= size(); }
+
+    // The three coordinates a rect adds to an axis, low edge first
+    static void features(SDL_Rect rect, Axis axis, int out[3]);
+
+    // Nearest entry to value within max_distance for which accept(const
+    // Entry &) holds, walking outwards from value in both directions at
+    // once. Gives up after max_probes rejected entries, so a crowd of
+    // rejected shapes on one line costs a bounded time. Returns false when
+    // there is none.
+    template <typename Accept>
+    bool nearest(Axis axis, int value, int max_distance, int max_probes, Accept &&accept, Entry &out) const;
+
+    size_t size() const { return axes[AXIS_X].size(); }
+
+private:
+    struct Less {
+        bool operator()(const Entry &a, const Entry &b) const {
+            return a.value < b.value || (a.value == b.value && a.id < b.id);
+        }
+    };
+    typedef BucketList<Entry, Less> Sorted;
+
+    Sorted axes[2];
+};
+
+template <typename Accept>
+bool SnapIndex::nearest(Axis axis, int value, int max_distance, int max_probes, Accept &&accept, Entry &out) const
+{
+    const Sorted &sorted = axes[axis];
+
+    // Cursors on the first entry at or above value and the one before it
+    Sorted::Cursor up = sorted.lower_bound({value, 0});
+    Sorted::Cursor down = up;
+    bool has_up = !sorted.at_end(up);
+    bool has_down = sorted.prev(down);
+
+    for (int probes = 0; probes <= max_probes && (has_up || has_down); ++probes) {
+        const Entry *above = has_up ? &sorted[up] : nullptr;
+        const Entry *below = has_down ? &sorted[down] : nullptr;
+        bool take_up = above && (!below || above->value - value <= value - below->value);
+        const Entry &candidate = take_up ? *above : *below;
+        if (std::abs(candidate.value - value) > max_distance) return false;
+        if (accept(candidate)) {
+            out = candidate;
+            return true;
+        }
+
+        if (take_up) {
+            sorted.next(up);
+            has_up = !sorted.at_end(up);
+        } else {
+            has_down = sorted.prev(down);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include <algorithm>
+#include "scene.h"
+
+// Loose quadtree over world-space rects.
+// Items are keyed by shape id, stored by the id's slot so the item table is
+// only as large as the scene's, and carry a z key; the topmost hit is the
+// item with the largest z, which keeps the stacking order of the scene. An
+// item may be the ellipse inscribed in its rect, which point queries test
+// exactly; rect queries use the rect. Nodes are made as items need them and
+// dropped once nothing is left in or under them.
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(int world_half_extent = 1 << 20);
+
+    void clear();
+    // Room for ids with slots below slot_count, ahead of inserting many
+    void reserve(Uint32 slot_count) { items.reserve(slot_count); }
+    void insert(int id, SDL_Rect rect, Uint64 z, bool ellipse = false);
+    void update(int id, SDL_Rect rect);
+    void set_z(int id, Uint64 z);
+    void remove(int id);
+    bool contains(int id) const;
+
+    // Returns the id of the topmost item containing p, or -1.
+    int query_topmost(SDL_Point p) const;
+    // Appends the ids of all items overlapping r (in no particular order).
+    // Nodes of half size below min_half are not visited; the items in them
+    // are all at most min_half wide.
+    void query_rect(SDL_Rect r, std::vector<int>& out, int min_half = 0) const;
+
+    // Half size of the node holding the item, which depends only on its size
+    // unless it lies outside the world; 0 when the id is not in the index
+    int node_half(int id) const { return contains(id) ? nodes[items[shape_slot(id)].node].half : 0; }
+
+    int size() const { return item_count; }
+
+private:
+    static const int MAX_DEPTH = 20;
+
+    struct Node {
+        int cx, cy, half;        // tight cell: center +/- half, loose bounds are twice that
+        int parent = -1;
+        int children[4] = {-1, -1, -1, -1};
+        std::vector<int> items;
+    };
+
+    struct Item {
+        int id = -1;
+        SDL_Rect rect;
+        Uint64 z;
+        bool ellipse = false;
+        int node = -1;           // -1 when the slot holds no item
+        int position = -1;       // inside nodes[node].items
+    };
+
+    int root_half;
+    int item_count = 0;
+    std::vector<Node> nodes;
+    std::vector<int> free_nodes;  // Unlinked from the tree, for child_for to reuse
+    std::vector<Item> items;      // By slot
+
+    int find_node(SDL_Rect rect);
+    int child_for(int node, int x, int y);
+    void link(int id, int node);
+    void unlink(int id);
+    void prune(int node);
+    bool fits_node(SDL_Rect rect, int node) const;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "scene.h"
+#include "bucket_list.h"
+
+// Stacking order of the scene as order-maintenance labels.
+// A shape's z is a label in the 64-bit space, unique, larger on top. The
+// labels are kept sorted here, so a shape can be given a label between any
+// two neighbours without moving shape storage: the midpoint of the gap when
+// there is one. That costs O(BUCKET + log n) amortized in the BucketList
+// holding the labels. When a gap runs out, the labels of a small range
+// around it are spread out evenly first (Bender et al., "Two Simplified
+// Algorithms for Maintaining Order in a List"): the range is the smallest
+// aligned block of 2^i labels holding at most 2^(i/2) of them, which keeps
+// the amortized number of labels rewritten logarithmic. They are rewritten
+// in place. Relabeling never changes the order of the shapes it touches, so
+// nothing has to be redrawn for it.
+class StackOrder
+{
+public:
+    struct Entry {
+        Uint64 z;
+        ShapeId id;
+    };
+
+    void clear() { labels.clear(); }
+    void build(const Scene &scene);
+
+    void insert(ShapeId id, Uint64 z) { labels.insert({z, id}); }
+    void remove(ShapeId id, Uint64 z) { labels.erase({z, id}); }
+
+    // Whether some shape has label z
+    bool taken(Uint64 z) const;
+    // Nearest label above or below z; false if there is none
+    bool above(Uint64 z, Entry &out) const;
+    bool below(Uint64 z, Entry &out) const;
+    bool top(Entry &out) const;
+
+    // A free label right above under, or at the very bottom when under is
+    // null. Shapes whose labels had to be spread out to make room are listed
+    // in relabeled until the next call, with their new labels.
+    Uint64 place_above(const Uint64 *under);
+    // A free label right below over
+    Uint64 place_below(Uint64 over);
+    const std::vector<Entry> &relabeled() const { return moved; }
+
+    size_t size() const { return labels.size(); }
+
+private:
+    struct Less {
+        bool operator()(const Entry &a, const Entry &b) const {
+            return a.z < b.z || (a.z == b.z && a.id < b.id);
+        }
+    };
+    typedef BucketList<Entry, Less> Labels;
+
+    // Spreads the labels around anchor to free a slot right above it, or
+    // below every label in its block when bottom is set; returns the slot
+    Uint64 relabel(Uint64 anchor, bool bottom);
+
+    Labels labels;
+    std::vector<Entry> moved;
+};
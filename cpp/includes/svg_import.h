@@ -0,0 +1,47 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <vector>
+#include "arena.h"
+#include "shape.h"
+
+// Streaming SVG reader.
+// Walks the document once, tag by tag, without building a tree: only the
+// inherited style and transform of the open elements are kept on a stack.
+// <rect>, <circle> and <ellipse> become shapes; circles and ellipses keep
+// their bounding box. Fills come from fill, fill-opacity and opacity, as
+// attributes or in style, and inherit through groups. Transforms are applied
+// when they are translations and scales; rotation and skew are dropped.
+// Lengths are read in user units whatever their suffix. Anything inside
+// <defs>, <clipPath>, <mask>, <pattern>, <symbol> or <marker> is not drawn.
+class SvgImporter
+{
+public:
+    // Appends a shape for every filled element and returns how many were
+    // added. Malformed markup ends the read early but keeps what was found.
+    int read(const char *data, size_t size, std::vector<Shape> &out);
+
+    int elements = 0; // Start tags seen by the last read
+
+    // Attribute of the element being read, with entities already decoded
+    struct Attribute {
+        const char *name;
+        const char *value;
+        int name_length;
+        int value_length;
+        Attribute *next;
+    };
+
+    // Inherited state of an open element
+    struct Style {
+        SDL_Color fill;
+        float fill_opacity;
+        float opacity;
+        bool fill_none;
+        bool hidden;
+        float sx, sy, tx, ty; // user space to document: x * sx + tx
+    };
+
+private:
+    Arena arena;              // Attributes and decoded values of one tag
+    std::vector<Style> stack;
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Emscripten only has threads when built with -pthread (SharedArrayBuffer)
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define VECTORMATE_HAS_THREADS 0
+#else
+#define VECTORMATE_HAS_THREADS 1
+#endif
+
+// Fork-join pool with work stealing.
+// run() deals task indices round-robin into one queue per slot; each slot
+// pops from the back of its own queue and steals from the front of the
+// others when it runs dry, so uneven tasks still balance. The calling thread
+// is slot 0 and works alongside the pool. With no workers (or no thread
+// support) run() simply loops on the calling thread. The task is called
+// through a borrowed reference and the queues keep their storage, so a run
+// allocates nothing once the queues have held that many indices.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int workers = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Joins the current workers and starts new ones; clamped to what the
+    // platform offers, so the result may be 0
+    void resize(int workers);
+    int worker_count() const { return (int)threads.size(); }
+
+    // Extra threads worth starting next to the calling one
+    static int available_workers();
+
+    // Calls task(index, slot) for every index in [0, count) and returns when
+    // all are done. slot is in [0, worker_count()] and unique per thread.
+    template <typename Task>
+    void run(int count, Task &&task)
+    {
+        typedef typename std::remove_reference<Task>::type Callable;
+        TaskRef ref = {(void *)&task, [](void *callable, int index, int slot) {
+            (*(Callable *)callable)(index, slot);
+        }};
+        run_tasks(count, ref);
+    }
+
+private:
+    // Non-owning handle to the caller's callable
+    struct TaskRef {
+        void *callable;
+        void (*call)(void *callable, int index, int slot);
+    };
+
+    // Indices in [head, tail) of items are pending
+    struct Queue {
+        std::mutex mutex;
+        std::vector<int> items;
+        int head = 0;
+        int tail = 0;
+    };
+
+    void run_tasks(int count, const TaskRef &task);
+
+    bool next(int slot, int &index);
+    void drain(int slot);
+    void worker_main(int slot);
+    void stop();
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues; // One per slot
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const TaskRef *task = nullptr;
+    Uint64 generation = 0;
+    std::atomic<int> pending{0};
+    bool stopping = false;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cmath>
+#include <list>
+#include <unordered_map>
+#include "raster.h"
+
+// Content space: world coordinates scaled by zoom and floored, before pan is
+// applied. world_to_screen is content minus the pan in pixels, so content
+// pixels stay put while the view pans.
+inline int world_to_content(int v, float zoom) {
+    return (int)std::floor((double)v * zoom);
+}
+
+// One square of content space at one zoom level, holding background, grid and
+// shape fills. Selection handles are not cached.
+struct Tile {
+    float zoom = 0.0f;
+    int tx = 0;
+    int ty = 0;
+    SDL_Texture *texture = nullptr; // SDL backend
+    Framebuffer pixels;             // Software backend
+    SDL_Rect dirty = {0, 0, 0, 0};  // Tile-local area to redraw, empty when clean
+    Uint64 last_used = 0;
+};
+
+// LRU cache of rasterized tiles with a memory budget.
+// Tiles are keyed by exact zoom level and tile coordinates; every zoom level
+// seen recently keeps its own tiles, so returning to it is a cache hit.
+// Tiles used in the current frame are never evicted, so a frame may exceed
+// the budget when the viewport needs more tiles than fit.
+class TileCache
+{
+public:
+    static const int TILE_SIZE = 256;
+    static const size_t TILE_BYTES = (size_t)TILE_SIZE * TILE_SIZE * 4;
+
+    explicit TileCache(size_t budget_bytes = 32u << 20);
+
+    // Frees every tile. Must be called while the renderer that created the
+    // textures is still alive.
+    void clear();
+    void set_budget(size_t budget_bytes);
+    void begin_frame() { ++frame; }
+
+    // Returns the tile, creating or recycling one on a miss; new tiles are
+    // fully dirty. Textures come from renderer, or CPU framebuffers are used
+    // when it is null. Returns null if no texture could be created.
+    Tile *acquire(SDL_Renderer *renderer, float zoom, int tx, int ty);
+
+    // Marks the content under a world rect dirty in every zoom level
+    void invalidate(SDL_Rect world_rect) { invalidate(&world_rect, 1); }
+    // The same for many rects in one pass over the tiles, for bulk edits
+    void invalidate(const SDL_Rect *world_rects, int count);
+    void invalidate_all();
+
+    size_t size() const { return tiles.size(); }
+    size_t bytes() const { return tiles.size() * TILE_BYTES; }
+    Uint64 hits = 0;
+    Uint64 misses = 0;
+
+private:
+    struct Key {
+        Uint32 zoom_bits;
+        int tx, ty;
+        bool operator==(const Key &o) const { return zoom_bits == o.zoom_bits && tx == o.tx && ty == o.ty; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+
+    static Key key_of(float zoom, int tx, int ty);
+
+    size_t budget;
+    Uint64 frame = 0;
+    std::list<Tile> tiles; // Most recently used first
+    std::unordered_map<Key, std::list<Tile>::iterator, KeyHash> lookup;
+};
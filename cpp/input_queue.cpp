@@ -0,0 +1,44 @@
+#include "input_queue.h"
+
+#include <cstring>
+
+int key_code_from_name(const char *name)
+{
+    if (!name || !name[0]) return KEY_UNKNOWN;
+
+    // Single code point keys: decode one UTF-8 sequence
+    const unsigned char *s = (const unsigned char *)name;
+    int length = s[0] < 0x80 ? 1 : s[0] < 0xE0 ? 2 : s[0] < 0xF0 ? 3 : 4;
+    if ((int)std::strlen(name) == length) {
+        if (length == 1) return s[0];
+        int code = s[0] & (0x7F >> length);
+        for (int i = 1; i < length; ++i) code = (code << 6) | (s[i] & 0x3F);
+        return code;
+    }
+
+    static const struct { const char *name; int code; } named[] = {
+        {"Backspace", KEY_BACKSPACE},
+        {"Tab", KEY_TAB},
+        {"Enter", KEY_ENTER},
+        {"Escape", KEY_ESCAPE},
+        {"Delete", KEY_DELETE},
+        {"ArrowLeft", KEY_ARROW_LEFT},
+        {"ArrowRight", KEY_ARROW_RIGHT},
+        {"ArrowUp", KEY_ARROW_UP},
+        {"ArrowDown", KEY_ARROW_DOWN},
+        {"Home", KEY_HOME},
+        {"End", KEY_END},
+    };
+    for (const auto &entry : named) {
+        if (std::strcmp(name, entry.name) == 0) return entry.code;
+    }
+    return KEY_UNKNOWN;
+}
+
+bool InputQueue::push(const InputEvent &event)
+{
+    if (write_index - read_index >= CAPACITY) return false;
+    events[write_index & (CAPACITY - 1)] = event;
+    ++write_index;
+    return true;
+}
@@ -0,0 +1,147 @@
+#include "input_trace.h"
+#include "frame_stats.h"
+#include <cstring>
+
+const Uint16 InputTraceRecorder::VERSION;
+
+int trace_op_args(TraceOp op)
+{
+    static const int counts[TRACE_OP_COUNT] = {0, 0, 3, 2, 3, 2, 3, 2, 2, 6, 4, 2, 0, 0, 4, 0, 1};
+    return op < TRACE_OP_COUNT ? counts[op] : -1;
+}
+
+// Small negative numbers stay short: 0, -1, 1, -2, ... map to 0, 1, 2, 3, ...
+static Uint64 zigzag(int value)
+{
+    return ((Uint32)value << 1) ^ (Uint32)(value < 0 ? -1 : 0);
+}
+
+static int unzigzag(Uint64 value)
+{
+    Uint32 bits = (Uint32)value;
+    return (int)((bits >> 1) ^ (0u - (bits & 1)));
+}
+
+void InputTraceRecorder::start(const InputTraceHeader &header, const std::vector<Uint8> &scene,
+                               const ShapeId *selection, int selection_count)
+{
+    InputTraceHeader head = header;
+    std::memcpy(head.magic, "VMTR", 4);
+    head.version = VERSION;
+    head.header_bytes = sizeof(InputTraceHeader);
+    head.scene_bytes = (Uint32)scene.size();
+    head.selection_count = (Uint32)selection_count;
+
+    data.clear();
+    const Uint8 *bytes = (const Uint8 *)&head;
+    data.insert(data.end(), bytes, bytes + sizeof(head));
+    data.insert(data.end(), scene.begin(), scene.end());
+    bytes = (const Uint8 *)selection;
+    data.insert(data.end(), bytes, bytes + selection_count * sizeof(ShapeId));
+
+    active = true;
+    muted = false;
+    started = stat_clock();
+    last_us = 0;
+}
+
+void InputTraceRecorder::put_varint(Uint64 value)
+{
+    while (value >= 0x80) {
+        data.push_back((Uint8)(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back((Uint8)value);
+}
+
+void InputTraceRecorder::record(TraceOp op, int a, int b, int c, int d, int e, int f)
+{
+    if (!recording()) return;
+
+    Uint64 now_us = (stat_clock() - started) / 1000;
+    put_varint(now_us - last_us);
+    last_us = now_us;
+    data.push_back(op);
+
+    const int args[6] = {a, b, c, d, e, f};
+    for (int i = 0; i < trace_op_args(op); ++i) put_varint(zigzag(args[i]));
+}
+
+size_t InputTraceRecorder::stop(Uint64 checksum)
+{
+    if (!active) return data.size();
+
+    muted = false;
+    record(TRACE_END);
+    const Uint8 *bytes = (const Uint8 *)&checksum;
+    data.insert(data.end(), bytes, bytes + sizeof(checksum));
+    active = false;
+    return data.size();
+}
+
+bool InputTraceReader::open(const Uint8 *bytes, size_t bytes_size)
+{
+    data = bytes;
+    size = bytes_size;
+    time_us = 0;
+    done = false;
+    final_checksum = 0;
+
+    if (!bytes || size < sizeof(InputTraceHeader)) return false;
+    std::memcpy(&head, bytes, sizeof(head));
+    if (std::memcmp(head.magic, "VMTR", 4) != 0 || head.version != InputTraceRecorder::VERSION ||
+        head.header_bytes != sizeof(InputTraceHeader)) {
+        return false;
+    }
+
+    Uint64 body = (Uint64)sizeof(InputTraceHeader) + head.scene_bytes + (Uint64)head.selection_count * sizeof(ShapeId);
+    if (body > size) return false;
+    offset = (size_t)body;
+    return true;
+}
+
+ShapeId InputTraceReader::selected(int i) const
+{
+    ShapeId id;
+    std::memcpy(&id, scene() + head.scene_bytes + i * sizeof(ShapeId), sizeof(id));
+    return id;
+}
+
+bool InputTraceReader::get_varint(Uint64 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+        Uint8 byte = data[offset++];
+        value |= (Uint64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool InputTraceReader::next(TraceEvent &event)
+{
+    if (done) return false;
+
+    Uint64 delta;
+    if (!get_varint(delta) || offset >= size) return false;
+    time_us += delta;
+    event.time_us = time_us;
+    event.op = (TraceOp)data[offset++];
+
+    int count = trace_op_args(event.op);
+    if (count < 0) return false;
+    for (int i = 0; i < count; ++i) {
+        Uint64 value;
+        if (!get_varint(value)) return false;
+        event.args[i] = unzigzag(value);
+    }
+
+    if (event.op == TRACE_END) {
+        if (offset + sizeof(final_checksum) > size) return false;
+        std::memcpy(&final_checksum, data + offset, sizeof(final_checksum));
+        offset += sizeof(final_checksum);
+        done = true;
+        return false;
+    }
+    return true;
+}
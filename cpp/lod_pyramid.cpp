@@ -0,0 +1,244 @@
+#include "lod_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int LodPyramid::LEVELS;
+const int LodPyramid::FOOTPRINT_MARGIN;
+const int LodPyramid::BLOCK_CELLS;
+const int LodPyramid::FILL_SCALE;
+const int LodPyramid::ELLIPSE_FILL;
+const Uint16 LodPyramid::NO_CELL;
+
+static int floor_div(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+void LodPyramid::clear()
+{
+    for (Level &level : levels) {
+        level.slots.clear();
+        level.blocks.clear();
+        level.free_blocks.clear();
+        level.used = 0;
+        level.cells = 0;
+    }
+}
+
+int LodPyramid::level_for_zoom(float zoom)
+{
+    int level = 0;
+    while (level < LEVELS && (float)cell_size(level + 1) * zoom <= 1.0f) ++level;
+    return level;
+}
+
+size_t LodPyramid::home(Uint64 key, size_t mask)
+{
+    Uint64 h = key * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 32)) & mask;
+}
+
+void LodPyramid::add(SDL_Rect rect, SDL_Color color, bool ellipse, int node_half, int sign)
+{
+    if (!holds(node_half) || rect.w <= 0 || rect.h <= 0 || color.a == 0) return;
+    int fill = ellipse ? ELLIPSE_FILL : FILL_SCALE;
+
+    int first = 1;
+    while (cell_size(first) <= node_half) ++first;
+
+    for (int level = first; level <= LEVELS; ++level) {
+        int size = cell_size(level);
+        int cx0 = floor_div(rect.x, size), cx1 = floor_div(rect.x + rect.w - 1, size);
+        int cy0 = floor_div(rect.y, size), cy1 = floor_div(rect.y + rect.h - 1, size);
+
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            int top = std::max(rect.y, cy * size);
+            int bottom = std::min(rect.y + rect.h, (cy + 1) * size);
+            for (int cx = cx0; cx <= cx1; ++cx) {
+                int left = std::max(rect.x, cx * size);
+                int right = std::min(rect.x + rect.w, (cx + 1) * size);
+
+                Sint64 weight = (Sint64)(right - left) * (bottom - top) * fill * color.a * sign;
+                accumulate(levels[level - 1], cx, cy, weight, weight * color.r, weight * color.g, weight * color.b);
+            }
+        }
+    }
+}
+
+// Slot holding the key, or the empty slot where it would go
+size_t LodPyramid::find_slot(const Level &level, Uint64 key) const
+{
+    size_t mask = level.slots.size() - 1;
+    size_t slot = home(key, mask);
+    while (level.slots[slot].block != -1 && level.slots[slot].key != key) slot = (slot + 1) & mask;
+    return slot;
+}
+
+void LodPyramid::accumulate(Level &level, int cx, int cy, Sint64 weight, Sint64 red, Sint64 green, Sint64 blue)
+{
+    if (level.slots.empty() || (level.used + 1) * 2 > level.slots.size()) grow(level);
+
+    int bx = floor_div(cx, BLOCK_CELLS), by = floor_div(cy, BLOCK_CELLS);
+    Uint64 key = key_of(bx, by);
+    size_t slot = find_slot(level, key);
+
+    if (level.slots[slot].block == -1) {
+        if (weight <= 0) return; // Taking out a shape that was never added
+
+        int index;
+        if (!level.free_blocks.empty()) {
+            index = level.free_blocks.back();
+            level.free_blocks.pop_back();
+        } else {
+            index = (int)level.blocks.size();
+            level.blocks.emplace_back();
+        }
+        Block &block = level.blocks[index];
+        block.bx = bx;
+        block.by = by;
+        block.cells.clear();
+        std::fill(block.slot, block.slot + BLOCK_CELLS * BLOCK_CELLS, NO_CELL);
+
+        level.slots[slot] = {key, index};
+        ++level.used;
+    }
+
+    Block &block = level.blocks[level.slots[slot].block];
+    int x = cx - bx * BLOCK_CELLS, y = cy - by * BLOCK_CELLS;
+    Uint16 &position = block.slot[y * BLOCK_CELLS + x];
+    if (position == NO_CELL) {
+        if (weight <= 0) return;
+        position = (Uint16)block.cells.size();
+        block.cells.push_back({(Uint8)x, (Uint8)y, 0, 0, 0, 0});
+        ++level.cells;
+    }
+
+    Cell &cell = block.cells[position];
+    cell.weight += weight;
+    cell.red += red;
+    cell.green += green;
+    cell.blue += blue;
+    if (cell.weight != 0) return;
+
+    // Last shape gone from the cell: swap the last cell into its place
+    const Cell &last = block.cells.back();
+    block.slot[last.y * BLOCK_CELLS + last.x] = position;
+    cell = last;
+    block.cells.pop_back();
+    block.slot[y * BLOCK_CELLS + x] = NO_CELL;
+    --level.cells;
+
+    if (block.cells.empty()) {
+        level.free_blocks.push_back(level.slots[slot].block);
+        erase_slot(level, slot);
+    }
+}
+
+// Backward-shift deletion: later entries of the probe run move up into the
+// hole unless that would put them before their home slot
+void LodPyramid::erase_slot(Level &level, size_t slot)
+{
+    size_t mask = level.slots.size() - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; level.slots[next].block != -1; next = (next + 1) & mask) {
+        size_t want = home(level.slots[next].key, mask);
+        bool stays = hole <= next ? (want > hole && want <= next) : (want > hole || want <= next);
+        if (stays) continue;
+        level.slots[hole] = level.slots[next];
+        hole = next;
+    }
+    level.slots[hole] = {0, -1};
+    --level.used;
+}
+
+void LodPyramid::grow(Level &level)
+{
+    std::vector<Slot> old;
+    old.swap(level.slots);
+    level.slots.assign(std::max<size_t>(64, old.size() * 2), Slot{0, -1});
+
+    for (const Slot &entry : old) {
+        if (entry.block != -1) level.slots[find_slot(level, entry.key)] = entry;
+    }
+}
+
+const LodPyramid::Block *LodPyramid::find(int level, int bx, int by) const
+{
+    const Level &l = levels[level - 1];
+    if (l.used == 0) return nullptr;
+
+    const Slot &slot = l.slots[find_slot(l, key_of(bx, by))];
+    return slot.block == -1 ? nullptr : &l.blocks[slot.block];
+}
+
+size_t LodPyramid::cell_count() const
+{
+    size_t total = 0;
+    for (const Level &level : levels) total += level.cells;
+    return total;
+}
+
+void LodPyramid::resolve(int level, float zoom, int left, int top, int width, int rows, Sums *sums, Uint32 *colors) const
+{
+    double cell = (double)cell_size(level) * zoom;
+    // Area * alpha sums are in world units; a pixel is 1 / zoom^2 of them
+    double coverage_scale = (double)zoom * zoom / (255.0 * FILL_SCALE);
+    std::fill(sums, sums + (size_t)width * rows, Sums{0, 0, 0, 0});
+
+    int cy0 = (int)std::floor(top / cell) - 1;
+    int cy1 = (int)std::floor((top + rows) / cell);
+    int cx0 = (int)std::floor(left / cell) - 1;
+    int cx1 = (int)std::floor((left + width) / cell);
+
+    const int B = BLOCK_CELLS;
+    for (int by = floor_div(cy0, B); by <= floor_div(cy1, B); ++by) {
+        for (int bx = floor_div(cx0, B); bx <= floor_div(cx1, B); ++bx) {
+            const Block *block = find(level, bx, by);
+            if (!block) continue;
+
+            for (const Cell &c : block->cells) {
+                int cx = bx * B + c.x, cy = by * B + c.y;
+                if (cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1) continue;
+
+                double x = cx * cell, y = cy * cell;
+                int px = (int)std::floor(x), py = (int)std::floor(y);
+                // Share in column px and row py, the rest in px + 1 and py + 1
+                float share_x = (float)std::min(1.0, (px + 1 - x) / cell);
+                float share_y = (float)std::min(1.0, (py + 1 - y) / cell);
+                int col = px - left, row = py - top;
+
+                float weight = (float)c.weight, red = (float)c.red, green = (float)c.green, blue = (float)c.blue;
+                for (int dy = 0; dy < 2; ++dy) {
+                    int r = row + dy;
+                    float fy = dy ? 1 - share_y : share_y;
+                    if (r < 0 || r >= rows || fy <= 0) continue;
+                    for (int dx = 0; dx < 2; ++dx) {
+                        int k = col + dx;
+                        float f = (dx ? 1 - share_x : share_x) * fy;
+                        if (k < 0 || k >= width || f <= 0) continue;
+                        Sums &s = sums[(size_t)r * width + k];
+                        s.weight += weight * f;
+                        s.red += red * f;
+                        s.green += green * f;
+                        s.blue += blue * f;
+                    }
+                }
+            }
+        }
+    }
+
+    // 32 levels per channel, 0 and 255 included
+    auto quantize = [](double v) { return (Uint32)(((int)(v + 0.5) >> 3) * 255 / 31); };
+    for (size_t i = 0; i < (size_t)width * rows; ++i) {
+        const Sums &s = sums[i];
+        Uint32 color = 0;
+        if (s.weight > 0) {
+            Uint32 alpha = quantize(std::min(1.0, s.weight * coverage_scale) * 255);
+            if (alpha) {
+                color = (alpha << 24) | (quantize(s.red / s.weight) << 16) |
+                        (quantize(s.green / s.weight) << 8) | quantize(s.blue / s.weight);
+            }
+        }
+        colors[i] = color;
+    }
+}
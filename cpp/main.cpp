@@ -1,5 +1,7 @@
 #include <SDL2/SDL.h>
+#ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#endif
 #include <iostream>
 
 
@@ -11,7 +13,8 @@ Canvas *canvas = nullptr;
 extern "C"
 {
     void initialize_canvas(int width, int height);
-    void render();
+    void initialize_canvas_with_backend(int width, int height, int backend);
+    bool render();
     void on_mouse_down(int x, int y, int button);
     void on_mouse_move(int x, int y);
     void on_mouse_up(int x, int y, int button);
@@ -20,8 +23,37 @@ extern "C"
     void set_canvas_background(int r, int g, int b, int a);
     void set_grid_settings(bool show, int size);
     void set_grid_settings_with_color(bool show, int size, int r, int g, int b, int a);
+    void set_snapping(bool to_grid, bool to_shapes);
     void set_zoom_level(float zoom);
     void zoom_at_point(float zoom_factor, int x, int y); // <-- add this back
+    InputQueue *get_input_queue();
+    void drain_input();
+    int set_raster_threads(int threads);
+    bool undo();
+    bool redo();
+    void set_history_budget(int bytes);
+    bool set_selected_shape_color(int r, int g, int b, int a);
+    Uint8 *reserve_scene_buffer(int bytes);
+    bool load_scene(const Uint8 *data, int size);
+    int save_scene();
+    Uint8 *get_scene_buffer();
+    int import_svg(const char *data, int size);
+    int add_shapes(const int *rects, const Uint8 *colors, const Uint8 *types, int count);
+    int remove_shapes(int first_id, int count);
+    bool export_begin(int format, int x, int y, int w, int h, float scale);
+    int export_step();
+    Uint8 *export_chunk();
+    float export_progress();
+    void export_cancel();
+    FrameStats *get_frame_stats();
+    const SceneView *get_scene_view();
+    const SceneView *drain_changes();
+    void start_trace();
+    int stop_trace();
+    Uint8 *get_trace_buffer();
+    int delete_selection();
+    int restack_selection(int op);
+    int get_selection_count();
 }
 
 void initialize_canvas(int width, int height) {
@@ -32,8 +64,17 @@ void initialize_canvas(int width, int height) {
     canvas = new Canvas(width, height);
 }
 
-void render() {
-    if (canvas) canvas->render();
+void initialize_canvas_with_backend(int width, int height, int backend) {
+    if (canvas) {
+        canvas->cleanup();
+        delete canvas;
+    }
+    bool known = backend == RENDER_BACKEND_SOFTWARE || backend == RENDER_BACKEND_GEOMETRY;
+    canvas = new Canvas(width, height, known ? (RenderBackend)backend : RENDER_BACKEND_SDL);
+}
+
+bool render() {
+    return canvas ? canvas->render() : false;
 }
 
 void on_mouse_down(int x, int y, int button) {
@@ -71,6 +112,10 @@ void set_grid_settings_with_color(bool show, int size, int r, int g, int b, int
     if (canvas) canvas->set_grid_settings(show, size, r, g, b, a);
 }
 
+void set_snapping(bool to_grid, bool to_shapes) {
+    if (canvas) canvas->set_snapping(to_grid, to_shapes);
+}
+
 void set_zoom_level(float zoom) {
     if(canvas) canvas->set_zoom(zoom);
 }
@@ -78,3 +123,122 @@ void set_zoom_level(float zoom) {
 void zoom_at_point(float zoom_factor, int x, int y) {
     if(canvas) canvas->zoom_at_point(zoom_factor, x, y);
 }
+
+InputQueue *get_input_queue() {
+    return canvas ? &canvas->input_queue : nullptr;
+}
+
+void drain_input() {
+    if (canvas) canvas->drain_input();
+}
+
+int set_raster_threads(int threads) {
+    return canvas ? canvas->set_raster_threads(threads) : 0;
+}
+
+bool undo() {
+    return canvas ? canvas->undo() : false;
+}
+
+bool redo() {
+    return canvas ? canvas->redo() : false;
+}
+
+void set_history_budget(int bytes) {
+    if (canvas) canvas->history.set_budget(bytes > 0 ? (size_t)bytes : 0);
+}
+
+bool set_selected_shape_color(int r, int g, int b, int a) {
+    if (!canvas) return false;
+    return canvas->set_selection_color({(Uint8)r, (Uint8)g, (Uint8)b, (Uint8)a}) > 0;
+}
+
+Uint8 *reserve_scene_buffer(int bytes) {
+    if (!canvas || bytes < 0) return nullptr;
+    canvas->scene_buffer.resize((size_t)bytes);
+    return canvas->scene_buffer.data();
+}
+
+bool load_scene(const Uint8 *data, int size) {
+    return canvas && data && size > 0 ? canvas->load_scene(data, (size_t)size) : false;
+}
+
+int save_scene() {
+    return canvas ? (int)canvas->save_scene() : 0;
+}
+
+Uint8 *get_scene_buffer() {
+    return canvas ? canvas->scene_buffer.data() : nullptr;
+}
+
+int import_svg(const char *data, int size) {
+    return canvas && data && size > 0 ? canvas->import_svg(data, (size_t)size) : 0;
+}
+
+int add_shapes(const int *rects, const Uint8 *colors, const Uint8 *types, int count) {
+    if (!canvas || !rects || !colors || !types) return -1;
+    ShapeId first = canvas->add_shapes((const SDL_Rect *)rects, (const SDL_Color *)colors, types, count);
+    return first == INVALID_SHAPE_ID ? -1 : (int)first;
+}
+
+int remove_shapes(int first_id, int count) {
+    return canvas && first_id >= 0 ? canvas->remove_shapes((ShapeId)first_id, count) : 0;
+}
+
+bool export_begin(int format, int x, int y, int w, int h, float scale) {
+    if (!canvas || (format != EXPORT_PNG && format != EXPORT_SVG)) return false;
+    return canvas->export_begin((ExportFormat)format, {x, y, w, h}, scale);
+}
+
+int export_step() {
+    return canvas ? canvas->export_step() : -1;
+}
+
+Uint8 *export_chunk() {
+    return canvas && canvas->export_job ? canvas->export_job->chunk.data() : nullptr;
+}
+
+float export_progress() {
+    return canvas && canvas->export_job ? canvas->export_job->progress() : 1.0f;
+}
+
+void export_cancel() {
+    if (canvas) canvas->export_cancel();
+}
+
+FrameStats *get_frame_stats() {
+    return canvas ? &canvas->frame_stats : nullptr;
+}
+
+const SceneView *get_scene_view() {
+    return canvas ? &canvas->view_scene() : nullptr;
+}
+
+const SceneView *drain_changes() {
+    return canvas ? &canvas->drain_changes() : nullptr;
+}
+
+void start_trace() {
+    if (canvas) canvas->start_trace();
+}
+
+int stop_trace() {
+    return canvas ? (int)canvas->stop_trace() : 0;
+}
+
+Uint8 *get_trace_buffer() {
+    return canvas ? canvas->trace.data.data() : nullptr;
+}
+
+int delete_selection() {
+    return canvas ? canvas->delete_selection() : 0;
+}
+
+int restack_selection(int op) {
+    if (!canvas || op < STACK_TO_FRONT || op > STACK_TO_BACK) return 0;
+    return canvas->restack_selection((StackOp)op);
+}
+
+int get_selection_count() {
+    return canvas ? canvas->selection.size() : 0;
+}
@@ -0,0 +1,209 @@
+#include "raster.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void Framebuffer::resize(int new_width, int new_height)
+{
+    width = std::max(new_width, 0);
+    height = std::max(new_height, 0);
+    pixels.assign((size_t)width * height, 0);
+    clip = {0, 0, width, height};
+}
+
+// floor(x / 255) for x <= 65025, the same rounding as SDL's DRAW_MUL
+static inline Uint32 div255(Uint32 x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+// SDL premultiplies the source color once per fill: c * a / 255, alpha kept
+static inline Uint32 premultiply(SDL_Color c) {
+    return ((Uint32)c.a << 24) | ((Uint32)(c.r * c.a / 255) << 16) |
+           ((Uint32)(c.g * c.a / 255) << 8) | (Uint32)(c.b * c.a / 255);
+}
+
+// Two channels at a time in 16-bit lanes; div255 never carries across a lane
+// since a lane peaks at 65025 + 1 + 254
+static inline Uint32 blend_pixel(Uint32 dst, Uint32 src, Uint32 inva) {
+    Uint32 even = (dst & 0x00FF00FFu) * inva;
+    Uint32 odd = ((dst >> 8) & 0x00FF00FFu) * inva;
+    even = ((even + 0x00010001u + ((even >> 8) & 0x00FF00FFu)) >> 8) & 0x00FF00FFu;
+    odd = ((odd + 0x00010001u + ((odd >> 8) & 0x00FF00FFu)) >> 8) & 0x00FF00FFu;
+    return (even | (odd << 8)) + src;
+}
+
+// dst = dst * (255 - a) / 255 + src on every channel including alpha. The sum
+// never exceeds 255, so the SIMD paths can use plain 16-bit lanes.
+static void blend_span(Uint32 *p, int count, Uint32 src, Uint32 inva)
+{
+    int i = 0;
+
+#if defined(__wasm_simd128__)
+    const v128_t s = wasm_i32x4_splat((int)src);
+    const v128_t ia = wasm_i16x8_splat((short)inva);
+    const v128_t one = wasm_i16x8_splat(1);
+    for (; i + 4 <= count; i += 4) {
+        v128_t d = wasm_v128_load(p + i);
+        v128_t lo = wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(d), ia);
+        v128_t hi = wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(d), ia);
+        lo = wasm_u16x8_shr(wasm_i16x8_add(wasm_i16x8_add(lo, one), wasm_u16x8_shr(lo, 8)), 8);
+        hi = wasm_u16x8_shr(wasm_i16x8_add(wasm_i16x8_add(hi, one), wasm_u16x8_shr(hi, 8)), 8);
+        wasm_v128_store(p + i, wasm_u8x16_add_sat(wasm_u8x16_narrow_i16x8(lo, hi), s));
+    }
+#elif defined(__SSE2__)
+    const __m128i s = _mm_set1_epi32((int)src);
+    const __m128i ia = _mm_set1_epi16((short)inva);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia);
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)(p + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t s = vreinterpretq_u8_u32(vdupq_n_u32(src));
+    const uint8x8_t ia = vdup_n_u8((uint8_t)inva);
+    const uint16x8_t one = vdupq_n_u16(1);
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t d = vld1q_u8((const uint8_t *)(p + i));
+        uint16x8_t lo = vmull_u8(vget_low_u8(d), ia);
+        uint16x8_t hi = vmull_u8(vget_high_u8(d), ia);
+        lo = vshrq_n_u16(vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8)), 8);
+        hi = vshrq_n_u16(vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8)), 8);
+        vst1q_u8((uint8_t *)(p + i), vqaddq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), s));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        p[i] = blend_pixel(p[i], src, inva);
+    }
+}
+
+static bool clip_rect(const Framebuffer &fb, SDL_Rect rect, SDL_Rect &out)
+{
+    int x0 = std::max(rect.x, std::max(fb.clip.x, 0));
+    int y0 = std::max(rect.y, std::max(fb.clip.y, 0));
+    int x1 = std::min(rect.x + rect.w, std::min(fb.clip.x + fb.clip.w, fb.width));
+    int y1 = std::min(rect.y + rect.h, std::min(fb.clip.y + fb.clip.h, fb.height));
+    if (x1 <= x0 || y1 <= y0) return false;
+
+    out = {x0, y0, x1 - x0, y1 - y0};
+    return true;
+}
+
+void raster_fill_rect(Framebuffer &fb, SDL_Rect rect, SDL_Color color)
+{
+    SDL_Rect r;
+    if (!clip_rect(fb, rect, r)) return;
+
+    Uint32 value = raster_pack(color);
+    for (int y = r.y; y < r.y + r.h; ++y) {
+        Uint32 *row = fb.pixels.data() + (size_t)y * fb.width + r.x;
+        std::fill(row, row + r.w, value);
+    }
+}
+
+void raster_blend_rect(Framebuffer &fb, SDL_Rect rect, SDL_Color color)
+{
+    if (color.a == 255) {
+        raster_fill_rect(fb, rect, color);
+        return;
+    }
+    if (color.a == 0) return;
+
+    SDL_Rect r;
+    if (!clip_rect(fb, rect, r)) return;
+
+    Uint32 src = premultiply(color);
+    Uint32 inva = 255 - color.a;
+    for (int y = r.y; y < r.y + r.h; ++y) {
+        blend_span(fb.pixels.data() + (size_t)y * fb.width + r.x, r.w, src, inva);
+    }
+}
+
+void raster_blend_rects(Framebuffer &fb, const SDL_Rect *rects, int count, SDL_Color color)
+{
+    for (int i = 0; i < count; ++i) {
+        raster_blend_rect(fb, rects[i], color);
+    }
+}
+
+void raster_blend_ellipse(Framebuffer &fb, SDL_Rect box, SDL_Color color, EllipseCache &cache)
+{
+    SDL_Rect clip;
+    if (color.a == 0 || !clip_rect(fb, box, clip)) return;
+
+    // Source and inverse alpha of every coverage level, premultiplied once
+    Uint32 src[EllipseCache::LEVELS + 1], inva[EllipseCache::LEVELS + 1];
+    for (int level = 1; level <= EllipseCache::LEVELS; ++level) {
+        SDL_Color c = {color.r, color.g, color.b, EllipseCache::run_alpha(color, level)};
+        src[level] = c.a == 255 ? raster_pack(c) : premultiply(c);
+        inva[level] = 255 - c.a;
+    }
+
+    cache.for_each_run(box, clip, [&](SDL_Rect run, int level) {
+        Uint32 *p = fb.pixels.data() + (size_t)run.y * fb.width + run.x;
+        if (inva[level] == 0) {
+            std::fill(p, p + run.w, src[level]);
+        } else if (run.w == 1) {
+            *p = blend_pixel(*p, src[level], inva[level]);
+        } else {
+            blend_span(p, run.w, src[level], inva[level]);
+        }
+    });
+}
+
+void raster_copy(Framebuffer &fb, const Framebuffer &src, SDL_Rect src_rect, SDL_Point dst)
+{
+    // Clip the source to its own bounds, then the destination to the clip
+    SDL_Rect source_bounds = {0, 0, src.width, src.height};
+    SDL_Rect s;
+    if (!SDL_IntersectRect(&src_rect, &source_bounds, &s)) return;
+    dst.x += s.x - src_rect.x;
+    dst.y += s.y - src_rect.y;
+
+    SDL_Rect d;
+    if (!clip_rect(fb, {dst.x, dst.y, s.w, s.h}, d)) return;
+    s.x += d.x - dst.x;
+    s.y += d.y - dst.y;
+
+    for (int y = 0; y < d.h; ++y) {
+        const Uint32 *from = src.pixels.data() + (size_t)(s.y + y) * src.width + s.x;
+        std::copy(from, from + d.w, fb.pixels.data() + (size_t)(d.y + y) * fb.width + d.x);
+    }
+}
+
+void raster_blend_line(Framebuffer &fb, int x1, int y1, int x2, int y2, SDL_Color color)
+{
+    if (x1 == x2) {
+        raster_blend_rect(fb, {x1, std::min(y1, y2), 1, std::abs(y2 - y1) + 1}, color);
+        return;
+    }
+    if (y1 == y2) {
+        raster_blend_rect(fb, {std::min(x1, x2), y1, std::abs(x2 - x1) + 1, 1}, color);
+        return;
+    }
+
+    // Diagonal lines are not used by the canvas yet; plain Bresenham
+    int dx = std::abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+    int dy = -std::abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+    int err = dx + dy;
+    for (;;) {
+        raster_blend_rect(fb, {x1, y1, 1, 1}, color);
+        if (x1 == x2 && y1 == y2) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x1 += sx; }
+        if (e2 <= dx) { err += dx; y1 += sy; }
+    }
+}
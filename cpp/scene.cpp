@@ -0,0 +1,263 @@
+#include "scene.h"
+
+#include <algorithm>
+
+const Uint32 Scene::NO_INDEX;
+const Uint64 Scene::Z_SPACING;
+
+ShapeId Scene::add(const Shape &shape)
+{
+    // The newest freed slot below the free tail, keeping the tail whole for
+    // claim_ids; entries for slots taken since or now in the tail are dropped
+    while (!free_slots.empty() && (free_slots.back() >= used_end || sparse[free_slots.back()] != NO_INDEX)) {
+        free_slots.pop_back();
+    }
+
+    Uint32 slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        if (used_end == SHAPE_SLOT_COUNT) return INVALID_SHAPE_ID;
+        slot = used_end++;
+        if (slot == sparse.size()) {
+            sparse.push_back(NO_INDEX);
+            generations.push_back(0);
+        }
+    }
+
+    ShapeId id = issue(slot, generations[slot]);
+    append(id, shape, z_counter);
+    return id;
+}
+
+ShapeId Scene::claim_ids(int count)
+{
+    if (count <= 0) return INVALID_SHAPE_ID;
+
+    // A run of free slots below the tail, looked for from where the last
+    // search left off. The search gives up after a scan a few times the run's
+    // length, so it costs about as much as adding the shapes; the run then
+    // starts at the free tail.
+    Uint32 start = used_end;
+    if (used_end - (Uint32)size() >= (Uint32)count) {
+        Uint32 run = 0;
+        Uint64 limit = std::min<Uint64>(4 * (Uint64)count + 256, used_end);
+        for (Uint64 scanned = 0; scanned < limit; ++scanned) {
+            if (run_cursor >= used_end) {
+                run_cursor = 0;
+                run = 0;
+            }
+            if (sparse[run_cursor++] != NO_INDEX) run = 0;
+            else if (++run == (Uint32)count) {
+                start = run_cursor - run;
+                break;
+            }
+        }
+    }
+    if ((size_t)start + count > SHAPE_SLOT_COUNT) return INVALID_SHAPE_ID;
+    used_end = std::max(used_end, start + count);
+    if (used_end > sparse.size()) {
+        sparse.resize(used_end, NO_INDEX);
+        generations.resize(used_end, 0);
+    }
+
+    // One generation for the whole run keeps the ids consecutive
+    Uint32 generation = 0;
+    for (Uint32 slot = start; slot < start + count; ++slot) generation = std::max<Uint32>(generation, generations[slot]);
+    for (Uint32 slot = start; slot < start + count; ++slot) issue(slot, generation);
+    return generation << SHAPE_SLOT_BITS | start;
+}
+
+void Scene::add(const Shape &shape, ShapeId id)
+{
+    append(id, shape, z_counter);
+}
+
+bool Scene::restore(ShapeId id, const Shape &shape, Uint64 shape_z)
+{
+    // The generation table is left alone: it already hands out ids past this one
+    Uint32 slot = shape_slot(id);
+    if (slot >= sparse.size() || sparse[slot] != NO_INDEX) return false;
+
+    // A slot in the free tail splits it; the part below goes on the free list
+    for (; used_end <= slot; ++used_end) {
+        if (used_end != slot) free_slots.push_back(used_end);
+    }
+    append(id, shape, shape_z);
+    return true;
+}
+
+void Scene::append(ShapeId id, const Shape &shape, Uint64 shape_z)
+{
+    sparse[shape_slot(id)] = sparse_entry(id, size());
+
+    x.push_back(shape.rect.x);
+    y.push_back(shape.rect.y);
+    w.push_back(shape.rect.w);
+    h.push_back(shape.rect.h);
+    color.push_back(shape.color);
+    type.push_back((Uint8)shape.type);
+    flags.push_back(0);
+    z.push_back(shape_z);
+    ids.push_back(id);
+    if (shape_z >= z_counter) z_counter = shape_z + Z_SPACING;
+}
+
+ShapeId Scene::issue(Uint32 slot, Uint32 generation)
+{
+    generations[slot] = (Uint8)((generation + 1) & SHAPE_GENERATION_MASK);
+    return generation << SHAPE_SLOT_BITS | slot;
+}
+
+// Every free slot below the tail, lowest on top
+void Scene::collect_free_slots()
+{
+    free_slots.clear();
+    for (Uint32 slot = used_end; slot-- > 0;) {
+        if (sparse[slot] == NO_INDEX) free_slots.push_back(slot);
+    }
+}
+
+bool Scene::remove(ShapeId id)
+{
+    int index = index_of(id);
+    if (index == -1) return false;
+
+    // Swap the last shape into the hole so every column stays packed
+    int last = size() - 1;
+    if (index != last) {
+        x[index] = x[last];
+        y[index] = y[last];
+        w[index] = w[last];
+        h[index] = h[last];
+        color[index] = color[last];
+        type[index] = type[last];
+        flags[index] = flags[last];
+        z[index] = z[last];
+        ids[index] = ids[last];
+        sparse[shape_slot(ids[index])] = sparse_entry(ids[index], index);
+    }
+
+    x.pop_back();
+    y.pop_back();
+    w.pop_back();
+    h.pop_back();
+    color.pop_back();
+    type.pop_back();
+    flags.pop_back();
+    z.pop_back();
+    ids.pop_back();
+
+    Uint32 slot = shape_slot(id);
+    sparse[slot] = NO_INDEX;
+    if (slot + 1 == used_end) {
+        while (used_end > 0 && sparse[used_end - 1] == NO_INDEX) --used_end;
+    } else {
+        free_slots.push_back(slot);
+        if (free_slots.size() > used_end) collect_free_slots();
+    }
+    return true;
+}
+
+void Scene::clear()
+{
+    // The generations are kept, so ids handed out later still differ from
+    // the ones of the shapes cleared here
+    for (ShapeId id : ids) sparse[shape_slot(id)] = NO_INDEX;
+    used_end = 0;
+
+    x.clear();
+    y.clear();
+    w.clear();
+    h.clear();
+    color.clear();
+    type.clear();
+    flags.clear();
+    z.clear();
+    ids.clear();
+    collect_free_slots();
+}
+
+void Scene::reserve(int count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    w.reserve(count);
+    h.reserve(count);
+    color.reserve(count);
+    type.reserve(count);
+    flags.reserve(count);
+    z.reserve(count);
+    ids.reserve(count);
+}
+
+void Scene::resize(int count)
+{
+    x.resize(count);
+    y.resize(count);
+    w.resize(count);
+    h.resize(count);
+    color.resize(count);
+    type.resize(count);
+    flags.assign(count, 0);
+    z.resize(count);
+    ids.resize(count);
+}
+
+bool Scene::reindex(Uint32 slot_count, Uint64 z_count)
+{
+    sparse.assign(slot_count, NO_INDEX);
+    generations.assign(slot_count, 0);
+    z_counter = z_count;
+
+    for (int i = 0; i < size(); ++i) {
+        ShapeId id = ids[i];
+        Uint32 slot = shape_slot(id);
+        if (shape_generation(id) > SHAPE_GENERATION_MASK || slot >= slot_count || sparse[slot] != NO_INDEX) {
+            resize(0);
+            sparse.clear();
+            generations.clear();
+            free_slots.clear();
+            used_end = 0;
+            z_counter = 0;
+            return false;
+        }
+        sparse[slot] = sparse_entry(id, i);
+        generations[slot] = (Uint8)((shape_generation(id) + 1) & SHAPE_GENERATION_MASK);
+        z_counter = std::max(z_counter, z[i] + Z_SPACING);
+    }
+    used_end = slot_count;
+    while (used_end > 0 && sparse[used_end - 1] == NO_INDEX) --used_end;
+    collect_free_slots();
+    return true;
+}
+
+void Scene::set_z(int index, Uint64 shape_z)
+{
+    z[index] = shape_z;
+    if (shape_z >= z_counter) z_counter = shape_z + Z_SPACING;
+}
+
+void Scene::set_rect(int index, SDL_Rect r)
+{
+    x[index] = r.x;
+    y[index] = r.y;
+    w[index] = r.w;
+    h[index] = r.h;
+}
+
+Shape Scene::get(int index) const
+{
+    return {(ShapeType)type[index], rect(index), color[index]};
+}
+
+void Scene::translate(const int *indices, int count, int dx, int dy)
+{
+    int *xs = x.data();
+    int *ys = y.data();
+    for (int i = 0; i < count; ++i) {
+        xs[indices[i]] += dx;
+        ys[indices[i]] += dy;
+    }
+}
@@ -0,0 +1,363 @@
+#include "scene_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define SCENE_FILE_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define SCENE_FILE_HAS_MMAP 0
+#endif
+
+static const char MAGIC[4] = {'V', 'M', 'S', 'C'};
+
+const Uint16 SceneFile::VERSION;
+const Uint32 SceneFile::CHUNK_SHAPES;
+
+// z, x, y, w, h, color, id, type; padded so the next chunk stays 8-aligned
+static Uint64 chunk_bytes(Uint32 count)
+{
+    return ((Uint64)count * 33 + 7) / 8 * 8;
+}
+
+static Uint64 hash_bytes(const void *data, size_t bytes, Uint64 h)
+{
+    const Uint64 PRIME = 0x9E3779B97F4A7C15ull;
+    const Uint8 *p = (const Uint8 *)data;
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        Uint64 v;
+        std::memcpy(&v, p + i, 8);
+        h = (h ^ v) * PRIME;
+        h ^= h >> 29;
+    }
+    for (; i < bytes; ++i) {
+        h = (h ^ p[i]) * PRIME;
+    }
+    return h;
+}
+
+// Hashes the scene columns directly, so checking an unchanged chunk costs
+// one pass over its memory and no serialization
+static Uint64 chunk_hash(const Scene &scene, Uint32 base, Uint32 count)
+{
+    Uint64 h = hash_bytes(&count, sizeof(count), 0);
+    h = hash_bytes(scene.z.data() + base, count * sizeof(Uint64), h);
+    h = hash_bytes(scene.x.data() + base, count * sizeof(int), h);
+    h = hash_bytes(scene.y.data() + base, count * sizeof(int), h);
+    h = hash_bytes(scene.w.data() + base, count * sizeof(int), h);
+    h = hash_bytes(scene.h.data() + base, count * sizeof(int), h);
+    h = hash_bytes(scene.color.data() + base, count * sizeof(SDL_Color), h);
+    h = hash_bytes(scene.ids.data() + base, count * sizeof(ShapeId), h);
+    return hash_bytes(scene.type.data() + base, count, h);
+}
+
+Uint64 SceneFile::checksum(const Scene &scene)
+{
+    Uint32 count = (Uint32)scene.size();
+    Uint64 h = chunk_hash(scene, 0, count);
+    return hash_bytes(scene.flags.data(), count, h);
+}
+
+struct SceneFile::Source {
+    Uint64 size = 0;
+    virtual ~Source() {}
+    virtual bool read(Uint64 offset, void *dst, size_t bytes) = 0;
+};
+
+struct SceneFile::Sink {
+    virtual ~Sink() {}
+    virtual bool write(Uint64 offset, const void *src, size_t bytes) = 0;
+};
+
+namespace {
+
+struct MemorySource : SceneFile::Source {
+    const Uint8 *data;
+
+    MemorySource(const Uint8 *d, size_t s) : data(d) { size = s; }
+
+    bool read(Uint64 offset, void *dst, size_t bytes) override {
+        if (offset > size || bytes > size - offset) return false;
+        std::memcpy(dst, data + offset, bytes);
+        return true;
+    }
+};
+
+struct FileSource : SceneFile::Source {
+    FILE *file;
+
+    explicit FileSource(FILE *f) : file(f) {
+        if (std::fseek(file, 0, SEEK_END) == 0) {
+            long end = std::ftell(file);
+            size = end > 0 ? (Uint64)end : 0;
+        }
+    }
+
+    bool read(Uint64 offset, void *dst, size_t bytes) override {
+        if (offset > size || bytes > size - offset) return false;
+        if (std::fseek(file, (long)offset, SEEK_SET) != 0) return false;
+        return std::fread(dst, 1, bytes, file) == bytes;
+    }
+};
+
+struct MemorySink : SceneFile::Sink {
+    std::vector<Uint8> &buffer;
+
+    explicit MemorySink(std::vector<Uint8> &b) : buffer(b) {}
+
+    bool write(Uint64 offset, const void *src, size_t bytes) override {
+        if (buffer.size() < offset + bytes) buffer.resize(offset + bytes);
+        std::memcpy(buffer.data() + offset, src, bytes);
+        return true;
+    }
+};
+
+struct FileSink : SceneFile::Sink {
+    FILE *file;
+
+    explicit FileSink(FILE *f) : file(f) {}
+
+    bool write(Uint64 offset, const void *src, size_t bytes) override {
+        if (std::fseek(file, (long)offset, SEEK_SET) != 0) return false;
+        return std::fwrite(src, 1, bytes, file) == bytes;
+    }
+};
+
+} // namespace
+
+void SceneFile::reset()
+{
+    chunks.clear();
+    file_end = 0;
+    live_bytes = 0;
+    target.clear();
+    valid = false;
+}
+
+bool SceneFile::read(Scene &scene, Source &source)
+{
+    reset();
+
+    auto fail = [&scene]() {
+        scene.resize(0);
+        scene.reindex(0, 0);
+        return false;
+    };
+
+    SceneFileHeader header;
+    if (!source.read(0, &header, sizeof(header))) return fail();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) return fail();
+    if (header.version == 0 || header.version > VERSION) return fail();
+    if (header.header_bytes < sizeof(header) || header.chunk_shapes == 0) return fail();
+
+    Uint64 index_bytes = (Uint64)header.chunk_count * sizeof(SceneChunkEntry);
+    if (header.index_offset > source.size || index_bytes > source.size - header.index_offset) return fail();
+
+    std::vector<SceneChunkEntry> index(header.chunk_count);
+    if (!source.read(header.index_offset, index.data(), (size_t)index_bytes)) return fail();
+
+    Uint64 total = 0;
+    for (const SceneChunkEntry &entry : index) {
+        if (entry.count > header.chunk_shapes || entry.bytes < chunk_bytes(entry.count)) return fail();
+        if (entry.offset > source.size || entry.bytes > source.size - entry.offset) return fail();
+        total += entry.count;
+    }
+    if (total != header.shape_count || total > 0x7FFFFFFF) return fail();
+
+    scene.resize((int)total);
+
+    Uint32 base = 0;
+    for (const SceneChunkEntry &entry : index) {
+        Uint32 n = entry.count;
+        Uint64 at = entry.offset;
+        bool ok = source.read(at, scene.z.data() + base, n * sizeof(Uint64)) &&
+                  source.read(at + n * 8, scene.x.data() + base, n * sizeof(int)) &&
+                  source.read(at + n * 12, scene.y.data() + base, n * sizeof(int)) &&
+                  source.read(at + n * 16, scene.w.data() + base, n * sizeof(int)) &&
+                  source.read(at + n * 20, scene.h.data() + base, n * sizeof(int)) &&
+                  source.read(at + n * 24, scene.color.data() + base, n * sizeof(SDL_Color)) &&
+                  source.read(at + n * 28, scene.ids.data() + base, n * sizeof(ShapeId)) &&
+                  source.read(at + n * 32, scene.type.data() + base, n);
+        if (!ok) return fail();
+        base += n;
+    }
+
+    // The same shapes add_shapes would accept
+    for (int i = 0; i < scene.size(); ++i) {
+        if (scene.type[i] > CIRCLE || scene.w[i] < 0 || scene.h[i] < 0) return fail();
+    }
+
+    // Slots past the largest live one belonged to deleted shapes, which
+    // nothing refers to after a load. Sizing the id tables to the live slots
+    // also keeps a corrupt header from allocating huge ones.
+    Uint32 slot_count = 0;
+    for (ShapeId id : scene.ids) slot_count = std::max(slot_count, shape_slot(id) + 1);
+    if (header.id_count < slot_count) return fail();
+    if (!scene.reindex(slot_count, header.z_count)) return fail();
+
+    // Files written with another chunk size load fine, but their chunks do
+    // not line up with ours, so the next save rewrites everything
+    if (header.chunk_shapes == CHUNK_SHAPES) {
+        chunks = index;
+        file_end = header.index_offset + index_bytes;
+        live_bytes = sizeof(header) + index_bytes;
+        for (const SceneChunkEntry &entry : index) live_bytes += entry.bytes;
+        valid = true;
+    }
+    return true;
+}
+
+bool SceneFile::can_append() const
+{
+    // Rewrite once superseded chunks and indexes take up half the document
+    return valid && file_end <= live_bytes * 2;
+}
+
+bool SceneFile::write(const Scene &scene, Sink &sink, bool incremental)
+{
+    Uint32 count = (Uint32)scene.size();
+    Uint32 chunk_count = (count + CHUNK_SHAPES - 1) / CHUNK_SHAPES;
+
+    std::vector<SceneChunkEntry> next(chunk_count);
+    Uint64 end = incremental ? file_end : sizeof(SceneFileHeader);
+    Uint64 live = sizeof(SceneFileHeader);
+    static const Uint8 zeros[8] = {0};
+    chunks_written = 0;
+
+    for (Uint32 k = 0; k < chunk_count; ++k) {
+        Uint32 base = k * CHUNK_SHAPES;
+        Uint32 n = std::min(CHUNK_SHAPES, count - base);
+        Uint64 hash = chunk_hash(scene, base, n);
+        Uint32 bytes = (Uint32)chunk_bytes(n);
+        live += bytes;
+
+        if (incremental && k < chunks.size() && chunks[k].count == n && chunks[k].hash == hash) {
+            next[k] = chunks[k];
+            continue;
+        }
+
+        bool ok = sink.write(end, scene.z.data() + base, n * sizeof(Uint64)) &&
+                  sink.write(end + n * 8, scene.x.data() + base, n * sizeof(int)) &&
+                  sink.write(end + n * 12, scene.y.data() + base, n * sizeof(int)) &&
+                  sink.write(end + n * 16, scene.w.data() + base, n * sizeof(int)) &&
+                  sink.write(end + n * 20, scene.h.data() + base, n * sizeof(int)) &&
+                  sink.write(end + n * 24, scene.color.data() + base, n * sizeof(SDL_Color)) &&
+                  sink.write(end + n * 28, scene.ids.data() + base, n * sizeof(ShapeId)) &&
+                  sink.write(end + n * 32, scene.type.data() + base, n) &&
+                  sink.write(end + n * 33, zeros, bytes - n * 33);
+        if (!ok) return false;
+
+        next[k] = {end, hash, n, bytes};
+        end += bytes;
+        ++chunks_written;
+    }
+
+    // With no chunk rewritten the previous index still describes the scene
+    Uint64 index_bytes = (Uint64)chunk_count * sizeof(SceneChunkEntry);
+    bool same_index = incremental && chunks_written == 0 && chunk_count == chunks.size();
+    if (same_index) {
+        end -= index_bytes;
+    } else if (!sink.write(end, next.data(), (size_t)index_bytes)) {
+        return false;
+    }
+
+    SceneFileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.header_bytes = sizeof(SceneFileHeader);
+    header.chunk_shapes = CHUNK_SHAPES;
+    header.chunk_count = chunk_count;
+    header.shape_count = count;
+    header.id_count = scene.slot_count();
+    header.z_count = scene.next_z();
+    header.index_offset = end;
+    if (!sink.write(0, &header, sizeof(header))) return false;
+
+    chunks.swap(next);
+    file_end = end + index_bytes;
+    live_bytes = live + index_bytes;
+    valid = true;
+    return true;
+}
+
+bool SceneFile::load(Scene &scene, const Uint8 *data, size_t size)
+{
+    MemorySource source(data, size);
+    return read(scene, source);
+}
+
+size_t SceneFile::save(const Scene &scene, std::vector<Uint8> &buffer)
+{
+    bool incremental = can_append() && target.empty() && buffer.size() == file_end;
+    if (!incremental) buffer.clear();
+
+    MemorySink sink(buffer);
+    write(scene, sink, incremental);
+    buffer.resize(file_end);
+    target.clear();
+    return buffer.size();
+}
+
+bool SceneFile::load_file(Scene &scene, const char *path)
+{
+    bool ok = false;
+
+#if SCENE_FILE_HAS_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, (size_t)info.st_size, MADV_SEQUENTIAL);
+            ok = load(scene, (const Uint8 *)mapped, (size_t)info.st_size);
+            munmap(mapped, (size_t)info.st_size);
+        }
+    }
+    close(fd);
+#else
+    FILE *file = std::fopen(path, "rb");
+    if (!file) return false;
+    FileSource source(file);
+    ok = read(scene, source);
+    std::fclose(file);
+#endif
+
+    if (ok) target = path;
+    return ok;
+}
+
+bool SceneFile::save_file(const Scene &scene, const char *path)
+{
+    // Only append if the file is still the one we last wrote
+    bool incremental = can_append() && target == path;
+    if (incremental) {
+        FILE *current = std::fopen(path, "rb");
+        incremental = current && FileSource(current).size == file_end;
+        if (current) std::fclose(current);
+    }
+
+    FILE *file = std::fopen(path, incremental ? "r+b" : "wb");
+    if (!file) {
+        reset();
+        return false;
+    }
+
+    FileSink sink(file);
+    bool ok = write(scene, sink, incremental);
+    ok = std::fclose(file) == 0 && ok;
+
+    if (ok) {
+        target = path;
+    } else {
+        reset();
+    }
+    return ok;
+}
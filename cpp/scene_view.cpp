@@ -0,0 +1,71 @@
+#include "scene_view.h"
+
+const int ChangeJournal::CAPACITY;
+const Uint32 ChangeJournal::NOT_LISTED;
+
+ChangeJournal::ChangeJournal()
+{
+    pending.reserve(CAPACITY);
+    drained.reserve(CAPACITY);
+}
+
+void ChangeJournal::note(ShapeId id, Uint32 kinds)
+{
+    if (whole_scene) return; // The reader re-reads everything anyway
+
+    // Only new slots grow the table, and those come from edits that allocate
+    Uint32 slot = shape_slot(id);
+    if (slot >= listed_by_slot.size()) listed_by_slot.resize(slot + 1, NOT_LISTED);
+    Uint32 &listed = listed_by_slot[slot];
+    if (listed == NOT_LISTED || pending[listed].id != id) {
+        if (pending.size() == (size_t)CAPACITY) {
+            whole_scene = true;
+            return;
+        }
+        listed = (Uint32)pending.size();
+        pending.push_back({id, 0});
+    }
+    pending[listed].kinds |= kinds;
+}
+
+void ChangeJournal::reset(Uint32 slot_count)
+{
+    // Nothing pending needs listing now, so the table can start over at
+    // the new scene's size
+    whole_scene = true;
+    pending.clear();
+    listed_by_slot.assign(slot_count, NOT_LISTED);
+}
+
+int ChangeJournal::drain()
+{
+    drained.clear();
+    for (const ChangeRecord &record : pending) {
+        if (!whole_scene) drained.push_back(record);
+        listed_by_slot[shape_slot(record.id)] = NOT_LISTED;
+    }
+    pending.clear();
+    reset_drained = whole_scene;
+    whole_scene = false;
+    return (int)drained.size();
+}
+
+template <typename T>
+static SceneView::Column column(const std::vector<T> &values)
+{
+    return {values.data(), (Uint32)values.size(), (Uint32)sizeof(T)};
+}
+
+void SceneView::refresh(const Scene &scene)
+{
+    shape_count = (Uint32)scene.size();
+    columns[COLUMN_X] = column(scene.x);
+    columns[COLUMN_Y] = column(scene.y);
+    columns[COLUMN_W] = column(scene.w);
+    columns[COLUMN_H] = column(scene.h);
+    columns[COLUMN_COLOR] = column(scene.color);
+    columns[COLUMN_TYPE] = column(scene.type);
+    columns[COLUMN_FLAGS] = column(scene.flags);
+    columns[COLUMN_Z] = column(scene.z);
+    columns[COLUMN_ID] = column(scene.ids);
+}
@@ -0,0 +1,23 @@
+#include "selection.h"
+
+bool SelectionSet::insert(ShapeId id)
+{
+    if (id == INVALID_SHAPE_ID || contains(id)) return false;
+    if (shape_slot(id) >= position.size()) position.resize((size_t)shape_slot(id) + 1, 0);
+
+    position[shape_slot(id)] = (Uint32)dense.size();
+    dense.push_back(id);
+    return true;
+}
+
+bool SelectionSet::erase(ShapeId id)
+{
+    if (!contains(id)) return false;
+
+    // Move the last id into the hole so the ids stay packed
+    ShapeId last = dense.back();
+    dense[position[shape_slot(id)]] = last;
+    position[shape_slot(last)] = position[shape_slot(id)];
+    dense.pop_back();
+    return true;
+}
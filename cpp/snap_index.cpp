@@ -0,0 +1,71 @@
+#include "snap_index.h"
+
+#include <algorithm>
+
+void SnapIndex::clear()
+{
+    for (Sorted &sorted : axes) sorted.clear();
+}
+
+void SnapIndex::features(SDL_Rect rect, Axis axis, int out[3])
+{
+    int start = axis == AXIS_X ? rect.x : rect.y;
+    int size = axis == AXIS_X ? rect.w : rect.h;
+    out[0] = start;
+    out[1] = start + size / 2;
+    out[2] = start + size;
+}
+
+void SnapIndex::build(const Scene &scene)
+{
+    size_t total = (size_t)scene.size() * 3;
+    std::vector<Entry> all(total), sorted_all(total);
+    for (int axis = AXIS_X; axis <= AXIS_Y; ++axis) {
+        // Gathered in slot order, so the stable sort by value below leaves
+        // equal values ordered by slot
+        size_t n = 0;
+        for (Uint32 slot = 0; slot < scene.slot_count(); ++slot) {
+            ShapeId id = scene.id_in_slot(slot);
+            if (id == INVALID_SHAPE_ID) continue;
+            int values[3];
+            features(scene.rect(scene.index_of(id)), (Axis)axis, values);
+            for (int value : values) all[n++] = {value, id};
+        }
+
+        // LSD radix sort on the value with its sign bit flipped, 11 bits a pass
+        for (int shift = 0; shift < 32; shift += 11) {
+            size_t offsets[2049] = {};
+            for (const Entry &entry : all) ++offsets[((((Uint32)entry.value ^ 0x80000000u) >> shift) & 2047) + 1];
+            for (int digit = 0; digit < 2048; ++digit) offsets[digit + 1] += offsets[digit];
+            for (const Entry &entry : all) sorted_all[offsets[(((Uint32)entry.value ^ 0x80000000u) >> shift) & 2047]++] = entry;
+            all.swap(sorted_all);
+        }
+
+        // Equal values whose slots were reused are out of id order
+        for (size_t begin = 0, end; begin < total; begin = end) {
+            for (end = begin + 1; end < total && all[end].value == all[begin].value; ++end) {}
+            if (end - begin > 1 && !std::is_sorted(all.begin() + begin, all.begin() + end, Less())) {
+                std::sort(all.begin() + begin, all.begin() + end, Less());
+            }
+        }
+        axes[axis].assign(all.data(), total);
+    }
+}
+
+void SnapIndex::insert(ShapeId id, SDL_Rect rect)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Y; ++axis) {
+        int values[3];
+        features(rect, (Axis)axis, values);
+        for (int value : values) axes[axis].insert({value, id});
+    }
+}
+
+void SnapIndex::remove(ShapeId id, SDL_Rect rect)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Y; ++axis) {
+        int values[3];
+        features(rect, (Axis)axis, values);
+        for (int value : values) axes[axis].erase({value, id});
+    }
+}
@@ -0,0 +1,244 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+
+// Same inclusive edges as is_point_in_rect in canvas.cpp
+static inline bool point_in_rect(SDL_Point p, const SDL_Rect &r) {
+    return p.x >= r.x && p.x <= r.x + r.w && p.y >= r.y && p.y <= r.y + r.h;
+}
+
+// Closed ellipse inscribed in the rect; a degenerate one is its axis
+static inline bool point_in_ellipse(SDL_Point p, const SDL_Rect &r) {
+    if (!point_in_rect(p, r)) return false;
+    if (r.w == 0 || r.h == 0) return true;
+
+    // Doubled so the center lands on an integer
+    double dx = 2.0 * (p.x - r.x) - r.w, dy = 2.0 * (p.y - r.y) - r.h;
+    return dx * dx / ((double)r.w * r.w) + dy * dy / ((double)r.h * r.h) <= 1.0;
+}
+
+static inline bool rects_touch(const SDL_Rect &a, const SDL_Rect &b) {
+    return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+SpatialIndex::SpatialIndex(int world_half_extent)
+    : root_half(std::max(world_half_extent, 1))
+{
+    clear();
+}
+
+void SpatialIndex::clear()
+{
+    nodes.clear();
+    free_nodes.clear();
+    items.clear();
+    item_count = 0;
+
+    Node root;
+    root.cx = 0;
+    root.cy = 0;
+    root.half = root_half;
+    nodes.push_back(root);
+}
+
+bool SpatialIndex::contains(int id) const
+{
+    return id >= 0 && shape_slot(id) < items.size() && items[shape_slot(id)].node != -1 && items[shape_slot(id)].id == id;
+}
+
+bool SpatialIndex::fits_node(SDL_Rect rect, int node) const
+{
+    if (node == 0) return true; // The root catches everything, even out-of-world rects
+
+    const Node &n = nodes[node];
+    int loose = n.half * 2;
+    return rect.x >= n.cx - loose && rect.x + rect.w <= n.cx + loose &&
+           rect.y >= n.cy - loose && rect.y + rect.h <= n.cy + loose;
+}
+
+int SpatialIndex::child_for(int node, int x, int y)
+{
+    int quadrant = (x >= nodes[node].cx ? 1 : 0) | (y >= nodes[node].cy ? 2 : 0);
+    int child = nodes[node].children[quadrant];
+    if (child != -1) return child;
+
+    // A pruned node keeps its item storage for the next cell it becomes
+    if (!free_nodes.empty()) {
+        child = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        child = (int)nodes.size();
+        nodes.emplace_back(); // may reallocate, so index nodes again below
+    }
+
+    Node &c = nodes[child];
+    c.half = nodes[node].half / 2;
+    c.cx = nodes[node].cx + ((quadrant & 1) ? c.half : -c.half);
+    c.cy = nodes[node].cy + ((quadrant & 2) ? c.half : -c.half);
+    c.parent = node;
+    nodes[node].children[quadrant] = child;
+    return child;
+}
+
+// Deepest node whose tight cell holds the rect center and whose loose bounds
+// still hold the whole rect.
+int SpatialIndex::find_node(SDL_Rect rect)
+{
+    int center_x = rect.x + rect.w / 2;
+    int center_y = rect.y + rect.h / 2;
+    int extent = (std::max(rect.w, rect.h) + 1) / 2;
+
+    if (center_x < -root_half || center_x >= root_half || center_y < -root_half || center_y >= root_half) {
+        return 0;
+    }
+
+    int node = 0;
+    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+        int child_half = nodes[node].half / 2;
+        if (child_half < 1 || child_half < extent) break;
+        node = child_for(node, center_x, center_y);
+    }
+    return node;
+}
+
+void SpatialIndex::link(int id, int node)
+{
+    Item &item = items[shape_slot(id)];
+    item.node = node;
+    item.position = (int)nodes[node].items.size();
+    nodes[node].items.push_back(id);
+}
+
+void SpatialIndex::unlink(int id)
+{
+    Item &item = items[shape_slot(id)];
+    std::vector<int> &bucket = nodes[item.node].items;
+    int moved = bucket.back();
+
+    bucket[item.position] = moved;
+    items[shape_slot(moved)].position = item.position;
+    bucket.pop_back();
+
+    prune(item.node);
+    item.node = -1;
+    item.position = -1;
+}
+
+// Takes the node out of the tree if nothing is left in or under it, and its
+// parent after it, so queries do not walk cells that were emptied
+void SpatialIndex::prune(int node)
+{
+    while (node != 0) {
+        Node &n = nodes[node];
+        if (!n.items.empty()) return;
+        for (int child : n.children) {
+            if (child != -1) return;
+        }
+
+        for (int &child : nodes[n.parent].children) {
+            if (child == node) child = -1;
+        }
+        free_nodes.push_back(node);
+        node = n.parent;
+    }
+}
+
+void SpatialIndex::insert(int id, SDL_Rect rect, Uint64 z, bool ellipse)
+{
+    if (id < 0) return;
+    Uint32 slot = shape_slot(id);
+    if (slot >= items.size()) items.resize(slot + 1);
+
+    // An item left in the slot is replaced, whichever id it had
+    Item &item = items[slot];
+    if (item.node != -1) unlink(item.id);
+    else ++item_count;
+
+    item.id = id;
+    item.rect = rect;
+    item.z = z;
+    item.ellipse = ellipse;
+    link(id, find_node(rect));
+}
+
+void SpatialIndex::update(int id, SDL_Rect rect)
+{
+    if (!contains(id)) return;
+
+    Item &item = items[shape_slot(id)];
+    item.rect = rect;
+    // Small moves usually stay inside the loose bounds of the current node
+    if (fits_node(rect, item.node)) return;
+
+    unlink(id);
+    link(id, find_node(rect));
+}
+
+void SpatialIndex::set_z(int id, Uint64 z)
+{
+    if (contains(id)) items[shape_slot(id)].z = z;
+}
+
+void SpatialIndex::remove(int id)
+{
+    if (!contains(id)) return;
+    unlink(id);
+    --item_count;
+}
+
+int SpatialIndex::query_topmost(SDL_Point p) const
+{
+    int best = -1;
+    Uint64 best_z = 0;
+
+    int stack[4 * MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &n = nodes[stack[--top]];
+
+        for (int id : n.items) {
+            const Item &item = items[shape_slot(id)];
+            if ((best == -1 || item.z > best_z) &&
+                (item.ellipse ? point_in_ellipse(p, item.rect) : point_in_rect(p, item.rect))) {
+                best = id;
+                best_z = item.z;
+            }
+        }
+
+        for (int child : n.children) {
+            if (child == -1) continue;
+            const Node &c = nodes[child];
+            int loose = c.half * 2;
+            if (p.x >= c.cx - loose && p.x <= c.cx + loose && p.y >= c.cy - loose && p.y <= c.cy + loose) {
+                stack[top++] = child;
+            }
+        }
+    }
+
+    return best;
+}
+
+void SpatialIndex::query_rect(SDL_Rect r, std::vector<int> &out, int min_half) const
+{
+    int stack[4 * MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &n = nodes[stack[--top]];
+
+        for (int id : n.items) {
+            if (rects_touch(r, items[shape_slot(id)].rect)) out.push_back(id);
+        }
+
+        for (int child : n.children) {
+            if (child == -1 || nodes[child].half < min_half) continue;
+            const Node &c = nodes[child];
+            int loose = c.half * 2;
+            SDL_Rect bounds = {c.cx - loose, c.cy - loose, loose * 2, loose * 2};
+            if (rects_touch(r, bounds)) stack[top++] = child;
+        }
+    }
+}
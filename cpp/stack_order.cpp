@@ -0,0 +1,147 @@
+#include "stack_order.h"
+
+#include <algorithm>
+
+void StackOrder::build(const Scene &scene)
+{
+    // Gathered in slot order, then LSD radix sorted on z 11 bits a pass.
+    // Passes where every label has the same digit are skipped, which is most
+    // of them: labels are dense from the bottom of the space.
+    size_t total = (size_t)scene.size();
+    std::vector<Entry> all(total), sorted(total);
+    size_t n = 0;
+    for (Uint32 slot = 0; slot < scene.slot_count(); ++slot) {
+        ShapeId id = scene.id_in_slot(slot);
+        if (id != INVALID_SHAPE_ID) all[n++] = {scene.z[scene.index_of(id)], id};
+    }
+
+    for (int shift = 0; shift < 64; shift += 11) {
+        size_t offsets[2049] = {};
+        for (const Entry &entry : all) ++offsets[((entry.z >> shift) & 2047) + 1];
+        if (total == 0 || offsets[((all[0].z >> shift) & 2047) + 1] == total) continue;
+
+        for (int digit = 0; digit < 2048; ++digit) offsets[digit + 1] += offsets[digit];
+        for (const Entry &entry : all) sorted[offsets[(entry.z >> shift) & 2047]++] = entry;
+        all.swap(sorted);
+    }
+
+    // Slot order is id order until slots are reused, so shapes sharing a z
+    // may still need putting in id order
+    for (size_t begin = 0, end; begin < total; begin = end) {
+        for (end = begin + 1; end < total && all[end].z == all[begin].z; ++end) {}
+        if (end - begin > 1 && !std::is_sorted(all.begin() + begin, all.begin() + end, Less())) {
+            std::sort(all.begin() + begin, all.begin() + end, Less());
+        }
+    }
+    labels.assign(all.data(), total);
+}
+
+bool StackOrder::taken(Uint64 z) const
+{
+    Labels::Cursor cursor = labels.lower_bound({z, 0});
+    return !labels.at_end(cursor) && labels[cursor].z == z;
+}
+
+bool StackOrder::above(Uint64 z, Entry &out) const
+{
+    Labels::Cursor cursor = labels.upper_bound({z, INVALID_SHAPE_ID});
+    if (labels.at_end(cursor)) return false;
+    out = labels[cursor];
+    return true;
+}
+
+bool StackOrder::below(Uint64 z, Entry &out) const
+{
+    Labels::Cursor cursor = labels.lower_bound({z, 0});
+    if (!labels.prev(cursor)) return false;
+    out = labels[cursor];
+    return true;
+}
+
+bool StackOrder::top(Entry &out) const
+{
+    Labels::Cursor cursor = labels.end();
+    if (!labels.prev(cursor)) return false;
+    out = labels[cursor];
+    return true;
+}
+
+Uint64 StackOrder::place_above(const Uint64 *under)
+{
+    moved.clear();
+    const Uint64 max = ~(Uint64)0;
+    const Uint64 spacing = Scene::Z_SPACING;
+
+    Entry next;
+    if (!under) {
+        if (labels.empty()) return spacing;
+        next = labels[labels.begin()];
+        // Free labels are [0, next.z)
+        if (next.z >= spacing) return next.z - spacing;
+        if (next.z > 0) return (next.z - 1) / 2;
+        return relabel(next.z, true);
+    }
+
+    Uint64 low = *under;
+    if (!above(low, next)) {
+        if (low <= max - spacing) return low + spacing;
+        if (low < max) return low + 1 + (max - low - 1) / 2;
+        return relabel(low, false);
+    }
+    if (next.z - low >= 2) return low + (next.z - low) / 2;
+    return relabel(low, false);
+}
+
+Uint64 StackOrder::place_below(Uint64 over)
+{
+    Entry under;
+    if (below(over, under)) return place_above(&under.z);
+    return place_above(nullptr);
+}
+
+Uint64 StackOrder::relabel(Uint64 anchor, bool bottom)
+{
+    for (int i = 2; i < 64; ++i) {
+        Uint64 size = (Uint64)1 << i;
+        Uint64 start = anchor & ~(size - 1);
+        Uint64 last = start + (size - 1);
+
+        // Labels in the block, counted up to the most it may hold
+        size_t limit = (size_t)1 << (i / 2);
+        Labels::Cursor first = labels.lower_bound({start, 0});
+        size_t count = 0;
+        for (Labels::Cursor cursor = first; !labels.at_end(cursor) && labels[cursor].z <= last && count < limit; labels.next(cursor)) {
+            ++count;
+        }
+        if (count + 1 > limit && i < 63) continue;
+
+        // Even spacing across the block, the new slot taking its place in line
+        Uint64 step = size / (count + 1);
+        Uint64 label = start + step / 2;
+        Uint64 slot = label;
+        bool placed = false;
+        if (bottom) {
+            label += step;
+            placed = true;
+        }
+
+        Labels::Cursor cursor = first;
+        for (size_t k = 0; k < count; ++k, labels.next(cursor)) {
+            Entry entry = labels[cursor];
+            bool anchored = !placed && entry.z == anchor;
+            if (entry.z != label) {
+                entry.z = label;
+                labels.replace(cursor, entry);
+                moved.push_back(entry);
+            }
+            label += step;
+            if (anchored) {
+                slot = label;
+                label += step;
+                placed = true;
+            }
+        }
+        return slot;
+    }
+    return anchor; // Unreachable below 2^31 shapes
+}
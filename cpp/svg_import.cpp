@@ -0,0 +1,599 @@
+#include "svg_import.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+bool equals(const char *s, int n, const char *literal)
+{
+    int length = (int)std::strlen(literal);
+    return n == length && std::memcmp(s, literal, n) == 0;
+}
+
+bool equals_nocase(const char *s, int n, const char *literal)
+{
+    int length = (int)std::strlen(literal);
+    if (n != length) return false;
+    for (int i = 0; i < n; ++i) {
+        if (lower(s[i]) != literal[i]) return false;
+    }
+    return true;
+}
+
+void trim(const char *&s, int &n)
+{
+    while (n > 0 && is_space(*s)) { ++s; --n; }
+    while (n > 0 && is_space(s[n - 1])) --n;
+}
+
+const char *find(const char *p, const char *end, const char *literal)
+{
+    size_t n = std::strlen(literal);
+    while (p + n <= end) {
+        const char *hit = (const char *)std::memchr(p, literal[0], end - p - n + 1);
+        if (!hit) return nullptr;
+        if (std::memcmp(hit, literal, n) == 0) return hit;
+        p = hit + 1;
+    }
+    return nullptr;
+}
+
+// SVG number grammar: sign, digits, fraction, exponent. Does not need a
+// terminator, unlike strtod, and ignores the locale.
+bool read_number(const char *&p, const char *end, double &out)
+{
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '+' || *s == '-')) negative = *s++ == '-';
+
+    double value = 0.0;
+    int digits = 0;
+    while (s < end && is_digit(*s)) {
+        value = value * 10.0 + (*s++ - '0');
+        ++digits;
+    }
+    if (s < end && *s == '.') {
+        ++s;
+        double scale = 0.1;
+        while (s < end && is_digit(*s)) {
+            value += (*s++ - '0') * scale;
+            scale *= 0.1;
+            ++digits;
+        }
+    }
+    if (digits == 0) return false;
+
+    // An exponent needs digits, so units like "em" are left alone
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '+' || *e == '-')) negative_exponent = *e++ == '-';
+        if (e < end && is_digit(*e)) {
+            int exponent = 0;
+            while (e < end && is_digit(*e)) exponent = std::min(exponent * 10 + (*e++ - '0'), 400);
+            value *= std::pow(10.0, negative_exponent ? -exponent : exponent);
+            s = e;
+        }
+    }
+
+    out = negative ? -value : value;
+    p = s;
+    return true;
+}
+
+void skip_separators(const char *&p, const char *end)
+{
+    while (p < end && (is_space(*p) || *p == ',')) ++p;
+}
+
+// Length in user units; the unit suffix, if any, is ignored
+bool read_length(const char *s, int n, double &out)
+{
+    const char *p = s;
+    while (p < s + n && is_space(*p)) ++p;
+    return read_number(p, s + n, out);
+}
+
+Uint8 clamp_channel(double v)
+{
+    return (Uint8)std::lround(std::min(255.0, std::max(0.0, v)));
+}
+
+int hex_digit(char c)
+{
+    if (is_digit(c)) return c - '0';
+    c = lower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+bool parse_hex_color(const char *s, int n, SDL_Color &out)
+{
+    int v[8];
+    if (n > 8) return false;
+    for (int i = 0; i < n; ++i) {
+        v[i] = hex_digit(s[i]);
+        if (v[i] < 0) return false;
+    }
+    if (n == 3 || n == 4) {
+        out = {(Uint8)(v[0] * 17), (Uint8)(v[1] * 17), (Uint8)(v[2] * 17), (Uint8)(n == 4 ? v[3] * 17 : 255)};
+        return true;
+    }
+    if (n == 6 || n == 8) {
+        out = {(Uint8)(v[0] * 16 + v[1]), (Uint8)(v[2] * 16 + v[3]), (Uint8)(v[4] * 16 + v[5]),
+               (Uint8)(n == 8 ? v[6] * 16 + v[7] : 255)};
+        return true;
+    }
+    return false;
+}
+
+// rgb(r, g, b) and rgba(r, g, b, a), channels as numbers or percentages
+bool parse_rgb_color(const char *s, int n, SDL_Color &out)
+{
+    const char *p = s;
+    const char *end = s + n;
+    double channels[4] = {0, 0, 0, 1};
+    int count = 0;
+
+    while (count < 4) {
+        skip_separators(p, end);
+        if (p < end && *p == '/') { ++p; skip_separators(p, end); }
+        double v;
+        if (!read_number(p, end, v)) break;
+        bool percent = p < end && *p == '%';
+        if (percent) ++p;
+        channels[count] = count < 3 ? (percent ? v * 2.55 : v) : (percent ? v / 100.0 : v);
+        ++count;
+    }
+    if (count < 3) return false;
+
+    out = {clamp_channel(channels[0]), clamp_channel(channels[1]), clamp_channel(channels[2]), clamp_channel(channels[3] * 255.0)};
+    return true;
+}
+
+bool parse_named_color(const char *s, int n, SDL_Color &out)
+{
+    static const struct { const char *name; SDL_Color color; } named[] = {
+        {"black", {0, 0, 0, 255}},
+        {"white", {255, 255, 255, 255}},
+        {"red", {255, 0, 0, 255}},
+        {"green", {0, 128, 0, 255}},
+        {"blue", {0, 0, 255, 255}},
+        {"yellow", {255, 255, 0, 255}},
+        {"cyan", {0, 255, 255, 255}},
+        {"aqua", {0, 255, 255, 255}},
+        {"magenta", {255, 0, 255, 255}},
+        {"fuchsia", {255, 0, 255, 255}},
+        {"gray", {128, 128, 128, 255}},
+        {"grey", {128, 128, 128, 255}},
+        {"silver", {192, 192, 192, 255}},
+        {"maroon", {128, 0, 0, 255}},
+        {"olive", {128, 128, 0, 255}},
+        {"lime", {0, 255, 0, 255}},
+        {"teal", {0, 128, 128, 255}},
+        {"navy", {0, 0, 128, 255}},
+        {"purple", {128, 0, 128, 255}},
+        {"orange", {255, 165, 0, 255}},
+        {"transparent", {0, 0, 0, 0}},
+    };
+    for (const auto &entry : named) {
+        if (equals_nocase(s, n, entry.name)) {
+            out = entry.color;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Paint servers (url(#...)) and unknown keywords leave the inherited fill,
+// as if the property were not given
+void apply_fill(SvgImporter::Style &style, const char *s, int n)
+{
+    trim(s, n);
+    if (equals_nocase(s, n, "none")) {
+        style.fill_none = true;
+        return;
+    }
+
+    SDL_Color color;
+    bool ok = false;
+    if (n > 1 && s[0] == '#') {
+        ok = parse_hex_color(s + 1, n - 1, color);
+    } else if (n > 4 && (equals_nocase(s, 4, "rgb(") || equals_nocase(s, 5, "rgba("))) {
+        const char *open = (const char *)std::memchr(s, '(', n);
+        ok = parse_rgb_color(open + 1, (int)(s + n - open - 1), color);
+    } else {
+        ok = parse_named_color(s, n, color);
+    }
+
+    if (ok) {
+        style.fill = color;
+        style.fill_none = false;
+    }
+}
+
+double read_fraction(const char *s, int n)
+{
+    const char *p = s;
+    const char *end = s + n;
+    while (p < end && is_space(*p)) ++p;
+    double v;
+    if (!read_number(p, end, v)) return 1.0;
+    if (p < end && *p == '%') v /= 100.0;
+    return std::min(1.0, std::max(0.0, v));
+}
+
+void apply_property(SvgImporter::Style &style, const char *name, int name_length, const char *value, int value_length)
+{
+    if (equals(name, name_length, "fill")) {
+        apply_fill(style, value, value_length);
+    } else if (equals(name, name_length, "fill-opacity")) {
+        style.fill_opacity = (float)read_fraction(value, value_length);
+    } else if (equals(name, name_length, "opacity")) {
+        style.opacity = (float)read_fraction(value, value_length);
+    } else if (equals(name, name_length, "display")) {
+        trim(value, value_length);
+        if (equals(value, value_length, "none")) style.hidden = true;
+    }
+}
+
+// style="fill: red; opacity: .5"
+void apply_style(SvgImporter::Style &style, const char *s, int n)
+{
+    const char *end = s + n;
+    while (s < end) {
+        const char *semicolon = (const char *)std::memchr(s, ';', end - s);
+        const char *stop = semicolon ? semicolon : end;
+        const char *colon = (const char *)std::memchr(s, ':', stop - s);
+        if (colon) {
+            const char *name = s;
+            int name_length = (int)(colon - s);
+            const char *value = colon + 1;
+            int value_length = (int)(stop - value);
+            trim(name, name_length);
+            apply_property(style, name, name_length, value, value_length);
+        }
+        s = stop + (semicolon ? 1 : 0);
+    }
+}
+
+// Composes a transform list onto the style's scale and translation. Only
+// the axis-aligned part is kept: rotate and skew are skipped, and a matrix
+// with rotation contributes its translation.
+void apply_transform(SvgImporter::Style &style, const char *s, int n)
+{
+    const char *p = s;
+    const char *end = s + n;
+
+    while (p < end) {
+        skip_separators(p, end);
+        const char *name = p;
+        while (p < end && *p != '(') ++p;
+        int name_length = (int)(p - name);
+        trim(name, name_length);
+        if (p >= end) return;
+        ++p;
+
+        double args[6] = {0, 0, 0, 0, 0, 0};
+        int count = 0;
+        for (;;) {
+            skip_separators(p, end);
+            double v;
+            if (!read_number(p, end, v)) break;
+            if (count < 6) args[count++] = v;
+        }
+        while (p < end && *p != ')') ++p;
+        if (p >= end) return;
+        ++p;
+
+        double sx = 1, sy = 1, tx = 0, ty = 0;
+        if (equals(name, name_length, "translate") && count >= 1) {
+            tx = args[0];
+            ty = count >= 2 ? args[1] : 0;
+        } else if (equals(name, name_length, "scale") && count >= 1) {
+            sx = args[0];
+            sy = count >= 2 ? args[1] : args[0];
+        } else if (equals(name, name_length, "matrix") && count == 6) {
+            if (args[1] == 0 && args[2] == 0) {
+                sx = args[0];
+                sy = args[3];
+            }
+            tx = args[4];
+            ty = args[5];
+        }
+
+        // Parent * this: the new transform applies to coordinates first
+        style.tx += style.sx * (float)tx;
+        style.ty += style.sy * (float)ty;
+        style.sx *= (float)sx;
+        style.sy *= (float)sy;
+    }
+}
+
+// Decodes the XML entities in an attribute value into the arena
+const char *decode_entities(Arena &arena, const char *s, int n, int &out_length)
+{
+    char *out = arena.allocate_array<char>(n);
+    int length = 0;
+
+    for (int i = 0; i < n;) {
+        if (s[i] != '&') {
+            out[length++] = s[i++];
+            continue;
+        }
+
+        const char *semicolon = (const char *)std::memchr(s + i, ';', n - i);
+        if (!semicolon) {
+            out[length++] = s[i++];
+            continue;
+        }
+        const char *name = s + i + 1;
+        int name_length = (int)(semicolon - name);
+
+        long code = -1;
+        if (equals(name, name_length, "amp")) code = '&';
+        else if (equals(name, name_length, "lt")) code = '<';
+        else if (equals(name, name_length, "gt")) code = '>';
+        else if (equals(name, name_length, "quot")) code = '"';
+        else if (equals(name, name_length, "apos")) code = '\'';
+        else if (name_length > 1 && name[0] == '#') {
+            bool hex = name[1] == 'x' || name[1] == 'X';
+            code = 0;
+            for (int k = hex ? 2 : 1; k < name_length && code <= 0x10FFFF; ++k) {
+                int digit = hex ? hex_digit(name[k]) : (is_digit(name[k]) ? name[k] - '0' : -1);
+                if (digit < 0) { code = -1; break; }
+                code = code * (hex ? 16 : 10) + digit;
+            }
+            if (code > 0x10FFFF) code = -1;
+        }
+
+        if (code < 0) {
+            out[length++] = s[i++];
+            continue;
+        }
+
+        // UTF-8; never longer than the entity it replaces
+        if (code < 0x80) {
+            out[length++] = (char)code;
+        } else if (code < 0x800) {
+            out[length++] = (char)(0xC0 | (code >> 6));
+            out[length++] = (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out[length++] = (char)(0xE0 | (code >> 12));
+            out[length++] = (char)(0x80 | ((code >> 6) & 0x3F));
+            out[length++] = (char)(0x80 | (code & 0x3F));
+        } else {
+            out[length++] = (char)(0xF0 | (code >> 18));
+            out[length++] = (char)(0x80 | ((code >> 12) & 0x3F));
+            out[length++] = (char)(0x80 | ((code >> 6) & 0x3F));
+            out[length++] = (char)(0x80 | (code & 0x3F));
+        }
+        i = (int)(semicolon - s) + 1;
+    }
+
+    out_length = length;
+    return out;
+}
+
+bool is_hidden_container(const char *name, int n)
+{
+    return equals(name, n, "defs") || equals(name, n, "clipPath") || equals(name, n, "mask") ||
+           equals(name, n, "pattern") || equals(name, n, "symbol") || equals(name, n, "marker");
+}
+
+const SvgImporter::Attribute *find_attribute(const SvgImporter::Attribute *list, const char *name)
+{
+    for (; list; list = list->next) {
+        if (equals(list->name, list->name_length, name)) return list;
+    }
+    return nullptr;
+}
+
+double attribute_length(const SvgImporter::Attribute *list, const char *name, double fallback)
+{
+    const SvgImporter::Attribute *attribute = find_attribute(list, name);
+    double v;
+    return attribute && read_length(attribute->value, attribute->value_length, v) ? v : fallback;
+}
+
+// Document-space box of a user-space box, rounded to whole units
+bool to_rect(const SvgImporter::Style &style, double x, double y, double w, double h, SDL_Rect &out)
+{
+    if (!(w > 0 && h > 0)) return false;
+
+    double x0 = x * style.sx + style.tx, x1 = (x + w) * style.sx + style.tx;
+    double y0 = y * style.sy + style.ty, y1 = (y + h) * style.sy + style.ty;
+    if (x0 > x1) std::swap(x0, x1);
+    if (y0 > y1) std::swap(y0, y1);
+    if (!(x0 > -1e9 && x1 < 1e9 && y0 > -1e9 && y1 < 1e9)) return false;
+
+    int left = (int)std::lround(x0), top = (int)std::lround(y0);
+    out = {left, top, std::max(1, (int)std::lround(x1) - left), std::max(1, (int)std::lround(y1) - top)};
+    return true;
+}
+
+} // namespace
+
+int SvgImporter::read(const char *data, size_t size, std::vector<Shape> &out)
+{
+    size_t first = out.size();
+    elements = 0;
+    stack.clear();
+    stack.push_back({{0, 0, 0, 255}, 1.0f, 1.0f, false, false, 1.0f, 1.0f, 0.0f, 0.0f});
+
+    const char *p = data;
+    const char *end = data + size;
+
+    while (p < end) {
+        p = (const char *)std::memchr(p, '<', end - p);
+        if (!p) break;
+        ++p;
+
+        // Markup that is not an element
+        if (end - p >= 3 && std::memcmp(p, "!--", 3) == 0) {
+            p = find(p + 3, end, "-->");
+            if (!p) break;
+            p += 3;
+            continue;
+        }
+        if (end - p >= 8 && std::memcmp(p, "![CDATA[", 8) == 0) {
+            p = find(p + 8, end, "]]>");
+            if (!p) break;
+            p += 3;
+            continue;
+        }
+        if (p < end && (*p == '!' || *p == '?')) {
+            p = (const char *)std::memchr(p, '>', end - p);
+            if (!p) break;
+            ++p;
+            continue;
+        }
+        if (p < end && *p == '/') {
+            p = (const char *)std::memchr(p, '>', end - p);
+            if (!p) break;
+            ++p;
+            if (stack.size() > 1) stack.pop_back();
+            continue;
+        }
+
+        // Start tag
+        const char *name = p;
+        while (p < end && !is_space(*p) && *p != '/' && *p != '>') ++p;
+        int name_length = (int)(p - name);
+
+        // Drop a namespace prefix (svg:rect)
+        const char *colon = (const char *)std::memchr(name, ':', name_length);
+        if (colon) {
+            name_length -= (int)(colon + 1 - name);
+            name = colon + 1;
+        }
+
+        arena.reset();
+        Attribute *attributes = nullptr;
+        Attribute **tail = &attributes;
+        bool self_closing = false;
+        bool closed = false;
+
+        while (p < end) {
+            while (p < end && is_space(*p)) ++p;
+            if (p >= end) break;
+            if (*p == '>') {
+                ++p;
+                closed = true;
+                break;
+            }
+            if (*p == '/') {
+                ++p;
+                if (p < end && *p == '>') {
+                    ++p;
+                    self_closing = true;
+                    closed = true;
+                    break;
+                }
+                continue;
+            }
+
+            const char *attribute_name = p;
+            while (p < end && !is_space(*p) && *p != '=' && *p != '>' && *p != '/') ++p;
+            int attribute_name_length = (int)(p - attribute_name);
+            while (p < end && is_space(*p)) ++p;
+
+            const char *value = p;
+            int value_length = 0;
+            if (p < end && *p == '=') {
+                ++p;
+                while (p < end && is_space(*p)) ++p;
+                if (p < end && (*p == '"' || *p == '\'')) {
+                    char quote = *p++;
+                    value = p;
+                    p = (const char *)std::memchr(p, quote, end - p);
+                    if (!p) return (int)(out.size() - first);
+                    value_length = (int)(p - value);
+                    ++p;
+                } else {
+                    value = p;
+                    while (p < end && !is_space(*p) && *p != '>') ++p;
+                    value_length = (int)(p - value);
+                }
+            }
+            if (attribute_name_length == 0) continue;
+
+            if (std::memchr(value, '&', value_length)) {
+                value = decode_entities(arena, value, value_length, value_length);
+            }
+
+            Attribute *attribute = arena.allocate_array<Attribute>(1);
+            *attribute = {attribute_name, value, attribute_name_length, value_length, nullptr};
+            *tail = attribute;
+            tail = &attribute->next;
+        }
+        if (!closed) break;
+        ++elements;
+
+        // Presentation attributes first, then style, which overrides them.
+        // Opacity is the element's own until both are read, then multiplies
+        // into what it inherits.
+        Style style = stack.back();
+        float inherited_opacity = style.opacity;
+        style.opacity = 1.0f;
+        for (const Attribute *a = attributes; a; a = a->next) {
+            if (equals(a->name, a->name_length, "transform")) {
+                apply_transform(style, a->value, a->value_length);
+            } else if (!equals(a->name, a->name_length, "style")) {
+                apply_property(style, a->name, a->name_length, a->value, a->value_length);
+            }
+        }
+        if (const Attribute *css = find_attribute(attributes, "style")) {
+            apply_style(style, css->value, css->value_length);
+        }
+        style.opacity *= inherited_opacity;
+        if (is_hidden_container(name, name_length)) style.hidden = true;
+
+        bool is_rect = equals(name, name_length, "rect");
+        bool is_circle = equals(name, name_length, "circle");
+        bool is_ellipse = equals(name, name_length, "ellipse");
+        int alpha = (int)std::lround(style.fill.a * style.fill_opacity * style.opacity);
+
+        if ((is_rect || is_circle || is_ellipse) && !style.hidden && !style.fill_none && alpha > 0) {
+            SDL_Rect rect;
+            bool ok;
+            if (is_rect) {
+                ok = to_rect(style,
+                             attribute_length(attributes, "x", 0), attribute_length(attributes, "y", 0),
+                             attribute_length(attributes, "width", 0), attribute_length(attributes, "height", 0), rect);
+            } else {
+                double cx = attribute_length(attributes, "cx", 0);
+                double cy = attribute_length(attributes, "cy", 0);
+                double rx = attribute_length(attributes, is_circle ? "r" : "rx", 0);
+                double ry = is_circle ? rx : attribute_length(attributes, "ry", 0);
+                ok = to_rect(style, cx - rx, cy - ry, rx * 2, ry * 2, rect);
+            }
+
+            if (ok) {
+                SDL_Color color = style.fill;
+                color.a = (Uint8)alpha;
+                out.push_back({is_rect ? ShapeType::RECTANGLE : ShapeType::CIRCLE, rect, color});
+            }
+        }
+
+        if (!self_closing) stack.push_back(style);
+    }
+
+    return (int)(out.size() - first);
+}
@@ -0,0 +1,138 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int workers)
+{
+    resize(workers);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+int ThreadPool::available_workers()
+{
+#if VECTORMATE_HAS_THREADS
+    int hardware = (int)std::thread::hardware_concurrency();
+    return std::max(hardware - 1, 0);
+#else
+    return 0;
+#endif
+}
+
+void ThreadPool::resize(int workers)
+{
+    stop();
+
+    workers = std::max(0, std::min(workers, available_workers()));
+    queues.clear();
+    for (int slot = 0; slot <= workers; ++slot) {
+        queues.emplace_back(new Queue());
+    }
+
+    stopping = false;
+#if VECTORMATE_HAS_THREADS
+    for (int slot = 1; slot <= workers; ++slot) {
+        threads.emplace_back(&ThreadPool::worker_main, this, slot);
+    }
+#endif
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads) thread.join();
+    threads.clear();
+}
+
+void ThreadPool::run_tasks(int count, const TaskRef &fn)
+{
+    if (count <= 0) return;
+    if (threads.empty()) {
+        for (int i = 0; i < count; ++i) fn.call(fn.callable, i, 0);
+        return;
+    }
+
+    // The task is published before any index, since a worker still looping
+    // from the previous run may pick one up without waking
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        pending.store(count);
+    }
+
+    // Queues are empty between runs, so each is refilled from the start
+    int slots = (int)queues.size();
+    int per_slot = (count + slots - 1) / slots;
+    for (int slot = 0; slot < slots; ++slot) {
+        Queue &queue = *queues[slot];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if ((int)queue.items.size() < per_slot) queue.items.resize(per_slot);
+        queue.head = 0;
+        queue.tail = 0;
+        for (int i = slot; i < count; i += slots) queue.items[queue.tail++] = i;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending.load() == 0; });
+    task = nullptr;
+}
+
+// Own work comes off the back, stolen work off the front of another slot
+bool ThreadPool::next(int slot, int &index)
+{
+    int slots = (int)queues.size();
+    for (int i = 0; i < slots; ++i) {
+        Queue &queue = *queues[(slot + i) % slots];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head == queue.tail) continue;
+
+        if (i == 0) {
+            index = queue.items[--queue.tail];
+        } else {
+            index = queue.items[queue.head++];
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::drain(int slot)
+{
+    int index;
+    while (next(slot, index)) {
+        task->call(task->callable, index, slot);
+        if (pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::worker_main(int slot)
+{
+    Uint64 seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        drain(slot);
+    }
+}
@@ -0,0 +1,136 @@
+#include "tile_cache.h"
+
+#include <cstring>
+#include <utility>
+
+TileCache::TileCache(size_t budget_bytes)
+    : budget(budget_bytes)
+{
+}
+
+size_t TileCache::KeyHash::operator()(const Key &k) const
+{
+    Uint64 h = k.zoom_bits;
+    h = h * 0x9E3779B97F4A7C15ull + (Uint32)k.tx;
+    h = h * 0x9E3779B97F4A7C15ull + (Uint32)k.ty;
+    return (size_t)(h ^ (h >> 29));
+}
+
+TileCache::Key TileCache::key_of(float zoom, int tx, int ty)
+{
+    Key key;
+    std::memcpy(&key.zoom_bits, &zoom, sizeof(key.zoom_bits));
+    key.tx = tx;
+    key.ty = ty;
+    return key;
+}
+
+void TileCache::clear()
+{
+    for (Tile &tile : tiles) {
+        if (tile.texture) SDL_DestroyTexture(tile.texture);
+    }
+    tiles.clear();
+    lookup.clear();
+}
+
+void TileCache::set_budget(size_t budget_bytes)
+{
+    budget = budget_bytes;
+
+    // Drop least recently used tiles that are over the new budget
+    while (bytes() > budget && !tiles.empty() && tiles.back().last_used != frame) {
+        Tile &tile = tiles.back();
+        if (tile.texture) SDL_DestroyTexture(tile.texture);
+        lookup.erase(key_of(tile.zoom, tile.tx, tile.ty));
+        tiles.pop_back();
+    }
+}
+
+Tile *TileCache::acquire(SDL_Renderer *renderer, float zoom, int tx, int ty)
+{
+    Key key = key_of(zoom, tx, ty);
+    auto found = lookup.find(key);
+    if (found != lookup.end()) {
+        ++hits;
+        tiles.splice(tiles.begin(), tiles, found->second);
+        tiles.front().last_used = frame;
+        return &tiles.front();
+    }
+    ++misses;
+
+    // Over budget: recycle the least recently used tile and its storage,
+    // rekeying its map node so a full cache misses without allocating
+    if (bytes() + TILE_BYTES > budget && !tiles.empty() && tiles.back().last_used != frame) {
+        auto node = lookup.extract(key_of(tiles.back().zoom, tiles.back().tx, tiles.back().ty));
+        tiles.splice(tiles.begin(), tiles, std::prev(tiles.end()));
+        node.key() = key;
+        node.mapped() = tiles.begin();
+        lookup.insert(std::move(node));
+    } else {
+        tiles.emplace_front();
+        lookup[key] = tiles.begin();
+    }
+
+    Tile &tile = tiles.front();
+    if (renderer && !tile.texture) {
+        tile.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, TILE_SIZE, TILE_SIZE);
+        if (!tile.texture) {
+            lookup.erase(key);
+            tiles.pop_front();
+            return nullptr;
+        }
+        SDL_SetTextureBlendMode(tile.texture, SDL_BLENDMODE_NONE);
+    }
+    if (!renderer && tile.pixels.width != TILE_SIZE) {
+        tile.pixels.resize(TILE_SIZE, TILE_SIZE);
+    }
+
+    tile.zoom = zoom;
+    tile.tx = tx;
+    tile.ty = ty;
+    tile.dirty = {0, 0, TILE_SIZE, TILE_SIZE};
+    tile.last_used = frame;
+    return &tile;
+}
+
+void TileCache::invalidate(const SDL_Rect *world_rects, int count)
+{
+    for (Tile &tile : tiles) {
+        // World span of the tile, a unit wider on each side so rounding never
+        // rejects a rect that the exact projection below would keep
+        double left = (double)tile.tx * TILE_SIZE / tile.zoom - 1.0;
+        double top = (double)tile.ty * TILE_SIZE / tile.zoom - 1.0;
+        double right = (double)(tile.tx + 1) * TILE_SIZE / tile.zoom + 1.0;
+        double bottom = (double)(tile.ty + 1) * TILE_SIZE / tile.zoom + 1.0;
+
+        for (int i = 0; i < count; ++i) {
+            const SDL_Rect &r = world_rects[i];
+            if (r.x >= right || r.x + r.w <= left || r.y >= bottom || r.y + r.h <= top) continue;
+
+            // Same edges as world_to_screen_rect, relative to the tile
+            int x0 = world_to_content(r.x, tile.zoom) - tile.tx * TILE_SIZE;
+            int y0 = world_to_content(r.y, tile.zoom) - tile.ty * TILE_SIZE;
+            int x1 = world_to_content(r.x + r.w, tile.zoom) - tile.tx * TILE_SIZE;
+            int y1 = world_to_content(r.y + r.h, tile.zoom) - tile.ty * TILE_SIZE;
+
+            SDL_Rect local = {x0, y0, x1 - x0, y1 - y0};
+            SDL_Rect bounds = {0, 0, TILE_SIZE, TILE_SIZE};
+            SDL_Rect hit;
+            if (!SDL_IntersectRect(&local, &bounds, &hit)) continue;
+
+            if (SDL_RectEmpty(&tile.dirty)) {
+                tile.dirty = hit;
+            } else {
+                SDL_UnionRect(&tile.dirty, &hit, &tile.dirty);
+            }
+        }
+    }
+}
+
+void TileCache::invalidate_all()
+{
+    for (Tile &tile : tiles) {
+        tile.dirty = {0, 0, TILE_SIZE, TILE_SIZE};
+    }
+}
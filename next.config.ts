@@ -8,6 +8,20 @@ const nextConfig: NextConfig = {
   eslint: {
     ignoreDuringBuilds: true,
   },
+  // A WASM module built with pthreads (VECTORMATE_WASM_THREADS) needs
+  // SharedArrayBuffer, which browsers only expose to cross-origin isolated pages
+  async headers() {
+    if (process.env.VECTORMATE_WASM_THREADS !== '1') return [];
+    return [
+      {
+        source: '/:path*',
+        headers: [
+          { key: 'Cross-Origin-Opener-Policy', value: 'same-origin' },
+          { key: 'Cross-Origin-Embedder-Policy', value: 'credentialless' },
+        ],
+      },
+    ];
+  },
   images: {
     remotePatterns: [
       {
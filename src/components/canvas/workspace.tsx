@@ -1,7 +1,7 @@
 'use client';
 
 import { useEffect, useRef } from 'react';
-import { initializeWasm, wasmApi, loadWasmScript } from '@/lib/wasm-bridge';
+import { initializeWasm, wasmApi, loadWasmScript, KeyModifier } from '@/lib/wasm-bridge';
 import useCanvasState from '@/states/canvasStates';
 
 export function CanvasWorkspace() {
@@ -87,7 +87,16 @@ export function CanvasWorkspace() {
       setShowGrid(!showGrid);
       event.preventDefault(); 
     } else {
-      wasmApi.onKeyDown(event.key);
+      const modifiers =
+        (event.ctrlKey ? KeyModifier.Ctrl : 0) |
+        (event.shiftKey ? KeyModifier.Shift : 0) |
+        (event.altKey ? KeyModifier.Alt : 0) |
+        (event.metaKey ? KeyModifier.Meta : 0);
+      wasmApi.onKeyDown(event.key, modifiers);
+      // Undo, redo and selection nudges are handled by the engine, not the browser
+      if (((event.ctrlKey || event.metaKey) && (key === 'z' || key === 'y')) || event.key.startsWith('Arrow')) {
+        event.preventDefault();
+      }
     }
   };
 
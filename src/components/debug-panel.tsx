@@ -1,11 +1,95 @@
 
 'use client';
 
-import { useState, useEffect } from 'react';
-import { isWasmInitialized, wasmApi } from '@/lib/wasm-bridge';
+import { useState, useEffect, useRef } from 'react';
+import { isWasmInitialized, wasmApi, FrameStat, FRAME_STATS_HEADER_WORDS } from '@/lib/wasm-bridge';
 import useCanvasState from '@/states/canvasStates';
 import { arrayToRgbaString } from '@/lib/utils';
 
+// Phases stacked bottom to top in the frame chart
+const CHART_PHASES = [
+  { stat: FrameStat.InputUs, color: '#a3a3a3' },
+  { stat: FrameStat.BackgroundUs, color: '#60a5fa' },
+  { stat: FrameStat.GridUs, color: '#818cf8' },
+  { stat: FrameStat.ShapesUs, color: '#34d399' },
+  { stat: FrameStat.SelectionUs, color: '#fbbf24' },
+  { stat: FrameStat.CompositeUs, color: '#f472b6' },
+  { stat: FrameStat.PresentUs, color: '#f87171' },
+];
+const CHART_WIDTH = 256;
+const CHART_HEIGHT = 64;
+const CHART_BUDGET_US = 16667; // One frame at 60 Hz fills the chart
+
+/**
+ * Draws the engine's recent frames as stacked phase bars, one pixel column
+ * per frame, straight from the WASM ring. Nothing is allocated per frame:
+ * the view is cached by the bridge and counters are only formatted a few
+ * times a second.
+ */
+function FrameStatsChart() {
+  const canvasRef = useRef<HTMLCanvasElement>(null);
+  const countersRef = useRef<HTMLDivElement>(null);
+
+  useEffect(() => {
+    let frameId = 0;
+    let lastWrite = -1;
+    let lastText = 0;
+
+    const draw = (now: number) => {
+      frameId = requestAnimationFrame(draw);
+      const stats = wasmApi.getFrameStats();
+      const ctx = canvasRef.current?.getContext('2d');
+      if (!stats || !ctx) {
+        return;
+      }
+
+      const capacity = stats[0];
+      const count = stats[1];
+      const write = stats[2];
+      if (write === lastWrite) {
+        return;
+      }
+      lastWrite = write;
+
+      ctx.clearRect(0, 0, CHART_WIDTH, CHART_HEIGHT);
+      const frames = Math.min(write, capacity, CHART_WIDTH);
+      for (let i = 0; i < frames; i++) {
+        const base = FRAME_STATS_HEADER_WORDS + ((write - frames + i) % capacity) * count;
+        const x = CHART_WIDTH - frames + i;
+        let y = CHART_HEIGHT;
+        for (const phase of CHART_PHASES) {
+          const h = (stats[base + phase.stat] / CHART_BUDGET_US) * CHART_HEIGHT;
+          ctx.fillStyle = phase.color;
+          ctx.fillRect(x, y - h, 1, h);
+          y -= h;
+        }
+      }
+
+      if (countersRef.current && write > 0 && now - lastText > 250) {
+        lastText = now;
+        const base = FRAME_STATS_HEADER_WORDS + ((write - 1) % capacity) * count;
+        countersRef.current.textContent =
+          `${(stats[base + FrameStat.TotalUs] / 1000).toFixed(2)} ms · ` +
+          `${stats[base + FrameStat.DrawCalls]} draws · ` +
+          `${stats[base + FrameStat.ShapesVisited]} visited / ${stats[base + FrameStat.ShapesCulled]} culled · ` +
+          `${stats[base + FrameStat.TilesRasterized]} tiles · ` +
+          `${stats[base + FrameStat.HitTests]} hits · ${stats[base + FrameStat.InputEvents]} events`;
+      }
+    };
+
+    frameId = requestAnimationFrame(draw);
+    return () => cancelAnimationFrame(frameId);
+  }, []);
+
+  return (
+    <div className="mt-2 pt-2 border-t border-gray-600">
+      <div className="font-bold mb-1">Frames</div>
+      <canvas ref={canvasRef} data-frame-chart width={CHART_WIDTH} height={CHART_HEIGHT} className="bg-gray-900 rounded w-full" />
+      <div ref={countersRef} className="text-xs text-gray-400 mt-1" />
+    </div>
+  );
+}
+
 export function DebugPanel() {
   const [wasmStatus, setWasmStatus] = useState(false);
   const [canvasSize, setCanvasSize] = useState({ width: 0, height: 0 });
@@ -19,7 +103,7 @@ export function DebugPanel() {
       setWasmStatus(isWasmInitialized());
       setWasmModuleExists(!!(window as any).VectorMateModule);
       
-      const canvas = document.querySelector('canvas');
+      const canvas = document.querySelector<HTMLCanvasElement>('canvas:not([data-frame-chart])');
       if (canvas) {
         const rect = canvas.getBoundingClientRect();
         setCanvasSize({
@@ -76,7 +160,7 @@ export function DebugPanel() {
       results.push('✗ WASM not initialized');
     }
     
-    const canvas = document.querySelector('canvas');
+    const canvas = document.querySelector<HTMLCanvasElement>('canvas:not([data-frame-chart])');
     if (canvas) {
       results.push(`✓ Canvas found: ${canvas.width}x${canvas.height}`);
       results.push(`Canvas ID: ${canvas.id}`);
@@ -95,7 +179,7 @@ export function DebugPanel() {
   };
 
   const handleTestCanvas = () => {
-    const canvas = document.querySelector('canvas') as HTMLCanvasElement;
+    const canvas = document.querySelector<HTMLCanvasElement>('canvas:not([data-frame-chart])') as HTMLCanvasElement;
     if (canvas) {
       const ctx = canvas.getContext('2d');
       if (ctx) {
@@ -130,6 +214,8 @@ export function DebugPanel() {
           <div>Grid Size: {gridSize}px</div>
           <div>Background: {arrayToRgbaString(bgColor)}</div>
         </div>
+
+        <FrameStatsChart />
         
         <div className="mt-2 space-y-1">
           <button 
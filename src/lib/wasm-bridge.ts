@@ -7,11 +7,16 @@ interface WasmModule {
   ccall: (funcName: string, returnType: string, argTypes: string[], args: any[]) => any;
   cwrap: (funcName: string, returnType: string, argTypes: string[]) => (...args: any[]) => any;
   canvas: HTMLCanvasElement;
+  HEAP32: Int32Array;
+  HEAPU8: Uint8Array;
+  _malloc: (size: number) => number;
+  _free: (ptr: number) => void;
 }
 
 interface WasmApi {
   initialize_canvas: (width: number, height: number) => void;
-  render: () => void;
+  initialize_canvas_with_backend: (width: number, height: number, backend: number) => void;
+  render: () => boolean;
   on_mouse_down: (x: number, y: number, button: number) => void;
   on_mouse_move: (x: number, y: number) => void;
   on_mouse_up: (x: number, y: number, button: number) => void;
@@ -20,8 +25,37 @@ interface WasmApi {
   set_canvas_background: (r: number, g: number, b: number, a: number) => void;
   set_grid_settings: (show: boolean, size: number, r?: number, g?: number, b?: number, a?: number) => void;
   set_grid_settings_with_color: (show: boolean, size: number, r: number, g: number, b: number, a: number) => void;
+  set_snapping: (toGrid: boolean, toShapes: boolean) => void;
   set_zoom_level: (zoom: number) => void;
   zoom_at_point: (zoom: number, x: number, y: number) => void;
+  get_input_queue: () => number;
+  drain_input: () => void;
+  set_raster_threads: (threads: number) => number;
+  undo: () => boolean;
+  redo: () => boolean;
+  set_history_budget: (bytes: number) => void;
+  set_selected_shape_color: (r: number, g: number, b: number, a: number) => boolean;
+  reserve_scene_buffer: (bytes: number) => number;
+  load_scene: (data: number, size: number) => boolean;
+  save_scene: () => number;
+  get_scene_buffer: () => number;
+  import_svg: (data: number, size: number) => number;
+  add_shapes: (rects: number, colors: number, types: number, count: number) => number;
+  remove_shapes: (firstId: number, count: number) => number;
+  export_begin: (format: number, x: number, y: number, w: number, h: number, scale: number) => boolean;
+  export_step: () => number;
+  export_chunk: () => number;
+  export_progress: () => number;
+  export_cancel: () => void;
+  get_frame_stats: () => number;
+  get_scene_view: () => number;
+  drain_changes: () => number;
+  start_trace: () => void;
+  stop_trace: () => number;
+  get_trace_buffer: () => number;
+  delete_selection: () => number;
+  restack_selection: (op: number) => number;
+  get_selection_count: () => number;
 }
 
 // Global state
@@ -34,9 +68,13 @@ const placeholderApi: WasmApi = {
   initialize_canvas: (width: number, height: number) => {
     console.log(`PLACEHOLDER: initialize_canvas(${width}, ${height}) - WASM not loaded`);
   },
+  initialize_canvas_with_backend: (width: number, height: number, backend: number) => {
+    console.log(`PLACEHOLDER: initialize_canvas_with_backend(${width}, ${height}, ${backend}) - WASM not loaded`);
+  },
   render: () => {
     // In a real-world scenario, this function in C++ would be filled
     // with WebGL calls to draw the scene.
+    return false;
   },
   on_mouse_down: (x: number, y: number, button: number) => console.log(`PLACEHOLDER: on_mouse_down(${x}, ${y}, ${button}) - WASM not loaded`),
   on_mouse_move: (x: number, y: number) => { /* Do nothing */ },
@@ -48,13 +86,253 @@ const placeholderApi: WasmApi = {
   set_canvas_background: (r: number, g: number, b: number, a: number) => console.log(`PLACEHOLDER: set_canvas_background(${r}, ${g}, ${b}, ${a}) - WASM not loaded`),
   set_grid_settings: (show: boolean, size: number, r?: number, g?: number, b?: number, a?: number) => console.log(`PLACEHOLDER: set_grid_settings(${show}, ${size}, ${r}, ${g}, ${b}, ${a}) - WASM not loaded`),
   set_grid_settings_with_color: (show: boolean, size: number, r: number, g: number, b: number, a: number) => console.log(`PLACEHOLDER: set_grid_settings_with_color(${show}, ${size}, ${r}, ${g}, ${b}, ${a}) - WASM not loaded`),
+  set_snapping: (toGrid: boolean, toShapes: boolean) => console.log(`PLACEHOLDER: set_snapping(${toGrid}, ${toShapes}) - WASM not loaded`),
   set_zoom_level: (zoom: number) => console.log(`PLACEHOLDER: set_zoom_level(${zoom}) - WASM not loaded`),
   zoom_at_point: (zoom: number, x: number, y: number) => console.log(`PLACEHOLDER: zoom_at_point(${zoom}, ${x}, ${y}) - WASM not loaded`),
+  get_input_queue: () => 0,
+  drain_input: () => { /* Do nothing */ },
+  set_raster_threads: () => 0,
+  undo: () => false,
+  redo: () => false,
+  set_history_budget: (bytes: number) => console.log(`PLACEHOLDER: set_history_budget(${bytes}) - WASM not loaded`),
+  set_selected_shape_color: (r: number, g: number, b: number, a: number) => {
+    console.log(`PLACEHOLDER: set_selected_shape_color(${r}, ${g}, ${b}, ${a}) - WASM not loaded`);
+    return false;
+  },
+  reserve_scene_buffer: () => 0,
+  load_scene: () => false,
+  save_scene: () => 0,
+  get_scene_buffer: () => 0,
+  import_svg: () => 0,
+  add_shapes: () => -1,
+  remove_shapes: () => 0,
+  export_begin: () => false,
+  export_step: () => -1,
+  export_chunk: () => 0,
+  export_progress: () => 1,
+  export_cancel: () => {},
+  get_frame_stats: () => 0,
+  get_scene_view: () => 0,
+  drain_changes: () => 0,
+  start_trace: () => {},
+  stop_trace: () => 0,
+  get_trace_buffer: () => 0,
+  delete_selection: () => 0,
+  restack_selection: () => 0,
+  get_selection_count: () => 0,
 };
 
 // Current API - starts with placeholders, gets replaced when WASM loads
 let currentApi: WasmApi = { ...placeholderApi };
 
+// === INPUT QUEUE ===
+// Pointer events and keys are written straight into the engine's ring buffer
+// in WASM linear memory (see cpp/includes/input_queue.h) instead of crossing
+// into WASM per event. The engine drains it once per render().
+const INPUT_HEADER_WORDS = 4; // capacity, write_index, read_index, reserved
+const INPUT_EVENT_WORDS = 4;  // type, x, y, value
+
+const InputEventType = {
+  MouseDown: 1,
+  MouseMove: 2,
+  MouseUp: 3,
+  KeyDown: 4,
+  Zoom: 5,
+} as const;
+
+// Mirrors ExportFormat in cpp/includes/export.h
+export const ExportFormat = {
+  Png: 0,
+  Svg: 1,
+} as const;
+
+// Mirrors FrameStat in cpp/includes/frame_stats.h: word offsets in a frame
+export const FrameStat = {
+  Frame: 0,
+  TotalUs: 1,
+  InputUs: 2,
+  BackgroundUs: 3,
+  GridUs: 4,
+  ShapesUs: 5,
+  SelectionUs: 6,
+  CompositeUs: 7,
+  PresentUs: 8,
+  DrawCalls: 9,
+  ShapesVisited: 10,
+  ShapesCulled: 11,
+  TilesRasterized: 12,
+  DamageRects: 13,
+  HitTests: 14,
+  InputEvents: 15,
+} as const;
+
+export const FRAME_STATS_HEADER_WORDS = 4; // capacity, stat_count, write_index, reserved
+
+// Mirrors ChangeKind in cpp/includes/scene_view.h
+export const ChangeKind = {
+  Created: 1 << 0,
+  Moved: 1 << 1,
+  Recolored: 1 << 2,
+  Restacked: 1 << 3,
+  Deleted: 1 << 4,
+  Selected: 1 << 5,
+} as const;
+
+// Mirrors SceneView in cpp/includes/scene_view.h: column_count, shape_count,
+// change_count, reset and the changes pointer, then data, count and stride
+// for each column in SceneColumn order
+const SCENE_VIEW_HEADER_WORDS = 5;
+const SCENE_VIEW_COLUMN_WORDS = 3;
+const SCENE_COLUMN_COUNT = 9;
+
+/**
+ * Typed array views straight over the engine's shape columns, one entry per
+ * shape at the same dense index. Dense order is not stacking order; sort by
+ * z for that.
+ */
+export interface SceneColumns {
+  count: number;
+  x: Int32Array;
+  y: Int32Array;
+  w: Int32Array;
+  h: Int32Array;
+  color: Uint8Array; // r, g, b, a per shape
+  type: Uint8Array;
+  flags: Uint8Array;
+  z: BigUint64Array;
+  id: Uint32Array;
+}
+
+/**
+ * Called once per frame with the shapes changed during it as (id, ChangeKind
+ * bits) word pairs. When reset is true the changes could not be listed and
+ * every column should be read again. The array is a view into WASM memory,
+ * good only until the listener returns.
+ */
+export type SceneChangeListener = (changes: Uint32Array, reset: boolean) => void;
+
+// Mirrors RenderBackend in cpp/includes/canvas.h
+export const RenderBackend = {
+  Sdl: 0,
+  Software: 1,
+  Geometry: 2,
+} as const;
+
+// Mirrors StackOp in cpp/includes/canvas.h
+export const StackOp = {
+  ToFront: 0,
+  Forward: 1,
+  Backward: 2,
+  ToBack: 3,
+} as const;
+
+export const KeyModifier = {
+  Ctrl: 1 << 0,
+  Shift: 1 << 1,
+  Alt: 1 << 2,
+  Meta: 1 << 3,
+} as const;
+
+// Mirrors key_code_from_name in cpp/input_queue.cpp
+const NAMED_KEY_CODES: Record<string, number> = {
+  Backspace: 8,
+  Tab: 9,
+  Enter: 13,
+  Escape: 27,
+  Delete: 127,
+  ArrowLeft: 0x110000,
+  ArrowRight: 0x110001,
+  ArrowUp: 0x110002,
+  ArrowDown: 0x110003,
+  Home: 0x110004,
+  End: 0x110005,
+};
+
+function keyCodeFromName(key: string): number {
+  const codePoint = key.codePointAt(0);
+  if (codePoint !== undefined && String.fromCodePoint(codePoint) === key) {
+    return codePoint;
+  }
+  return NAMED_KEY_CODES[key] ?? 0;
+}
+
+let inputQueuePtr = 0;
+let frameStatsPtr = 0;
+let frameStatsView: Uint32Array | null = null;
+let sceneViewHeader: Uint32Array | null = null;
+let sceneColumns: SceneColumns | null = null;
+const sceneColumnWords = new Uint32Array(SCENE_COLUMN_COUNT * SCENE_VIEW_COLUMN_WORDS);
+const sceneChangeListeners = new Set<SceneChangeListener>();
+const floatBits = new Float32Array(1);
+const floatBitsAsInt = new Int32Array(floatBits.buffer);
+
+/**
+ * Appends one event to the engine's input ring. Returns false when the queue
+ * is not available, so callers can fall back to the direct exported call.
+ */
+function pushInputEvent(type: number, x: number, y: number, value: number): boolean {
+  if (!wasmInstance || !inputQueuePtr) {
+    return false;
+  }
+
+  // HEAP32 is re-read on every push because memory growth replaces it
+  let heap = wasmInstance.HEAP32;
+  const base = inputQueuePtr >> 2;
+  const capacity = heap[base];
+  if (((heap[base + 1] - heap[base + 2]) >>> 0) >= capacity) {
+    currentApi.drain_input();
+    heap = wasmInstance.HEAP32;
+  }
+
+  const write = heap[base + 1] >>> 0;
+  const slot = base + INPUT_HEADER_WORDS + (write & (capacity - 1)) * INPUT_EVENT_WORDS;
+  heap[slot] = type;
+  heap[slot + 1] = x | 0;
+  heap[slot + 2] = y | 0;
+  heap[slot + 3] = value | 0;
+  heap[base + 1] = (write + 1) | 0;
+  return true;
+}
+
+/**
+ * Header view of the engine's SceneView at ptr, cached until memory grows
+ */
+function sceneViewWords(ptr: number): Uint32Array | null {
+  if (!wasmInstance || !ptr) {
+    return null;
+  }
+  const buffer = wasmInstance.HEAPU8.buffer;
+  if (!sceneViewHeader || sceneViewHeader.buffer !== buffer || sceneViewHeader.byteOffset !== ptr) {
+    sceneViewHeader = new Uint32Array(
+      buffer, ptr, SCENE_VIEW_HEADER_WORDS + SCENE_COLUMN_COUNT * SCENE_VIEW_COLUMN_WORDS);
+  }
+  return sceneViewHeader;
+}
+
+/**
+ * Drains the engine's change journal and hands it to the listeners. Runs
+ * once per frame after render, and only while someone is listening.
+ */
+function dispatchSceneChanges(): void {
+  const words = sceneViewWords(currentApi.drain_changes());
+  if (!words || !wasmInstance) {
+    return;
+  }
+  const count = words[2];
+  const reset = words[3] !== 0;
+  if (count === 0 && !reset) {
+    return;
+  }
+  const changes = new Uint32Array(wasmInstance.HEAPU8.buffer, words[4], count * 2);
+  sceneChangeListeners.forEach((listener) => {
+    try {
+      listener(changes, reset);
+    } catch (error) {
+      console.error('Error in scene change listener:', error);
+    }
+  });
+}
+
 /**
  * Loads and initializes the WebAssembly module.
  * @param canvas - The HTMLCanvasElement to which the WASM module will render.
@@ -116,7 +394,8 @@ export async function initializeWasm(canvas: HTMLCanvasElement): Promise<boolean
     // Wrap exported functions
     const wrappedFunctions: WasmApi = {
       initialize_canvas: wasmInstance.cwrap('initialize_canvas', 'void', ['number', 'number']),
-      render: wasmInstance.cwrap('render', 'void', []),
+      initialize_canvas_with_backend: wasmInstance.cwrap('initialize_canvas_with_backend', 'void', ['number', 'number', 'number']),
+      render: wasmInstance.cwrap('render', 'boolean', []),
       on_mouse_down: wasmInstance.cwrap('on_mouse_down', 'void', ['number', 'number', 'number']),
       on_mouse_move: wasmInstance.cwrap('on_mouse_move', 'void', ['number', 'number']),
       on_mouse_up: wasmInstance.cwrap('on_mouse_up', 'void', ['number', 'number', 'number']),
@@ -125,8 +404,37 @@ export async function initializeWasm(canvas: HTMLCanvasElement): Promise<boolean
       set_canvas_background: wasmInstance.cwrap('set_canvas_background', 'void', ['number', 'number', 'number', 'number']),
       set_grid_settings: wasmInstance.cwrap('set_grid_settings', 'void', ['boolean', 'number']),
       set_grid_settings_with_color: wasmInstance.cwrap('set_grid_settings_with_color', 'void', ['boolean', 'number', 'number', 'number', 'number', 'number']),
+      set_snapping: wasmInstance.cwrap('set_snapping', 'void', ['boolean', 'boolean']),
       set_zoom_level: wasmInstance.cwrap('set_zoom_level', 'void', ['number']),
       zoom_at_point: wasmInstance.cwrap('zoom_at_point', 'void', ['number', 'number', 'number']),
+      get_input_queue: wasmInstance.cwrap('get_input_queue', 'number', []),
+      drain_input: wasmInstance.cwrap('drain_input', 'void', []),
+      set_raster_threads: wasmInstance.cwrap('set_raster_threads', 'number', ['number']),
+      undo: wasmInstance.cwrap('undo', 'boolean', []),
+      redo: wasmInstance.cwrap('redo', 'boolean', []),
+      set_history_budget: wasmInstance.cwrap('set_history_budget', 'void', ['number']),
+      set_selected_shape_color: wasmInstance.cwrap('set_selected_shape_color', 'boolean', ['number', 'number', 'number', 'number']),
+      reserve_scene_buffer: wasmInstance.cwrap('reserve_scene_buffer', 'number', ['number']),
+      load_scene: wasmInstance.cwrap('load_scene', 'boolean', ['number', 'number']),
+      save_scene: wasmInstance.cwrap('save_scene', 'number', []),
+      get_scene_buffer: wasmInstance.cwrap('get_scene_buffer', 'number', []),
+      import_svg: wasmInstance.cwrap('import_svg', 'number', ['number', 'number']),
+      add_shapes: wasmInstance.cwrap('add_shapes', 'number', ['number', 'number', 'number', 'number']),
+      remove_shapes: wasmInstance.cwrap('remove_shapes', 'number', ['number', 'number']),
+      export_begin: wasmInstance.cwrap('export_begin', 'boolean', ['number', 'number', 'number', 'number', 'number', 'number']),
+      export_step: wasmInstance.cwrap('export_step', 'number', []),
+      export_chunk: wasmInstance.cwrap('export_chunk', 'number', []),
+      export_progress: wasmInstance.cwrap('export_progress', 'number', []),
+      export_cancel: wasmInstance.cwrap('export_cancel', null, []),
+      get_frame_stats: wasmInstance.cwrap('get_frame_stats', 'number', []),
+      get_scene_view: wasmInstance.cwrap('get_scene_view', 'number', []),
+      drain_changes: wasmInstance.cwrap('drain_changes', 'number', []),
+      start_trace: wasmInstance.cwrap('start_trace', null, []),
+      stop_trace: wasmInstance.cwrap('stop_trace', 'number', []),
+      get_trace_buffer: wasmInstance.cwrap('get_trace_buffer', 'number', []),
+      delete_selection: wasmInstance.cwrap('delete_selection', 'number', []),
+      restack_selection: wasmInstance.cwrap('restack_selection', 'number', ['number']),
+      get_selection_count: wasmInstance.cwrap('get_selection_count', 'number', []),
     };
 
     currentApi = wrappedFunctions;
@@ -152,7 +460,8 @@ export function isWasmInitialized(): boolean {
 }
 
 /**
- * Start the render loop
+ * Start the render loop. The engine tracks damage itself, so frames where
+ * nothing changed return early from render() without drawing.
  */
 export function startRenderLoop(): void {
   if (renderLoopId) {
@@ -164,6 +473,9 @@ export function startRenderLoop(): void {
       if (typeof currentApi.render === 'function') {
         currentApi.render();
       }
+      if (sceneChangeListeners.size > 0) {
+        dispatchSceneChanges();
+      }
     } catch (error) {
       console.error("Error in render loop:", error);
     }
@@ -187,9 +499,22 @@ export function stopRenderLoop(): void {
  * The main API for interacting with the WASM module.
  */
 export const wasmApi = {
-  initializeCanvas: (width: number, height: number) => {
+  initializeCanvas: (width: number, height: number, backend?: number) => {
     try {
-      currentApi.initialize_canvas(width, height);
+      if (backend === undefined) {
+        currentApi.initialize_canvas(width, height);
+      } else {
+        currentApi.initialize_canvas_with_backend(width, height, backend);
+        // Parallel tile rasterization needs a pthreads build on an isolated page
+        if (backend === RenderBackend.Software && globalThis.crossOriginIsolated) {
+          currentApi.set_raster_threads((navigator.hardwareConcurrency || 1) - 1);
+        }
+      }
+      inputQueuePtr = currentApi.get_input_queue();
+      frameStatsPtr = currentApi.get_frame_stats();
+      frameStatsView = null;
+      sceneViewHeader = null;
+      sceneColumns = null;
     } catch (error) {
       console.error('Error in initializeCanvas:', error);
     }
@@ -209,28 +534,36 @@ export const wasmApi = {
   },
   onMouseDown: (x: number, y: number, button: number) => {
     try {
-      currentApi.on_mouse_down(x, y, button);
+      if (!pushInputEvent(InputEventType.MouseDown, x, y, button)) {
+        currentApi.on_mouse_down(x, y, button);
+      }
     } catch (error) {
       console.error('Error in onMouseDown:', error);
     }
   },
   onMouseMove: (x: number, y: number) => {
     try {
-      currentApi.on_mouse_move(x, y);
+      if (!pushInputEvent(InputEventType.MouseMove, x, y, 0)) {
+        currentApi.on_mouse_move(x, y);
+      }
     } catch (error) {
       console.error('Error in onMouseMove:', error);
     }
   },
   onMouseUp: (x: number, y: number, button: number) => {
     try {
-      currentApi.on_mouse_up(x, y, button);
+      if (!pushInputEvent(InputEventType.MouseUp, x, y, button)) {
+        currentApi.on_mouse_up(x, y, button);
+      }
     } catch (error) {
       console.error('Error in onMouseUp:', error);
     }
   },
-  onKeyDown: (key: string) => {
+  onKeyDown: (key: string, modifiers: number = 0) => {
     try {
-      currentApi.on_key_down(key);
+      if (!pushInputEvent(InputEventType.KeyDown, keyCodeFromName(key), modifiers, 0)) {
+        currentApi.on_key_down(key);
+      }
     } catch (error) {
       console.error('Error in onKeyDown:', error);
     }
@@ -260,6 +593,15 @@ export const wasmApi = {
       console.error('Error in setGridSettings:', error);
     }
   },
+  setSnapping: (toGrid: boolean, toShapes: boolean) => {
+    try {
+      // Queued drag samples snap with the settings they were made under
+      currentApi.drain_input();
+      currentApi.set_snapping(toGrid, toShapes);
+    } catch (error) {
+      console.error('Error in setSnapping:', error);
+    }
+  },
   setZoomLevel: (zoom: number) => {
     try {
       const zoomFactor = zoom / 100.0;
@@ -275,6 +617,10 @@ export const wasmApi = {
   zoomAtPoint: (zoom: number, x: number, y: number) => {
     try {
       const zoomFactor = zoom / 100.0;
+      floatBits[0] = zoomFactor;
+      if (pushInputEvent(InputEventType.Zoom, x, y, floatBitsAsInt[0])) {
+        return;
+      }
       if (typeof currentApi.zoom_at_point === 'function') {
         currentApi.zoom_at_point(zoomFactor, x, y);
       } else {
@@ -284,6 +630,340 @@ export const wasmApi = {
       console.error('Error in zoomAtPoint:', error);
     }
   },
+  // Ctrl+Z / Ctrl+Shift+Z reach the engine as keys; these are for toolbar buttons
+  undo: (): boolean => {
+    try {
+      currentApi.drain_input();
+      return currentApi.undo();
+    } catch (error) {
+      console.error('Error in undo:', error);
+      return false;
+    }
+  },
+  redo: (): boolean => {
+    try {
+      currentApi.drain_input();
+      return currentApi.redo();
+    } catch (error) {
+      console.error('Error in redo:', error);
+      return false;
+    }
+  },
+  setHistoryBudget: (bytes: number) => {
+    try {
+      currentApi.set_history_budget(bytes);
+    } catch (error) {
+      console.error('Error in setHistoryBudget:', error);
+    }
+  },
+  setSelectedShapeColor: (r: number, g: number, b: number, a: number): boolean => {
+    try {
+      currentApi.drain_input();
+      return currentApi.set_selected_shape_color(r, g, b, a);
+    } catch (error) {
+      console.error('Error in setSelectedShapeColor:', error);
+      return false;
+    }
+  },
+  deleteSelection: (): number => {
+    try {
+      currentApi.drain_input();
+      return currentApi.delete_selection();
+    } catch (error) {
+      console.error('Error in deleteSelection:', error);
+      return 0;
+    }
+  },
+  restackSelection: (op: number): number => {
+    try {
+      currentApi.drain_input();
+      return currentApi.restack_selection(op);
+    } catch (error) {
+      console.error('Error in restackSelection:', error);
+      return 0;
+    }
+  },
+  getSelectionCount: (): number => {
+    try {
+      currentApi.drain_input();
+      return currentApi.get_selection_count();
+    } catch (error) {
+      console.error('Error in getSelectionCount:', error);
+      return 0;
+    }
+  },
+  /**
+   * Replaces the document with a saved scene (see cpp/includes/scene_file.h).
+   * The bytes are copied once into the engine's scene buffer and loaded
+   * column by column from there. Returns false and keeps the current
+   * document if the data is not a valid scene.
+   */
+  loadScene: (bytes: Uint8Array): boolean => {
+    try {
+      if (!wasmInstance || bytes.length === 0) {
+        return false;
+      }
+      currentApi.drain_input();
+      const ptr = currentApi.reserve_scene_buffer(bytes.length);
+      if (!ptr) {
+        return false;
+      }
+      // Read HEAPU8 after reserving, which may have grown memory
+      wasmInstance.HEAPU8.set(bytes, ptr);
+      return currentApi.load_scene(ptr, bytes.length);
+    } catch (error) {
+      console.error('Error in loadScene:', error);
+      return false;
+    }
+  },
+  /**
+   * Serializes the document. Only chunks changed since the last save or load
+   * are re-encoded; the result is a copy the caller owns.
+   */
+  saveScene: (): Uint8Array | null => {
+    try {
+      if (!wasmInstance) {
+        return null;
+      }
+      currentApi.drain_input();
+      const size = currentApi.save_scene();
+      const ptr = currentApi.get_scene_buffer();
+      return ptr ? wasmInstance.HEAPU8.slice(ptr, ptr + size) : null;
+    } catch (error) {
+      console.error('Error in saveScene:', error);
+      return null;
+    }
+  },
+  /**
+   * Adds the rects, circles and ellipses of an SVG document to the scene.
+   * The text is encoded straight into WASM memory and parsed in one pass
+   * there. Returns the number of shapes added.
+   */
+  importSvg: (svg: string | Uint8Array): number => {
+    try {
+      if (!wasmInstance) {
+        return 0;
+      }
+      const bytes = typeof svg === 'string' ? new TextEncoder().encode(svg) : svg;
+      if (bytes.length === 0) {
+        return 0;
+      }
+      currentApi.drain_input();
+      const ptr = wasmInstance._malloc(bytes.length);
+      if (!ptr) {
+        return 0;
+      }
+      try {
+        wasmInstance.HEAPU8.set(bytes, ptr);
+        return currentApi.import_svg(ptr, bytes.length);
+      } finally {
+        wasmInstance._free(ptr);
+      }
+    } catch (error) {
+      console.error('Error in importSvg:', error);
+      return 0;
+    }
+  },
+  /**
+   * Adds types.length shapes in one call and one undo step: x, y, w, h per
+   * shape in rects, r, g, b, a per shape in colors and a ShapeType per shape
+   * in types. The columns are copied into WASM memory as one block. Returns
+   * the id of the first shape, the others following in order, or -1 when
+   * nothing was added.
+   */
+  addShapes: (rects: Int32Array, colors: Uint8Array, types: Uint8Array): number => {
+    try {
+      const count = types.length;
+      if (!wasmInstance || count === 0 || rects.length < count * 4 || colors.length < count * 4) {
+        return -1;
+      }
+      currentApi.drain_input();
+      const ptr = wasmInstance._malloc(count * 21);
+      if (!ptr) {
+        return -1;
+      }
+      try {
+        // Rects first, keeping them 4-byte aligned
+        const heap = wasmInstance.HEAPU8;
+        heap.set(new Uint8Array(rects.buffer, rects.byteOffset, count * 16), ptr);
+        heap.set(colors.subarray(0, count * 4), ptr + count * 16);
+        heap.set(types, ptr + count * 20);
+        return currentApi.add_shapes(ptr, ptr + count * 16, ptr + count * 20, count);
+      } finally {
+        wasmInstance._free(ptr);
+      }
+    } catch (error) {
+      console.error('Error in addShapes:', error);
+      return -1;
+    }
+  },
+  /**
+   * Deletes the shapes with ids firstId to firstId + count - 1 as one undo
+   * step. Returns how many existed.
+   */
+  removeShapes: (firstId: number, count: number): number => {
+    try {
+      currentApi.drain_input();
+      return currentApi.remove_shapes(firstId, count);
+    } catch (error) {
+      console.error('Error in removeShapes:', error);
+      return 0;
+    }
+  },
+  /**
+   * Exports a world-space region at scale output pixels per world unit.
+   * The engine produces the file one band (PNG) or batch of shapes (SVG) at
+   * a time and this yields to the event loop between pieces, so the canvas
+   * stays interactive without WASM threads. Pieces go to write when given,
+   * otherwise they are collected into the returned Blob. One export runs at
+   * a time; returns null if it could not start or was cancelled.
+   */
+  exportImage: async (
+    format: number,
+    region: { x: number; y: number; width: number; height: number },
+    scale: number,
+    options: { write?: (chunk: Uint8Array) => void | Promise<void>; onProgress?: (fraction: number) => void } = {},
+  ): Promise<Blob | null> => {
+    try {
+      if (!wasmInstance) {
+        return null;
+      }
+      currentApi.drain_input();
+      if (!currentApi.export_begin(format, region.x, region.y, region.width, region.height, scale)) {
+        return null;
+      }
+      const parts: Uint8Array[] = [];
+      for (;;) {
+        const size = currentApi.export_step();
+        if (size < 0) {
+          break;
+        }
+        // Copy out before yielding: the next step reuses the buffer
+        const ptr = currentApi.export_chunk();
+        const chunk = wasmInstance.HEAPU8.slice(ptr, ptr + size);
+        options.onProgress?.(currentApi.export_progress());
+        if (options.write) {
+          await options.write(chunk);
+        } else {
+          parts.push(chunk);
+        }
+        await new Promise((resolve) => setTimeout(resolve, 0));
+        if (!currentApi.export_chunk()) {
+          return null; // Cancelled
+        }
+      }
+      return new Blob(parts, { type: format === ExportFormat.Svg ? 'image/svg+xml' : 'image/png' });
+    } catch (error) {
+      currentApi.export_cancel();
+      console.error('Error in exportImage:', error);
+      return null;
+    }
+  },
+  cancelExport: () => {
+    try {
+      currentApi.export_cancel();
+    } catch (error) {
+      console.error('Error in cancelExport:', error);
+    }
+  },
+  /**
+   * Live view of the engine's ring of recent frame stats. The view is cached
+   * and only recreated when WASM memory grows, so polling it every frame
+   * allocates nothing. Frame n starts at word
+   * FRAME_STATS_HEADER_WORDS + (n % capacity) * stat_count; the newest frame
+   * is write_index - 1.
+   */
+  getFrameStats: (): Uint32Array | null => {
+    if (!wasmInstance || !frameStatsPtr) {
+      return null;
+    }
+    const buffer = wasmInstance.HEAPU8.buffer;
+    if (!frameStatsView || frameStatsView.buffer !== buffer) {
+      const header = new Uint32Array(buffer, frameStatsPtr, FRAME_STATS_HEADER_WORDS);
+      frameStatsView = new Uint32Array(buffer, frameStatsPtr, FRAME_STATS_HEADER_WORDS + header[0] * header[1]);
+    }
+    return frameStatsView;
+  },
+  /**
+   * Zero-copy views over the shape columns. The views are cached and only
+   * rebuilt when a column moved or memory grew, which can follow any edit,
+   * so fetch them again after each batch of changes rather than keeping them.
+   */
+  getSceneColumns: (): SceneColumns | null => {
+    try {
+      currentApi.drain_input();
+      const words = sceneViewWords(currentApi.get_scene_view());
+      if (!words || !wasmInstance) {
+        return null;
+      }
+      const buffer = wasmInstance.HEAPU8.buffer;
+      const columns = words.subarray(SCENE_VIEW_HEADER_WORDS);
+      let moved = !sceneColumns || sceneColumns.x.buffer !== buffer;
+      for (let i = 0; i < columns.length; ++i) {
+        moved = moved || sceneColumnWords[i] !== columns[i];
+      }
+      if (moved) {
+        sceneColumnWords.set(columns);
+        const count = words[1];
+        const at = (column: number) => columns[column * SCENE_VIEW_COLUMN_WORDS];
+        sceneColumns = {
+          count,
+          x: new Int32Array(buffer, at(0), count),
+          y: new Int32Array(buffer, at(1), count),
+          w: new Int32Array(buffer, at(2), count),
+          h: new Int32Array(buffer, at(3), count),
+          color: new Uint8Array(buffer, at(4), count * 4),
+          type: new Uint8Array(buffer, at(5), count),
+          flags: new Uint8Array(buffer, at(6), count),
+          z: new BigUint64Array(buffer, at(7), count),
+          id: new Uint32Array(buffer, at(8), count),
+        };
+      }
+      return sceneColumns;
+    } catch (error) {
+      console.error('Error in getSceneColumns:', error);
+      return null;
+    }
+  },
+  /**
+   * Calls listener from the render loop with each frame's changed shapes.
+   * Returns a function that unsubscribes it.
+   */
+  subscribeToSceneChanges: (listener: SceneChangeListener): (() => void) => {
+    sceneChangeListeners.add(listener);
+    return () => {
+      sceneChangeListeners.delete(listener);
+    };
+  },
+  /**
+   * Starts recording every call that drives the canvas, from a snapshot of
+   * the current scene, selection and view. Start between interactions, not
+   * in the middle of a drag.
+   */
+  startTrace: () => {
+    try {
+      currentApi.start_trace();
+    } catch (error) {
+      console.error('Error in startTrace:', error);
+    }
+  },
+  /**
+   * Ends the recording and returns the trace, a copy the caller owns, for
+   * the native replayer (build-native/vectormate_replay).
+   */
+  stopTrace: (): Uint8Array | null => {
+    try {
+      if (!wasmInstance) {
+        return null;
+      }
+      const size = currentApi.stop_trace();
+      const ptr = currentApi.get_trace_buffer();
+      return ptr && size ? wasmInstance.HEAPU8.slice(ptr, ptr + size) : null;
+    } catch (error) {
+      console.error('Error in stopTrace:', error);
+      return null;
+    }
+  },
   // Debug function to manually trigger a draw
   debugDraw: () => {
     try {